@@ -40,6 +40,67 @@ inline void Normalize(const AudioFrame<int32_t>& in, AudioFrame<float>& out)
     out.right = (float)in.right * DIV_REC;
 }
 
+// Sample type wide enough to sum any number of sources (up to 65536) of type T without overflowing.
+template <typename T>
+struct AudioAccumulator;
+
+template <>
+struct AudioAccumulator<int16_t>
+{
+    using type = int32_t;
+};
+
+template <>
+struct AudioAccumulator<int32_t>
+{
+    using type = int64_t;
+};
+
+template <>
+struct AudioAccumulator<float>
+{
+    using type = float;
+};
+
+template <typename T>
+using AudioAccumulatorT = typename AudioAccumulator<T>::type;
+
+// Adds `count` frames of `src` to `dest` without clipping.
+inline void AccumulateFrames(AudioFrame<int32_t>* dest, const AudioFrame<int16_t>* src, size_t count)
+{
+    HorizontalAddWidenI16(&dest->left, &src->left, &src->left + 2 * count);
+}
+
+inline void AccumulateFrames(AudioFrame<int64_t>* dest, const AudioFrame<int32_t>* src, size_t count)
+{
+    HorizontalAddWidenI32(&dest->left, &src->left, &src->left + 2 * count);
+}
+
+inline void AccumulateFrames(AudioFrame<float>* dest, const AudioFrame<float>* src, size_t count)
+{
+    HorizontalAddF32(&dest->left, &src->left, &src->left + 2 * count);
+}
+
+// Clamps `count` accumulated frames to the range of the output type.
+inline void NarrowFrames(AudioFrame<int16_t>* dest, const AudioFrame<int32_t>* src, size_t count)
+{
+    NarrowSatI32ToI16(&dest->left, &src->left, &src->left + 2 * count);
+}
+
+inline void NarrowFrames(AudioFrame<int32_t>* dest, const AudioFrame<int64_t>* src, size_t count)
+{
+    NarrowSatI64ToI32(&dest->left, &src->left, &src->left + 2 * count);
+}
+
+inline void NarrowFrames(AudioFrame<float>* dest, const AudioFrame<float>* src, size_t count)
+{
+    // float has enough headroom; clipping is left to whatever consumes the output
+    for (size_t i = 0; i < count; ++i)
+    {
+        dest[i] = src[i];
+    }
+}
+
 inline void MixFrame(AudioFrame<int16_t>& dest, const AudioFrame<int16_t>& src)
 {
     dest.left  = SaturatingAdd(dest.left, src.left);
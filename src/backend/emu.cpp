@@ -38,8 +38,10 @@
 #include "pcm.h"
 #include "submcu.h"
 #include <bit>
+#include <cstring>
 #include <fstream>
 #include <span>
+#include <type_traits>
 #include <vector>
 
 Emulator::~Emulator()
@@ -109,6 +111,7 @@ bool Emulator::LoadRoms(Romset romset, const AllRomsetInfo& all_info, RomLocatio
     }
 
     MCU_SetRomset(GetMCU(), romset);
+    PCM_UpdateWaveBanks(GetPCM());
 
     const RomsetInfo& info = all_info.romsets[(size_t)romset];
 
@@ -157,6 +160,11 @@ void Emulator::PostMIDI(std::span<const uint8_t> data)
     }
 }
 
+void Emulator::PostMIDIAt(uint64_t cycle, std::span<const uint8_t> data)
+{
+    m_timed_midi.Push(cycle, data);
+}
+
 constexpr uint8_t GM_RESET_SEQ[] = { 0xF0, 0x7E, 0x7F, 0x09, 0x01, 0xF7 };
 constexpr uint8_t GS_RESET_SEQ[] = { 0xF0, 0x41, 0x10, 0x42, 0x12, 0x40, 0x00, 0x7F, 0x00, 0x41, 0xF7 };
 
@@ -178,9 +186,249 @@ void Emulator::PostSystemReset(EMU_SystemReset reset)
 
 void Emulator::Step()
 {
+    if (m_mcu->cycles >= m_timed_midi.GetNextCycle())
+    {
+        // Only hand over what the UART buffer can hold; the rest is retried on later steps as the firmware reads it.
+        m_timed_midi.Release(m_mcu->cycles, MCU_GetUARTFreeSpace(*m_mcu), [this](uint8_t byte) {
+            MCU_PostUART(*m_mcu, byte);
+        });
+    }
+
     MCU_Step(*m_mcu);
 }
 
+// Appends fields to a byte buffer.
+class EMU_StateWriter
+{
+public:
+    explicit EMU_StateWriter(std::vector<uint8_t>& out)
+        : m_out(out)
+    {
+    }
+
+    template <typename T>
+    void operator()(T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const size_t offset = m_out.size();
+        m_out.resize(offset + sizeof(T));
+        memcpy(&m_out[offset], &value, sizeof(T));
+    }
+
+private:
+    std::vector<uint8_t>& m_out;
+};
+
+// Reads fields back in the same order EMU_StateWriter wrote them.
+class EMU_StateReader
+{
+public:
+    explicit EMU_StateReader(std::span<const uint8_t> in)
+        : m_in(in)
+    {
+    }
+
+    template <typename T>
+    void operator()(T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        memcpy(&value, &m_in[m_offset], sizeof(T));
+        m_offset += sizeof(T);
+    }
+
+private:
+    std::span<const uint8_t> m_in;
+    size_t                   m_offset = 0;
+};
+
+// Counts the bytes EMU_StateWriter would produce.
+class EMU_StateSizer
+{
+public:
+    template <typename T>
+    void operator()(T&)
+    {
+        m_size += sizeof(T);
+    }
+
+    size_t GetSize() const
+    {
+        return m_size;
+    }
+
+private:
+    size_t m_size = 0;
+};
+
+// Bump this whenever the fields visited below change.
+constexpr uint32_t EMU_STATE_VERSION = 1;
+
+// Visits every field that makes up the state of a running emulator. Used for both saving and loading, so any new
+// field that changes at runtime must be added here. Roms, pointers between components and options set by the
+// frontend are deliberately left out.
+template <typename Archive>
+void EMU_VisitState(mcu_t& mcu, submcu_t& sm, mcu_timer_t& timer, lcd_t& lcd, pcm_t& pcm, Archive& ar)
+{
+    uint32_t version = EMU_STATE_VERSION;
+    ar(version);
+    ar(mcu.romset);
+
+    ar(mcu.r);
+    ar(mcu.pc);
+    ar(mcu.sr);
+    ar(mcu.cp);
+    ar(mcu.dp);
+    ar(mcu.ep);
+    ar(mcu.tp);
+    ar(mcu.br);
+    ar(mcu.sleep);
+    ar(mcu.ex_ignore);
+    ar(mcu.exception_pending);
+    ar(mcu.interrupt_pending);
+    ar(mcu.trapa_pending);
+    ar(mcu.cycles);
+    ar(mcu.ram);
+    ar(mcu.sram);
+    ar(mcu.nvram);
+    ar(mcu.cardram);
+    ar(mcu.dev_register);
+    ar(mcu.ad_val);
+    ar(mcu.ad_nibble);
+    ar(mcu.sw_pos);
+    ar(mcu.io_sd);
+    ar(mcu.uart_write_ptr);
+    ar(mcu.uart_read_ptr);
+    ar(mcu.uart_buffer);
+    ar(mcu.uart_rx_byte);
+    ar(mcu.uart_rx_delay);
+    ar(mcu.uart_tx_delay);
+    ar(mcu.ga_int);
+    ar(mcu.ga_int_enable);
+    ar(mcu.ga_int_trigger);
+    ar(mcu.ga_lcd_counter);
+    uint32_t button_pressed = mcu.button_pressed.load();
+    ar(button_pressed);
+    mcu.button_pressed.store(button_pressed);
+    ar(mcu.p0_data);
+    ar(mcu.p1_data);
+    ar(mcu.adf_rd);
+    ar(mcu.analog_end_time);
+    ar(mcu.ssr_rd);
+    ar(mcu.operand_type);
+    ar(mcu.operand_ea);
+    ar(mcu.operand_ep);
+    ar(mcu.operand_size);
+    ar(mcu.operand_reg);
+    ar(mcu.operand_status);
+    ar(mcu.operand_data);
+    ar(mcu.opcode_extended);
+
+    ar(sm.pc);
+    ar(sm.a);
+    ar(sm.x);
+    ar(sm.y);
+    ar(sm.s);
+    ar(sm.sr);
+    ar(sm.cycles);
+    ar(sm.sleep);
+    ar(sm.ram);
+    ar(sm.shared_ram);
+    ar(sm.access);
+    ar(sm.p0_dir);
+    ar(sm.p1_dir);
+    ar(sm.device_mode);
+    ar(sm.cts);
+    ar(sm.timer_cycles);
+    ar(sm.timer_prescaler);
+    ar(sm.timer_counter);
+    ar(sm.uart_rx_gotbyte);
+
+    ar(timer.cycles);
+    ar(timer.frt);
+    ar(timer.tmr);
+    ar(timer.tempreg);
+
+    ar(lcd.LCD_DL);
+    ar(lcd.LCD_N);
+    ar(lcd.LCD_F);
+    ar(lcd.LCD_D);
+    ar(lcd.LCD_C);
+    ar(lcd.LCD_B);
+    ar(lcd.LCD_ID);
+    ar(lcd.LCD_S);
+    ar(lcd.LCD_DD_RAM);
+    ar(lcd.LCD_AC);
+    ar(lcd.LCD_CG_RAM);
+    ar(lcd.LCD_RAM_MODE);
+    ar(lcd.LCD_Data);
+    ar(lcd.LCD_CG);
+    bool lcd_enable = lcd.enable.load();
+    ar(lcd_enable);
+    lcd.enable.store(lcd_enable);
+
+    ar(pcm.ram1);
+    ar(pcm.ram2);
+    ar(pcm.cycles);
+    ar(pcm.voice_mask);
+    ar(pcm.voice_mask_pending);
+    ar(pcm.write_latch);
+    ar(pcm.read_latch);
+    ar(pcm.wave_read_address);
+    ar(pcm.tv_counter);
+    ar(pcm.wave_byte_latch);
+    ar(pcm.select_channel);
+    ar(pcm.config_reg_3c);
+    ar(pcm.config_reg_3d);
+    ar(pcm.irq_channel);
+    ar(pcm.irq_assert);
+    ar(pcm.voice_mask_updating);
+    ar(pcm.nfs);
+    ar(pcm.accum_l);
+    ar(pcm.accum_r);
+    ar(pcm.rcsum);
+    ar(pcm.config);
+    ar(pcm.wave_bank_shift);
+    ar(pcm.eram);
+    ar(pcm.eram_unpacked);
+    ar(pcm.idle);
+    ar(pcm.idle_candidates);
+    ar(pcm.idle_frame);
+}
+
+void Emulator::SaveState(EMU_State& state)
+{
+    state.data.clear();
+    EMU_StateWriter writer(state.data);
+    EMU_VisitState(*m_mcu, *m_sm, *m_timer, *m_lcd, *m_pcm, writer);
+}
+
+bool Emulator::LoadState(const EMU_State& state)
+{
+    EMU_StateSizer sizer;
+    EMU_VisitState(*m_mcu, *m_sm, *m_timer, *m_lcd, *m_pcm, sizer);
+    if (state.data.size() != sizer.GetSize())
+    {
+        return false;
+    }
+
+    // The state starts with the version and romset; see EMU_VisitState.
+    uint32_t version;
+    Romset   romset;
+    memcpy(&version, &state.data[0], sizeof(version));
+    memcpy(&romset, &state.data[sizeof(version)], sizeof(romset));
+    if (version != EMU_STATE_VERSION || romset != m_mcu->romset)
+    {
+        return false;
+    }
+
+    EMU_StateReader reader(state.data);
+    EMU_VisitState(*m_mcu, *m_sm, *m_timer, *m_lcd, *m_pcm, reader);
+
+    // Scheduled bytes belong to the timeline that was just replaced.
+    m_timed_midi.Clear();
+    return true;
+}
+
 void Emulator::SaveNVRAM()
 {
     // emulator was constructed, but never init
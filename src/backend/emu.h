@@ -40,9 +40,11 @@
 #include "rom.h"
 #include "rom_io.h"
 #include "submcu.h"
+#include "timed_midi_queue.h"
 #include <filesystem>
 #include <memory>
 #include <span>
+#include <vector>
 
 struct EMU_Options
 {
@@ -60,6 +62,13 @@ enum class EMU_SystemReset {
     GM_RESET,
 };
 
+// Snapshot of everything in an emulator that changes while it runs. Roms and anything configured by `Init` or
+// `LoadRoms` are not included, so a snapshot can only be restored into an emulator that loaded the same romset.
+struct EMU_State
+{
+    std::vector<uint8_t> data;
+};
+
 struct Emulator {
 public:
     Emulator() = default;
@@ -100,10 +109,25 @@ public:
     void PostMIDI(uint8_t data_byte);
     void PostMIDI(std::span<const uint8_t> data);
 
+    // Schedules `data` to be posted when the MCU reaches `cycle` (see `mcu_t::cycles`). Bytes are handed to the UART
+    // by the first `Step` that starts at or after `cycle`, so their timing doesn't depend on when this is called.
+    // Bytes scheduled for a cycle that has already passed are posted by the next `Step`. If the UART buffer is full,
+    // bytes wait in the queue until the firmware has made room for them.
+    //
+    // Scheduled bytes are not part of `EMU_State`; `LoadState` discards any that haven't been posted yet.
+    void PostMIDIAt(uint64_t cycle, std::span<const uint8_t> data);
+
     void PostSystemReset(EMU_SystemReset reset);
 
     void Step();
 
+    // Captures the current state of the emulator into `state`.
+    void SaveState(EMU_State& state);
+
+    // Restores a state captured by `SaveState`. Returns false and leaves the emulator unchanged if `state` was captured
+    // from a different romset or build.
+    bool LoadState(const EMU_State& state);
+
     mcu_t& GetMCU() { return *m_mcu; }
     pcm_t& GetPCM() { return *m_pcm; }
     lcd_t& GetLCD() { return *m_lcd; }
@@ -123,5 +147,6 @@ private:
     std::unique_ptr<lcd_t>       m_lcd;
     std::unique_ptr<pcm_t>       m_pcm;
     EMU_Options                  m_options;
+    TimedMIDIQueue               m_timed_midi;
 };
 
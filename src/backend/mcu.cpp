@@ -869,6 +869,13 @@ void MCU_PostUART(mcu_t& mcu, uint8_t data)
     mcu.uart_write_ptr = (mcu.uart_write_ptr + 1) % uart_buffer_size;
 }
 
+uint32_t MCU_GetUARTFreeSpace(const mcu_t& mcu)
+{
+    // One slot stays empty so that a full buffer can be told apart from an empty one.
+    const uint32_t pending = (mcu.uart_write_ptr + uart_buffer_size - mcu.uart_read_ptr) % uart_buffer_size;
+    return uart_buffer_size - 1 - pending;
+}
+
 void MCU_UpdateUART_RX(mcu_t& mcu)
 {
     if ((mcu.dev_register[DEV_SCR] & 16) == 0) // RX disabled
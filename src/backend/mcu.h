@@ -561,5 +561,7 @@ void MCU_EncoderTrigger(mcu_t& mcu, int dir);
 
 void MCU_PostSample(mcu_t& mcu, const AudioFrame<int32_t>& frame);
 void MCU_PostUART(mcu_t& mcu, uint8_t data);
+// Number of bytes that can be posted before MCU_PostUART starts overwriting bytes the MCU hasn't read yet.
+uint32_t MCU_GetUARTFreeSpace(const mcu_t& mcu);
 
 void MCU_SetRomset(mcu_t& mcu, Romset romset);
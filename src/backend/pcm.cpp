@@ -38,40 +38,53 @@
 #include <cstdio>
 #include <cstring>
 
-uint8_t PCM_ReadROM(pcm_t& pcm, uint32_t address)
+static const uint8_t pcm_unmapped_bank[1] = {0};
+
+void PCM_UpdateWaveBanks(pcm_t& pcm)
 {
-    int bank;
-    if (pcm.config_reg_3d & 0x20)
-        bank = (address >> 21) & 7;
+    const bool is_mk1   = pcm.mcu->is_mk1;
+    const bool is_jv880 = pcm.mcu->is_jv880;
+
+    for (PCM_WaveBank& bank : pcm.wave_banks)
+    {
+        bank.data = pcm_unmapped_bank;
+        bank.mask = 0;
+    }
+
+    pcm.wave_banks[0].data = pcm.waverom1;
+    pcm.wave_banks[0].mask = is_mk1 ? 0xfffff : 0x1fffff;
+
+    pcm.wave_banks[1].data = pcm.waverom2;
+    pcm.wave_banks[1].mask = is_jv880 ? 0x1fffff : 0xfffff;
+
+    if (is_jv880)
+    {
+        pcm.wave_banks[2].data = pcm.waverom_card;
+        pcm.wave_banks[2].mask = 0x1fffff;
+
+        for (int bank = 3; bank <= 6; bank++)
+        {
+            pcm.wave_banks[bank].data = pcm.waverom_exp + (bank - 3) * 0x200000;
+            pcm.wave_banks[bank].mask = 0x1fffff;
+        }
+    }
     else
-        bank = (address >> 19) & 7;
-    switch (bank)
     {
-        case 0:
-            if (pcm.mcu->is_mk1)
-                return pcm.waverom1[address & 0xfffff];
-            else
-                return pcm.waverom1[address & 0x1fffff];
-        case 1:
-            if (!pcm.mcu->is_jv880)
-                return pcm.waverom2[address & 0xfffff];
-            else
-                return pcm.waverom2[address & 0x1fffff];
-        case 2:
-            if (pcm.mcu->is_jv880)
-                return pcm.waverom_card[address & 0x1fffff];
-            else
-                return pcm.waverom3[address & 0xfffff];
-        case 3:
-        case 4:
-        case 5:
-        case 6:
-            if (pcm.mcu->is_jv880)
-                return pcm.waverom_exp[(address & 0x1fffff) + (uint32_t)((bank - 3) * 0x200000)];
-        default:
-            break;
+        pcm.wave_banks[2].data = pcm.waverom3;
+        pcm.wave_banks[2].mask = 0xfffff;
     }
-    return 0;
+}
+
+inline uint8_t PCM_ReadROM(const pcm_t& pcm, uint32_t address)
+{
+    const PCM_WaveBank& bank = pcm.wave_banks[(address >> pcm.wave_bank_shift) & 7];
+    return bank.data[address & bank.mask];
+}
+
+inline void PCM_LeaveIdle(pcm_t& pcm)
+{
+    pcm.idle = false;
+    pcm.idle_candidates = 0;
 }
 
 void PCM_Write(pcm_t& pcm, uint32_t address, uint8_t data)
@@ -99,6 +112,8 @@ void PCM_Write(pcm_t& pcm, uint32_t address, uint8_t data)
                 break;
         }
         pcm.voice_mask_updating = true;
+        if (pcm.voice_mask_pending)
+            PCM_LeaveIdle(pcm);
     }
     else if (address >= 0x20 && address < 0x24) // wave rom
     {
@@ -123,11 +138,14 @@ void PCM_Write(pcm_t& pcm, uint32_t address, uint8_t data)
     {
         pcm.config_reg_3c = data;
         PCM_GetConfig(pcm.config, data);
+        PCM_LeaveIdle(pcm);
     }
     else if (address == 0x3d)
     {
         pcm.config_reg_3d = data;
         pcm.config.reg_slots = (data & 31) + 1;
+        pcm.wave_bank_shift = (data & 0x20) ? 21 : 19;
+        PCM_LeaveIdle(pcm);
     }
     else if (address == 0x3e)
     {
@@ -160,6 +178,9 @@ void PCM_Write(pcm_t& pcm, uint32_t address, uint8_t data)
             if ((address & 4) == 0)
                 ix |= 2;
 
+            // The bypass doesn't run the voice network that would pick up the new value.
+            if (pcm.ram1[pcm.select_channel][ix] != pcm.write_latch)
+                PCM_LeaveIdle(pcm);
             pcm.ram1[pcm.select_channel][ix] = pcm.write_latch;
         }
     }
@@ -182,6 +203,8 @@ void PCM_Write(pcm_t& pcm, uint32_t address, uint8_t data)
             if (address & 32)
                 ix |= 8;
 
+            if (pcm.ram2[pcm.select_channel][ix] != static_cast<uint16_t>(pcm.write_latch))
+                PCM_LeaveIdle(pcm);
             pcm.ram2[pcm.select_channel][ix] = static_cast<uint16_t>(pcm.write_latch);
         }
     }
@@ -268,6 +291,7 @@ uint8_t PCM_Read(pcm_t& pcm, uint32_t address)
 void PCM_Init(pcm_t& pcm, mcu_t& mcu)
 {
     pcm.mcu = &mcu;
+    PCM_UpdateWaveBanks(pcm);
 }
 
 // Sign-extends a 20-bit signed integer to a 32-bit signed integer.
@@ -486,15 +510,11 @@ inline void calc_tv(pcm_t& pcm, int e, int adjust, uint16_t *levelcur, int activ
     }
 }
 
-inline int eram_unpack(pcm_t& pcm, uint32_t addr, int type = 0)
+inline int eram_unpack(const pcm_t& pcm, uint32_t addr, int type = 0)
 {
-    addr &= 0x3fff;
-    int data = pcm.eram[addr];
-    int val = data & 0x3fff;
-    int sh = (data >> 14) & 3;
-
-    val <<= 18;
-    return val >> (18 - sh * 2 + type);
+    // type 1 reads the tap at half scale; this is the same as shifting the
+    // expanded word one more bit since both shifts are arithmetic
+    return pcm.eram_unpacked[addr & 0x3fff] >> type;
 }
 
 inline void eram_pack(pcm_t& pcm, uint32_t addr, uint32_t val)
@@ -514,8 +534,10 @@ inline void eram_pack(pcm_t& pcm, uint32_t addr, uint32_t val)
         sh = 0;
 
     int data = (val >> (sh * 2)) & 0x3fff;
+    int expanded = data << 18;
     data |= sh << 14;
     pcm.eram[addr] = (uint16_t)data;
+    pcm.eram_unpacked[addr] = expanded >> (18 - sh * 2);
 }
 
 void PCM_GetConfig(PCM_Config& config, uint8_t config_byte)
@@ -583,85 +605,257 @@ void PCM_GetConfig(PCM_Config& config, uint8_t config_byte)
     }
 }
 
-void PCM_Update(pcm_t& pcm, uint64_t cycles)
+inline uint64_t PCM_CyclesPerSample(const pcm_t& pcm)
 {
-    while (pcm.cycles < cycles)
+    uint64_t new_cycles = (uint64_t)(pcm.config.reg_slots + 1) * 25;
+
+    return pcm.mcu->is_jv880 ? (new_cycles * 25) / 29 : new_cycles;
+}
+
+// Number of settled output samples required before the effect memory is
+// scanned, about 60ms.
+static const uint32_t PCM_IDLE_SETTLE_SAMPLES = 4096;
+// Largest effect memory value (20-bit) still considered silent.
+static const int32_t PCM_IDLE_ERAM_THRESHOLD = 16;
+
+static bool PCM_IsEramSilent(const pcm_t& pcm)
+{
+    for (int32_t value : pcm.eram_unpacked)
     {
-        const uint32_t voice_active = pcm.voice_mask & pcm.voice_mask_pending;
-        { // final mixing
-            int shifter = pcm.ram2[30][10];
-            int xr = ((shifter >> 0) ^ (shifter >> 1) ^ (shifter >> 7) ^ (shifter >> 12)) & 1;
-            shifter = (shifter >> 1) | (xr << 15);
-            pcm.ram2[30][10] = (uint16_t)shifter;
+        if (value < -PCM_IDLE_ERAM_THRESHOLD || value > PCM_IDLE_ERAM_THRESHOLD)
+            return false;
+    }
+    return true;
+}
 
-            pcm.accum_l = addclip20(pcm.accum_l, (int32_t)pcm.ram1[30][0], 0);
-            pcm.accum_r = addclip20(pcm.accum_r, (int32_t)pcm.ram1[30][1], 0);
+static void PCM_DetectIdle(pcm_t& pcm, uint32_t voice_active, const AudioFrame<int32_t>& first,
+                           const AudioFrame<int32_t>& second, bool posted_second)
+{
+    const bool settled = voice_active == 0 &&
+        first.left == pcm.idle_frame.left && first.right == pcm.idle_frame.right &&
+        (!posted_second || (second.left == first.left && second.right == first.right));
 
-            pcm.ram1[30][2] = (uint32_t)addclip20(pcm.accum_l,
-                (int32_t)(pcm.config.orval | (shifter & pcm.config.noise_mask)), 0);
+    pcm.idle_frame = first;
 
-            pcm.ram1[30][4] = (uint32_t)addclip20(pcm.accum_r,
-                (int32_t)(pcm.config.orval | (shifter & pcm.config.noise_mask)), 0);
+    if (!settled)
+    {
+        pcm.idle_candidates = 0;
+        return;
+    }
 
-            pcm.ram1[30][0] = (uint32_t)(pcm.accum_l & pcm.config.write_mask);
-            pcm.ram1[30][1] = (uint32_t)(pcm.accum_r & pcm.config.write_mask);
-            
+    if (++pcm.idle_candidates < PCM_IDLE_SETTLE_SAMPLES)
+        return;
 
-            int32_t samp_l = (int32_t)((pcm.ram1[30][2] & (uint32_t)(~pcm.config.write_mask)) << 12);
-            int32_t samp_r = (int32_t)((pcm.ram1[30][4] & (uint32_t)(~pcm.config.write_mask)) << 12);
+    if (PCM_IsEramSilent(pcm))
+        pcm.idle = true;
+    else
+        pcm.idle_candidates = 0;
+}
 
-            MCU_PostSample(*pcm.mcu, {samp_l, samp_r});
+// Final mixing and dithering. Steps the noise shifter, posts one or two output frames and returns
+// whether a second (oversampled) frame was posted.
+static bool PCM_MixOutput(pcm_t& pcm, AudioFrame<int32_t>& out_first, AudioFrame<int32_t>& out_second)
+{
+    int shifter = pcm.ram2[30][10];
+    int xr = ((shifter >> 0) ^ (shifter >> 1) ^ (shifter >> 7) ^ (shifter >> 12)) & 1;
+    shifter = (shifter >> 1) | (xr << 15);
+    pcm.ram2[30][10] = (uint16_t)shifter;
 
-            xr = ((shifter >> 0) ^ (shifter >> 1) ^ (shifter >> 7) ^ (shifter >> 12)) & 1;
-            shifter = (shifter >> 1) | (xr << 15);
+    pcm.accum_l = addclip20(pcm.accum_l, (int32_t)pcm.ram1[30][0], 0);
+    pcm.accum_r = addclip20(pcm.accum_r, (int32_t)pcm.ram1[30][1], 0);
 
-            pcm.accum_l = addclip20(pcm.accum_l, (int32_t)pcm.ram1[30][0], 0);
-            pcm.accum_r = addclip20(pcm.accum_r, (int32_t)pcm.ram1[30][1], 0);
+    pcm.ram1[30][2] = (uint32_t)addclip20(pcm.accum_l,
+        (int32_t)(pcm.config.orval | (shifter & pcm.config.noise_mask)), 0);
 
-            pcm.ram1[30][3] = (uint32_t)addclip20(pcm.accum_l,
-                (int32_t)(pcm.config.orval | (shifter & pcm.config.noise_mask)), 0);
+    pcm.ram1[30][4] = (uint32_t)addclip20(pcm.accum_r,
+        (int32_t)(pcm.config.orval | (shifter & pcm.config.noise_mask)), 0);
 
-            pcm.ram1[30][5] = (uint32_t)addclip20(pcm.accum_r,
-                (int32_t)(pcm.config.orval | (shifter & pcm.config.noise_mask)), 0);
+    pcm.ram1[30][0] = (uint32_t)(pcm.accum_l & pcm.config.write_mask);
+    pcm.ram1[30][1] = (uint32_t)(pcm.accum_r & pcm.config.write_mask);
 
-            if (pcm.enable_oversampling && pcm.config.oversampling) // oversampling
-            {
-                pcm.ram2[30][10] = (uint16_t)shifter;
 
-                pcm.ram1[30][0] = (uint32_t)(pcm.accum_l & pcm.config.write_mask);
-                pcm.ram1[30][1] = (uint32_t)(pcm.accum_r & pcm.config.write_mask);
+    int32_t samp_l = (int32_t)((pcm.ram1[30][2] & (uint32_t)(~pcm.config.write_mask)) << 12);
+    int32_t samp_r = (int32_t)((pcm.ram1[30][4] & (uint32_t)(~pcm.config.write_mask)) << 12);
 
+    out_first = {samp_l, samp_r};
+    MCU_PostSample(*pcm.mcu, out_first);
 
-                samp_l = (int32_t)((pcm.ram1[30][3] & (uint32_t)(~pcm.config.write_mask)) << 12);
-                samp_r = (int32_t)((pcm.ram1[30][5] & (uint32_t)(~pcm.config.write_mask)) << 12);
+    xr = ((shifter >> 0) ^ (shifter >> 1) ^ (shifter >> 7) ^ (shifter >> 12)) & 1;
+    shifter = (shifter >> 1) | (xr << 15);
 
-                MCU_PostSample(*pcm.mcu, {samp_l, samp_r});
-            }
-        }
+    pcm.accum_l = addclip20(pcm.accum_l, (int32_t)pcm.ram1[30][0], 0);
+    pcm.accum_r = addclip20(pcm.accum_r, (int32_t)pcm.ram1[30][1], 0);
 
-        { // global counter for envelopes
-            if (!pcm.nfs)
-                pcm.tv_counter = pcm.ram2[31][8]; // fixme
+    pcm.ram1[30][3] = (uint32_t)addclip20(pcm.accum_l,
+        (int32_t)(pcm.config.orval | (shifter & pcm.config.noise_mask)), 0);
 
-            pcm.tv_counter -= 1;
+    pcm.ram1[30][5] = (uint32_t)addclip20(pcm.accum_r,
+        (int32_t)(pcm.config.orval | (shifter & pcm.config.noise_mask)), 0);
 
-            pcm.tv_counter &= 0x3fff;
-        }
+    if (pcm.enable_oversampling && pcm.config.oversampling) // oversampling
+    {
+        pcm.ram2[30][10] = (uint16_t)shifter;
 
-        // chorus/reverb
+        pcm.ram1[30][0] = (uint32_t)(pcm.accum_l & pcm.config.write_mask);
+        pcm.ram1[30][1] = (uint32_t)(pcm.accum_r & pcm.config.write_mask);
 
-        { // fixme
-            if (pcm.ram2[31][8] & 0x8000)
-                pcm.ram2[31][9] = pcm.ram2[31][8] & 0x7fff;
-            else
-                pcm.ram2[31][10] = pcm.ram2[31][8] & 0x7fff;
 
-            if ((0x4000 - pcm.ram2[31][8]) & 0x8000)
-                pcm.ram2[31][10] = (0x4000 - pcm.ram2[31][8]) & 0x7fff;
-            else
-                pcm.ram2[31][9] = (0x4000 - pcm.ram2[31][8]) & 0x7fff;
+        samp_l = (int32_t)((pcm.ram1[30][3] & (uint32_t)(~pcm.config.write_mask)) << 12);
+        samp_r = (int32_t)((pcm.ram1[30][5] & (uint32_t)(~pcm.config.write_mask)) << 12);
+
+        out_second = {samp_l, samp_r};
+        MCU_PostSample(*pcm.mcu, out_second);
+        return true;
+    }
+
+    return false;
+}
+
+// Global counter for envelopes and the chorus/reverb tap offsets derived from the effect slot's phase.
+static void PCM_StepCounters(pcm_t& pcm)
+{
+    { // global counter for envelopes
+        if (!pcm.nfs)
+            pcm.tv_counter = pcm.ram2[31][8]; // fixme
+
+        pcm.tv_counter -= 1;
+
+        pcm.tv_counter &= 0x3fff;
+    }
+
+    // chorus/reverb
+
+    { // fixme
+        if (pcm.ram2[31][8] & 0x8000)
+            pcm.ram2[31][9] = pcm.ram2[31][8] & 0x7fff;
+        else
+            pcm.ram2[31][10] = pcm.ram2[31][8] & 0x7fff;
+
+        if ((0x4000 - pcm.ram2[31][8]) & 0x8000)
+            pcm.ram2[31][10] = (0x4000 - pcm.ram2[31][8]) & 0x7fff;
+        else
+            pcm.ram2[31][9] = (0x4000 - pcm.ram2[31][8]) & 0x7fff;
+    }
+}
+
+// Address generator for the effect slot, drives the chorus delay taps.
+static void PCM_StepEffectAddress(pcm_t& pcm)
+{
+    const bool key = 1;
+    const bool okey = (pcm.ram2[31][7] & 0x20) != 0;
+    const bool active = key && okey;
+    const bool kon = key && !okey;
+
+    bool b15 = (pcm.ram2[31][8] & 0x8000) != 0; // 0
+    const bool b6 = (pcm.ram2[31][7] & 0x40) != 0; // 1
+    const bool b7 = (pcm.ram2[31][7] & 0x80) != 0; // 1
+    int old_nibble = (pcm.ram2[31][7] >> 12) & 15; // 1
+    (void)old_nibble; // unused
+
+    int address = (int)pcm.ram1[31][4]; // 0
+    int address_end = (int)pcm.ram1[31][0]; // 1 or 2
+    int address_loop = (int)pcm.ram1[31][2]; // 2 or 1
+
+    int sub_phase = (pcm.ram2[31][8] & 0x3fff); // 1
+    int interp_ratio = (sub_phase >> 7) & 127;
+    (void)interp_ratio; // unused
+    sub_phase += pcm.ram2[pcm.ram2[31][7] & 31][0]; // 5
+    int sub_phase_of = (sub_phase >> 14) & 7;
+    if (pcm.nfs)
+    {
+        pcm.ram2[31][8] &= ~0x3fff;
+        pcm.ram2[31][8] |= sub_phase & 0x3fff;
+    }
+
+
+    // address 0
+    int address_cnt = address;
+
+    int cmp1 = b15 ? address_loop : address_end;
+    int cmp2 = address_cnt;
+    bool address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 9
+    bool next_b15 = b15;
+
+    int next_address = address_cnt; // 11
+
+    cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
+    cmp2 = address_cnt;
+    int address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
+
+    const bool address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
+    const bool address_sub = !address_cmp && b6 && b15;
+    if (b7)
+        address_cnt2 -= address_add - address_sub;
+    else
+        address_cnt2 += address_add - address_sub;
+    address_cnt = address_cnt2 & 0xfffff; // 11
+    b15 = b6 && (b15 ^ address_cmp); // 11
+
+    cmp1 = b15 ? address_loop : address_end;
+    cmp2 = address_cnt;
+    address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 13
+
+    if (sub_phase_of >= 1)
+    {
+        next_address = address_cnt; // 13
+        next_b15 = b15;
+    }
+
+    if (active && pcm.nfs)
+        pcm.ram1[31][4] = (uint32_t)next_address;
+
+    if (pcm.nfs)
+    {
+        pcm.ram2[31][8] &= ~0x8000;
+        pcm.ram2[31][8] |= (uint16_t)(next_b15 << 15);
+    }
+
+    int t1 = address_loop; // 18
+    int t2 = (int)pcm.ram1[31][4] - t1; // 19
+    int t3 = address_end - t2; // 20
+    int t4 = (int)pcm.ram1[31][4]; // 23
+
+    pcm.ram2[29][10] = (uint16_t)t3;
+    pcm.ram2[29][11] = (uint16_t)t4;
+}
+
+void PCM_Update(pcm_t& pcm, uint64_t cycles)
+{
+    while (pcm.cycles < cycles)
+    {
+        if (pcm.idle)
+        {
+            // The voices and the effects network are skipped, but the cheap per-sample state is still stepped so
+            // that the noise shifter, counters and effect phase match the full path once voices start again. The
+            // accumulators hold the last slot's sum and don't change while idle.
+            const int32_t accum_l = pcm.accum_l;
+            const int32_t accum_r = pcm.accum_r;
+            AudioFrame<int32_t> out_first{};
+            AudioFrame<int32_t> out_second{};
+            PCM_MixOutput(pcm, out_first, out_second);
+            pcm.accum_l = accum_l;
+            pcm.accum_r = accum_r;
+
+            PCM_StepCounters(pcm);
+            PCM_StepEffectAddress(pcm);
+
+            if (pcm.nfs)
+            {
+                pcm.ram2[31][7] |= 0x20;
+            }
+
+            pcm.cycles += PCM_CyclesPerSample(pcm);
+            continue;
         }
 
+        const uint32_t voice_active = pcm.voice_mask & pcm.voice_mask_pending;
+        AudioFrame<int32_t> out_first{};
+        AudioFrame<int32_t> out_second{};
+        bool posted_second = false;
+        posted_second = PCM_MixOutput(pcm, out_first, out_second);
+
+        PCM_StepCounters(pcm);
+
         {
             int v1 = pcm.ram2[31][1];
 
@@ -1012,86 +1206,7 @@ void PCM_Update(pcm_t& pcm, uint64_t cycles)
                 rcadd[5] = m1;
                 rcadd2[5] = m2;
 
-                {
-                    // address generator
-
-                    const bool key = 1;
-                    const bool okey = (pcm.ram2[31][7] & 0x20) != 0;
-                    const bool active = key && okey;
-                    const bool kon = key && !okey;
-
-                    bool b15 = (pcm.ram2[31][8] & 0x8000) != 0; // 0
-                    const bool b6 = (pcm.ram2[31][7] & 0x40) != 0; // 1
-                    const bool b7 = (pcm.ram2[31][7] & 0x80) != 0; // 1
-                    int old_nibble = (pcm.ram2[31][7] >> 12) & 15; // 1
-                    (void)old_nibble; // unused
-
-                    int address = (int)pcm.ram1[31][4]; // 0
-                    int address_end = (int)pcm.ram1[31][0]; // 1 or 2
-                    int address_loop = (int)pcm.ram1[31][2]; // 2 or 1
-
-                    int sub_phase = (pcm.ram2[31][8] & 0x3fff); // 1
-                    int interp_ratio = (sub_phase >> 7) & 127;
-                    (void)interp_ratio; // unused
-                    sub_phase += pcm.ram2[pcm.ram2[31][7] & 31][0]; // 5
-                    int sub_phase_of = (sub_phase >> 14) & 7;
-                    if (pcm.nfs)
-                    {
-                        pcm.ram2[31][8] &= ~0x3fff;
-                        pcm.ram2[31][8] |= sub_phase & 0x3fff;
-                    }
-
-
-                    // address 0
-                    int address_cnt = address;
-
-                    int cmp1 = b15 ? address_loop : address_end;
-                    int cmp2 = address_cnt;
-                    bool address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 9
-                    bool next_b15 = b15;
-
-                    int next_address = address_cnt; // 11
-
-                    cmp1 = (!b6 && address_cmp) ? address_loop : address_cnt;
-                    cmp2 = address_cnt;
-                    int address_cnt2 = (kon || (!b6 && address_cmp)) ? cmp1 : cmp2;
-
-                    const bool address_add = (!address_cmp && b6 && !b15) || (!address_cmp && !b6);
-                    const bool address_sub = !address_cmp && b6 && b15;
-                    if (b7)
-                        address_cnt2 -= address_add - address_sub;
-                    else
-                        address_cnt2 += address_add - address_sub;
-                    address_cnt = address_cnt2 & 0xfffff; // 11
-                    b15 = b6 && (b15 ^ address_cmp); // 11
-
-                    cmp1 = b15 ? address_loop : address_end;
-                    cmp2 = address_cnt;
-                    address_cmp = (cmp1 & 0xfffff) == (cmp2 & 0xfffff); // 13
-
-                    if (sub_phase_of >= 1)
-                    {
-                        next_address = address_cnt; // 13
-                        next_b15 = b15;
-                    }
-
-                    if (active && pcm.nfs)
-                        pcm.ram1[31][4] = (uint32_t)next_address;
-
-                    if (pcm.nfs)
-                    {
-                        pcm.ram2[31][8] &= ~0x8000;
-                        pcm.ram2[31][8] |= (uint16_t)(next_b15 << 15);
-                    }
-
-                    int t1 = address_loop; // 18
-                    int t2 = (int)pcm.ram1[31][4] - t1; // 19
-                    int t3 = address_end - t2; // 20
-                    int t4 = (int)pcm.ram1[31][4]; // 23
-
-                    pcm.ram2[29][10] = (uint16_t)t3;
-                    pcm.ram2[29][11] = (uint16_t)t4;
-                }
+                PCM_StepEffectAddress(pcm);
             }
         }
 
@@ -1568,9 +1683,10 @@ void PCM_Update(pcm_t& pcm, uint64_t cycles)
 
         pcm.nfs = true;
 
-        uint64_t new_cycles = (uint64_t)(pcm.config.reg_slots + 1) * 25;
+        if (pcm.enable_idle_bypass)
+            PCM_DetectIdle(pcm, voice_active, out_first, out_second, posted_second);
 
-        pcm.cycles += pcm.mcu->is_jv880 ? (new_cycles * 25) / 29 : new_cycles;
+        pcm.cycles += PCM_CyclesPerSample(pcm);
     }
 }
 
@@ -1586,3 +1702,11 @@ uint32_t PCM_GetOutputFrequency(const pcm_t& pcm)
         return freq / 2;
     }
 }
+
+uint64_t PCM_GetCyclesPerSecond(const pcm_t& pcm)
+{
+    // Each PCM sample produces two output frames when oversampling, so samples run at half the oversampled rate
+    // either way.
+    const uint64_t freq = (pcm.mcu->is_mk1 || pcm.mcu->is_jv880) ? 64000 : 66207;
+    return PCM_CyclesPerSample(pcm) * freq / 2;
+}
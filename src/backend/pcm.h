@@ -33,6 +33,7 @@
  */
 #pragma once
 
+#include "audio.h"
 #include <cstdint>
 
 struct mcu_t;
@@ -51,6 +52,14 @@ struct PCM_Config
     uint8_t reg_slots = 1;
 };
 
+// A waverom bank as seen by the wave address decoder. Banks that are not
+// populated on the current romset point at a single zero byte with a zero mask.
+struct PCM_WaveBank
+{
+    const uint8_t* data = nullptr;
+    uint32_t       mask = 0;
+};
+
 struct pcm_t
 {
     uint32_t ram1[32][8]{};
@@ -77,7 +86,15 @@ struct pcm_t
 
     PCM_Config config{};
 
+    // Precomputed by PCM_UpdateWaveBanks so that wave fetches don't need to
+    // check the romset. Selected by (address >> wave_bank_shift) & 7.
+    PCM_WaveBank wave_banks[8]{};
+    uint8_t      wave_bank_shift = 19; // depends on config_reg_3d
+
     uint16_t eram[0x4000]{};
+    // Mirror of eram holding each word already expanded to its 20-bit value.
+    // eram_pack keeps the two in sync so reverb/chorus taps are plain loads.
+    int32_t  eram_unpacked[0x4000]{};
 
     uint8_t waverom1[0x200000]{};
     uint8_t waverom2[0x200000]{};
@@ -86,6 +103,18 @@ struct pcm_t
     uint8_t waverom_exp[0x800000]{};
 
     bool enable_oversampling = true;
+
+    // When enabled, PCM_Update stops running the voice and effects network
+    // once no voices are keyed, the effect memory has decayed and the output
+    // has settled. Only the output mixer, the global counters and the effect
+    // phase keep running until a voice is keyed or PCM memory is written.
+    // Decaying envelopes and effect memory are frozen, so this is not cycle
+    // accurate and is disabled by default.
+    bool enable_idle_bypass = false;
+
+    bool                idle            = false;
+    uint32_t            idle_candidates = 0; // consecutive settled samples
+    AudioFrame<int32_t> idle_frame{};
 };
 
 void PCM_Write(pcm_t& pcm, uint32_t address, uint8_t data);
@@ -93,4 +122,8 @@ uint8_t PCM_Read(pcm_t& pcm, uint32_t address);
 void PCM_Init(pcm_t& pcm, mcu_t& mcu);
 void PCM_Update(pcm_t& pcm, uint64_t cycles);
 uint32_t PCM_GetOutputFrequency(const pcm_t& pcm);
+// MCU cycles per second of emulated time, based on the number of voice slots the firmware configured.
+uint64_t PCM_GetCyclesPerSecond(const pcm_t& pcm);
 void PCM_GetConfig(PCM_Config& config, uint8_t config_byte);
+// Must be called whenever the romset changes.
+void PCM_UpdateWaveBanks(pcm_t& pcm);
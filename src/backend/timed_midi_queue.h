@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <span>
+
+// Holds MIDI bytes until the emulator reaches the cycle they were scheduled for. Bytes come out ordered by cycle, and
+// bytes scheduled for the same cycle come out in the order they were pushed, so a message is never interleaved with
+// another one scheduled at the same time.
+//
+// Bytes are stored back to back and described by one span per cycle, so pushing in nondecreasing cycle order, which
+// is what a sequencer or a timestamped input stream does, only ever appends. Out of order pushes are inserted in place.
+class TimedMIDIQueue
+{
+public:
+    static constexpr uint64_t NO_CYCLE = UINT64_MAX;
+
+    void Push(uint64_t cycle, std::span<const uint8_t> data)
+    {
+        if (data.empty())
+        {
+            return;
+        }
+
+        if (m_spans.empty() || m_spans.back().cycle <= cycle)
+        {
+            m_bytes.insert(m_bytes.end(), data.begin(), data.end());
+            AddToSpan(m_spans.end(), cycle, data.size());
+            return;
+        }
+
+        // Insert after every span scheduled at or before `cycle`.
+        auto pos = std::upper_bound(m_spans.begin(), m_spans.end(), cycle, [](uint64_t c, const Span& span) {
+            return c < span.cycle;
+        });
+
+        size_t offset = 0;
+        for (auto it = m_spans.begin(); it != pos; ++it)
+        {
+            offset += it->size;
+        }
+
+        m_bytes.insert(m_bytes.begin() + (ptrdiff_t)offset, data.begin(), data.end());
+        AddToSpan(pos, cycle, data.size());
+    }
+
+    // Returns the cycle of the earliest queued byte, or NO_CYCLE if the queue is empty.
+    uint64_t GetNextCycle() const
+    {
+        return m_spans.empty() ? NO_CYCLE : m_spans.front().cycle;
+    }
+
+    // Removes up to `max_bytes` bytes scheduled at or before `cycle` and passes them to `post` in order. Bytes over
+    // the limit stay queued and come out first on the next call.
+    template <typename PostFn>
+    void Release(uint64_t cycle, size_t max_bytes, PostFn&& post)
+    {
+        while (max_bytes && !m_spans.empty() && m_spans.front().cycle <= cycle)
+        {
+            Span&        span  = m_spans.front();
+            const size_t count = std::min(span.size, max_bytes);
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                post(m_bytes[i]);
+            }
+            m_bytes.erase(m_bytes.begin(), m_bytes.begin() + (ptrdiff_t)count);
+
+            max_bytes -= count;
+            span.size -= count;
+            if (span.size == 0)
+            {
+                m_spans.pop_front();
+            }
+        }
+    }
+
+    void Clear()
+    {
+        m_spans.clear();
+        m_bytes.clear();
+    }
+
+    bool IsEmpty() const
+    {
+        return m_spans.empty();
+    }
+
+    size_t GetByteCount() const
+    {
+        return m_bytes.size();
+    }
+
+private:
+    struct Span
+    {
+        uint64_t cycle;
+        size_t   size;
+    };
+
+    // Appends `size` bytes at `cycle` to the span just before `pos`, or starts a new span there if that one is
+    // scheduled earlier.
+    void AddToSpan(std::deque<Span>::iterator pos, uint64_t cycle, size_t size)
+    {
+        if (pos != m_spans.begin() && std::prev(pos)->cycle == cycle)
+        {
+            std::prev(pos)->size += size;
+        }
+        else
+        {
+            m_spans.insert(pos, Span{cycle, size});
+        }
+    }
+
+    std::deque<Span>    m_spans;
+    std::deque<uint8_t> m_bytes;
+};
@@ -0,0 +1,230 @@
+#include "loudness.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numbers>
+
+namespace common
+{
+
+// Blocks quieter than this are ignored entirely.
+constexpr double ABSOLUTE_GATE_LUFS = -70.0;
+
+// Blocks more than this far below the ungated loudness are ignored.
+constexpr double RELATIVE_GATE_LU = -10.0;
+
+// Kaiser window parameter for the true peak interpolation kernels.
+constexpr double TRUE_PEAK_BETA = 5.0;
+
+static double EnergyToLoudness(double energy)
+{
+    return -0.691 + 10.0 * std::log10(energy);
+}
+
+static double LoudnessToEnergy(double lufs)
+{
+    return std::pow(10.0, (lufs + 0.691) / 10.0);
+}
+
+static double BesselI0(double x)
+{
+    double sum  = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; ++k)
+    {
+        const double half_x_over_k = x / (2.0 * k);
+        term *= half_x_over_k * half_x_over_k;
+        sum += term;
+    }
+    return sum;
+}
+
+static double Sinc(double x)
+{
+    if (x == 0.0)
+    {
+        return 1.0;
+    }
+    return std::sin(std::numbers::pi * x) / (std::numbers::pi * x);
+}
+
+void LoudnessMeter::Init(uint32_t sample_rate)
+{
+    const double rate = (double)sample_rate;
+
+    // BS.1770 only specifies coefficients for 48kHz. These are the analog prototypes of those filters, which lets the
+    // meter run at the emulator's native rate without resampling first.
+    {
+        // Stage 1: high shelf modelling the acoustic effect of the head.
+        const double f0 = 1681.974450955533;
+        const double g  = 3.999843853973347;
+        const double q  = 0.7071752369554196;
+        const double k  = std::tan(std::numbers::pi * f0 / rate);
+        const double vh = std::pow(10.0, g / 20.0);
+        const double vb = std::pow(vh, 0.4996667741545416);
+        const double a0 = 1.0 + k / q + k * k;
+
+        m_stages[0].b0 = (vh + vb * k / q + k * k) / a0;
+        m_stages[0].b1 = 2.0 * (k * k - vh) / a0;
+        m_stages[0].b2 = (vh - vb * k / q + k * k) / a0;
+        m_stages[0].a1 = 2.0 * (k * k - 1.0) / a0;
+        m_stages[0].a2 = (1.0 - k / q + k * k) / a0;
+    }
+    {
+        // Stage 2: the RLB high pass.
+        const double f0 = 38.13547087602444;
+        const double q  = 0.5003270373238773;
+        const double k  = std::tan(std::numbers::pi * f0 / rate);
+        const double a0 = 1.0 + k / q + k * k;
+
+        m_stages[1].b0 = 1.0;
+        m_stages[1].b1 = -2.0;
+        m_stages[1].b2 = 1.0;
+        m_stages[1].a1 = 2.0 * (k * k - 1.0) / a0;
+        m_stages[1].a2 = (1.0 - k / q + k * k) / a0;
+    }
+
+    // Interpolation kernels for the 4x oversampled true peak. Phase 0 lands exactly on an input sample.
+    const double half_width = (double)(TAPS / 2);
+    const double window_div = BesselI0(TRUE_PEAK_BETA);
+    for (size_t phase = 0; phase < OVERSAMPLE; ++phase)
+    {
+        float* kernel = &m_coeffs[phase * TAPS];
+
+        double sum = 0.0;
+        for (size_t tap = 0; tap < TAPS; ++tap)
+        {
+            const double t      = (double)tap - (half_width - 1.0) - (double)phase / (double)OVERSAMPLE;
+            const double ratio  = t / half_width;
+            const double window = BesselI0(TRUE_PEAK_BETA * std::sqrt(std::max(0.0, 1.0 - ratio * ratio))) / window_div;
+            const double value  = Sinc(t) * window;
+            kernel[tap]         = (float)value;
+            sum += value;
+        }
+
+        for (size_t tap = 0; tap < TAPS; ++tap)
+        {
+            kernel[tap] = (float)(kernel[tap] / sum);
+        }
+    }
+
+    m_left  = {};
+    m_right = {};
+
+    m_step_frames = std::max<uint32_t>(1, (sample_rate + 5) / 10);
+    m_step_pos    = 0;
+    m_step_energy = 0.0;
+    m_steps_seen  = 0;
+    m_blocks.clear();
+
+    m_true_peak = 0.f;
+}
+
+double LoudnessMeter::KWeight(ChannelState& channel, double sample) const
+{
+    for (size_t i = 0; i < 2; ++i)
+    {
+        const Biquad& stage = m_stages[i];
+
+        const double w = sample - stage.a1 * channel.z1[i] - stage.a2 * channel.z2[i];
+        sample         = stage.b0 * w + stage.b1 * channel.z1[i] + stage.b2 * channel.z2[i];
+        channel.z2[i]  = channel.z1[i];
+        channel.z1[i]  = w;
+    }
+    return sample;
+}
+
+float LoudnessMeter::TruePeak(ChannelState& channel, float sample)
+{
+    std::copy(channel.history.begin() + 1, channel.history.end(), channel.history.begin());
+    channel.history.back() = sample;
+
+    float peak = std::abs(sample);
+    for (size_t phase = 1; phase < OVERSAMPLE; ++phase)
+    {
+        const float* kernel = &m_coeffs[phase * TAPS];
+
+        float acc = 0.f;
+        for (size_t tap = 0; tap < TAPS; ++tap)
+        {
+            acc += channel.history[tap] * kernel[tap];
+        }
+        peak = std::max(peak, std::abs(acc));
+    }
+    return peak;
+}
+
+void LoudnessMeter::Process(std::span<const AudioFrame<float>> input)
+{
+    float peak = m_true_peak;
+
+    for (const AudioFrame<float>& frame : input)
+    {
+        const double left  = KWeight(m_left, (double)frame.left);
+        const double right = KWeight(m_right, (double)frame.right);
+        m_step_energy += left * left + right * right;
+
+        peak = std::max(peak, TruePeak(m_left, frame.left));
+        peak = std::max(peak, TruePeak(m_right, frame.right));
+
+        if (++m_step_pos < m_step_frames)
+        {
+            continue;
+        }
+
+        if (m_steps_seen >= 3)
+        {
+            const double block = m_prev_steps[0] + m_prev_steps[1] + m_prev_steps[2] + m_step_energy;
+            m_blocks.push_back(block / (4.0 * (double)m_step_frames));
+        }
+
+        m_prev_steps[0] = m_prev_steps[1];
+        m_prev_steps[1] = m_prev_steps[2];
+        m_prev_steps[2] = m_step_energy;
+        ++m_steps_seen;
+
+        m_step_pos    = 0;
+        m_step_energy = 0.0;
+    }
+
+    m_true_peak = peak;
+}
+
+double LoudnessMeter::GetIntegratedLoudness() const
+{
+    const auto gated_mean = [this](double threshold, double& out_mean) {
+        double sum   = 0.0;
+        size_t count = 0;
+        for (double block : m_blocks)
+        {
+            if (block > threshold)
+            {
+                sum += block;
+                ++count;
+            }
+        }
+        out_mean = count ? sum / (double)count : 0.0;
+        return count != 0;
+    };
+
+    const double absolute_gate = LoudnessToEnergy(ABSOLUTE_GATE_LUFS);
+
+    double ungated;
+    if (!gated_mean(absolute_gate, ungated))
+    {
+        return -std::numeric_limits<double>::infinity();
+    }
+
+    const double relative_gate = ungated * std::pow(10.0, RELATIVE_GATE_LU / 10.0);
+
+    double gated;
+    if (!gated_mean(std::max(absolute_gate, relative_gate), gated))
+    {
+        return -std::numeric_limits<double>::infinity();
+    }
+
+    return EnergyToLoudness(gated);
+}
+
+} // namespace common
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "audio.h"
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace common
+{
+
+// Streaming stereo loudness meter following ITU-R BS.1770-4.
+//
+// Integrated loudness is measured on K-weighted audio in 400ms blocks overlapping by 75%, with the -70 LUFS absolute
+// gate and the -10 LU relative gate. True peak is estimated by 4x polyphase oversampling. Only the per-block energy is
+// kept, so memory grows by one double per 100ms of audio regardless of the sample rate.
+//
+// Samples are expected as floats where 1.0 is full scale.
+class LoudnessMeter
+{
+public:
+    static constexpr size_t OVERSAMPLE = 4;
+    static constexpr size_t TAPS       = 12;
+
+    // Prepares the meter for audio at `sample_rate` and discards any previous measurements.
+    void Init(uint32_t sample_rate);
+
+    void Process(std::span<const AudioFrame<float>> input);
+
+    // Returns integrated loudness in LUFS, or -infinity if every block was gated out (e.g. silence).
+    double GetIntegratedLoudness() const;
+
+    // Returns the highest true peak seen so far as a linear amplitude.
+    float GetTruePeak() const
+    {
+        return m_true_peak;
+    }
+
+private:
+    struct Biquad
+    {
+        double b0, b1, b2, a1, a2;
+    };
+
+    struct ChannelState
+    {
+        // Direct form II state for the two K-weighting stages.
+        double z1[2]{};
+        double z2[2]{};
+
+        // Most recent TAPS unfiltered input samples, newest last.
+        std::array<float, TAPS> history{};
+    };
+
+    double KWeight(ChannelState& channel, double sample) const;
+    float  TruePeak(ChannelState& channel, float sample);
+
+    Biquad m_stages[2]{};
+
+    // OVERSAMPLE kernels of TAPS coefficients each.
+    std::array<float, OVERSAMPLE * TAPS> m_coeffs{};
+
+    ChannelState m_left;
+    ChannelState m_right;
+
+    // Frames per 100ms step. Each gating block covers the last four steps.
+    uint32_t m_step_frames = 0;
+    uint32_t m_step_pos    = 0;
+    double   m_step_energy = 0.0;
+    double   m_prev_steps[3]{};
+    size_t   m_steps_seen = 0;
+
+    // Mean square of every complete gating block.
+    std::vector<double> m_blocks;
+
+    float m_true_peak = 0.f;
+};
+
+} // namespace common
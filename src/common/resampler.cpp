@@ -0,0 +1,166 @@
+#include "resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+namespace common
+{
+
+// Kaiser window design parameters (see Oppenheim & Schafer, "Discrete-Time Signal Processing").
+constexpr double STOPBAND_DB = 90.0;
+constexpr double KAISER_BETA = 0.1102 * (STOPBAND_DB - 8.7);
+
+// Zeroth order modified Bessel function of the first kind.
+static double BesselI0(double x)
+{
+    double sum  = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; ++k)
+    {
+        const double half_x_over_k = x / (2.0 * k);
+        term *= half_x_over_k * half_x_over_k;
+        sum += term;
+    }
+    return sum;
+}
+
+static double Sinc(double x)
+{
+    if (x == 0.0)
+    {
+        return 1.0;
+    }
+    return std::sin(std::numbers::pi * x) / (std::numbers::pi * x);
+}
+
+void Resampler::Init(uint32_t in_rate, uint32_t out_rate)
+{
+    m_in_rate   = in_rate;
+    m_out_rate  = out_rate;
+    m_step_int  = in_rate / out_rate;
+    m_step_frac = in_rate % out_rate;
+
+    // Cutoff in cycles per input sample. The transition band is centered just below the output nyquist frequency (or
+    // the input nyquist frequency when upsampling) so that the stopband starts right at it.
+    const double half_width = (double)(TAPS / 2);
+    const double transition = (STOPBAND_DB - 8.0) / (2.285 * 2.0 * std::numbers::pi * (double)TAPS);
+    const double nyquist    = 0.5 * std::min(1.0, (double)out_rate / (double)in_rate);
+    const double cutoff     = nyquist - transition / 2.0;
+    const double window_div = BesselI0(KAISER_BETA);
+
+    m_coeffs.resize((PHASES + 1) * TAPS);
+    for (size_t phase = 0; phase <= PHASES; ++phase)
+    {
+        float* kernel = &m_coeffs[phase * TAPS];
+
+        double sum = 0.0;
+        for (size_t tap = 0; tap < TAPS; ++tap)
+        {
+            // Tap TAPS/2 - 1 is the input sample at the read position.
+            const double t      = (double)tap - (half_width - 1.0) - (double)phase / (double)PHASES;
+            const double ratio  = t / half_width;
+            const double window = BesselI0(KAISER_BETA * std::sqrt(std::max(0.0, 1.0 - ratio * ratio))) / window_div;
+            const double value  = 2.0 * cutoff * Sinc(2.0 * cutoff * t) * window;
+            kernel[tap]         = (float)value;
+            sum += value;
+        }
+
+        // Normalize so that every phase has unity gain at DC.
+        for (size_t tap = 0; tap < TAPS; ++tap)
+        {
+            kernel[tap] = (float)(kernel[tap] / sum);
+        }
+    }
+
+    // Prime the history so that the first output frame is centered on the first input frame.
+    m_left.assign(TAPS / 2 - 1, 0.0f);
+    m_right.assign(TAPS / 2 - 1, 0.0f);
+    m_pos        = 0;
+    m_frac       = 0;
+    m_frames_in  = 0;
+    m_frames_out = 0;
+}
+
+void Resampler::Process(std::span<const AudioFrame<float>> input, std::vector<AudioFrame<float>>& output)
+{
+    for (const AudioFrame<float>& frame : input)
+    {
+        m_left.push_back(frame.left);
+        m_right.push_back(frame.right);
+    }
+    m_frames_in += input.size();
+
+    Drain(output, UINT64_MAX);
+}
+
+void Resampler::Finish(std::vector<AudioFrame<float>>& output)
+{
+    // Pad with enough silence to complete the kernels of the last few output frames.
+    m_left.resize(m_left.size() + TAPS, 0.0f);
+    m_right.resize(m_right.size() + TAPS, 0.0f);
+
+    Drain(output, ConvertFramePosition(m_frames_in));
+}
+
+uint64_t Resampler::ConvertFramePosition(uint64_t frame) const
+{
+    // Rounds up; output frame N is at input position N * in / out.
+    return (frame * m_out_rate + m_in_rate - 1) / m_in_rate;
+}
+
+void Resampler::Drain(std::vector<AudioFrame<float>>& output, uint64_t limit)
+{
+    while (m_pos + TAPS <= m_left.size() && m_frames_out < limit)
+    {
+        const uint64_t scaled_frac = (uint64_t)m_frac * PHASES;
+        const size_t   phase       = (size_t)(scaled_frac / m_out_rate);
+        const float    blend       = (float)(scaled_frac % m_out_rate) / (float)m_out_rate;
+
+        const float* kernel_a = &m_coeffs[phase * TAPS];
+        const float* kernel_b = kernel_a + TAPS;
+        const float* left     = &m_left[m_pos];
+        const float* right    = &m_right[m_pos];
+
+        // Independent partial sums avoid a serial dependency on a single accumulator, which lets the compiler
+        // vectorize this loop without -ffast-math. Auto vectorizes in clang at -O2, gcc at -O3.
+        constexpr size_t LANES = 8;
+        float            acc_l[LANES]{};
+        float            acc_r[LANES]{};
+        for (size_t tap = 0; tap < TAPS; tap += LANES)
+        {
+            for (size_t lane = 0; lane < LANES; ++lane)
+            {
+                const float a     = kernel_a[tap + lane];
+                const float coeff = a + blend * (kernel_b[tap + lane] - a);
+                acc_l[lane] += left[tap + lane] * coeff;
+                acc_r[lane] += right[tap + lane] * coeff;
+            }
+        }
+
+        AudioFrame<float> result{};
+        for (size_t lane = 0; lane < LANES; ++lane)
+        {
+            result.left += acc_l[lane];
+            result.right += acc_r[lane];
+        }
+        output.push_back(result);
+        ++m_frames_out;
+
+        m_pos += m_step_int;
+        m_frac += m_step_frac;
+        if (m_frac >= m_out_rate)
+        {
+            m_frac -= m_out_rate;
+            ++m_pos;
+        }
+    }
+
+    // Discard history that no future output frame will read.
+    const size_t consumed = std::min(m_pos, m_left.size());
+    m_left.erase(m_left.begin(), m_left.begin() + (ptrdiff_t)consumed);
+    m_right.erase(m_right.begin(), m_right.begin() + (ptrdiff_t)consumed);
+    m_pos -= consumed;
+}
+
+} // namespace common
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "audio.h"
+
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+namespace common
+{
+
+// Polyphase windowed-sinc sample rate converter for stereo audio.
+//
+// The filter bank is a table of `PHASES + 1` kaiser-windowed sinc kernels; output samples that fall between two phases
+// linearly interpolate the neighboring kernels. Positions are tracked as an exact fraction of the output rate so the
+// converter does not drift over long renders.
+//
+// Samples are processed as floats in whatever scale the caller uses. See `ToResamplerFrame` and `FromResamplerFrame`.
+class Resampler
+{
+public:
+    static constexpr size_t TAPS   = 128;
+    static constexpr size_t PHASES = 256;
+
+    // Prepares the filter for converting `in_rate` to `out_rate` and discards any buffered audio.
+    void Init(uint32_t in_rate, uint32_t out_rate);
+
+    // Consumes all of `input` and appends as many output frames as can be produced to `output`.
+    void Process(std::span<const AudioFrame<float>> input, std::vector<AudioFrame<float>>& output);
+
+    // Appends the remaining buffered output frames to `output`. After this call the total number of output frames is
+    // exactly `ConvertFramePosition(total input frames)`.
+    void Finish(std::vector<AudioFrame<float>>& output);
+
+    // Returns the output frame that corresponds to input frame `frame`.
+    uint64_t ConvertFramePosition(uint64_t frame) const;
+
+    uint32_t GetInputRate() const
+    {
+        return m_in_rate;
+    }
+
+    uint32_t GetOutputRate() const
+    {
+        return m_out_rate;
+    }
+
+private:
+    void Drain(std::vector<AudioFrame<float>>& output, uint64_t limit);
+
+    uint32_t m_in_rate  = 0;
+    uint32_t m_out_rate = 0;
+
+    // Amount the read position advances for each output frame, as `step_int + step_frac / out_rate`.
+    uint32_t m_step_int  = 0;
+    uint32_t m_step_frac = 0;
+
+    // (PHASES + 1) kernels of TAPS coefficients each.
+    std::vector<float> m_coeffs;
+
+    // Deinterleaved input history. m_pos is the index of the first tap of the next output frame and m_frac is the
+    // fractional part of the read position in units of 1 / out_rate.
+    std::vector<float> m_left;
+    std::vector<float> m_right;
+    size_t             m_pos  = 0;
+    uint32_t           m_frac = 0;
+
+    uint64_t m_frames_in  = 0;
+    uint64_t m_frames_out = 0;
+};
+
+template <typename T>
+inline AudioFrame<float> ToResamplerFrame(const AudioFrame<T>& frame)
+{
+    return {(float)frame.left, (float)frame.right};
+}
+
+template <typename T>
+inline T FromResamplerSample(float sample)
+{
+    if constexpr (std::is_same_v<T, float>)
+    {
+        return sample;
+    }
+    else
+    {
+        // Computed in double because INT32_MAX is not representable as a float.
+        const double rounded = (double)sample + (sample < 0 ? -0.5 : 0.5);
+        return (T)Clamp<double>(rounded, std::numeric_limits<T>::min(), std::numeric_limits<T>::max());
+    }
+}
+
+template <typename T>
+inline AudioFrame<T> FromResamplerFrame(const AudioFrame<float>& frame)
+{
+    return {FromResamplerSample<T>(frame.left), FromResamplerSample<T>(frame.right)};
+}
+
+} // namespace common
@@ -0,0 +1,338 @@
+#include "batch.h"
+#include "render.h"
+#include "smf.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/gain.h"
+
+// Returns true if `path` looks like a MIDI file.
+static bool R_IsMidiPath(const std::filesystem::path& path)
+{
+    std::string extension = path.extension().generic_string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) {
+        return (char)std::tolower(c);
+    });
+    return extension == ".mid" || extension == ".midi" || extension == ".smf";
+}
+
+// Lists the MIDI files to render in batch mode. `batch_path` is either a directory, in which case every MIDI file
+// directly inside it is rendered, or a text file with one path per line. Empty lines and lines starting with '#' are
+// skipped.
+static bool R_CollectBatchInputs(const std::filesystem::path& batch_path, std::vector<std::filesystem::path>& inputs)
+{
+    std::error_code ec;
+    if (std::filesystem::is_directory(batch_path, ec))
+    {
+        for (const auto& entry : std::filesystem::directory_iterator(batch_path, ec))
+        {
+            if (entry.is_regular_file() && R_IsMidiPath(entry.path()))
+            {
+                inputs.push_back(entry.path());
+            }
+        }
+        std::sort(inputs.begin(), inputs.end());
+        return !ec;
+    }
+
+    FILE* list = fopen(batch_path.generic_string().c_str(), "rb");
+    if (!list)
+    {
+        return false;
+    }
+
+    std::string line;
+    int         ch;
+    do
+    {
+        ch = fgetc(list);
+        if (ch == '\n' || ch == EOF)
+        {
+            while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t'))
+            {
+                line.pop_back();
+            }
+            if (!line.empty() && line[0] != '#')
+            {
+                inputs.emplace_back(line);
+            }
+            line.clear();
+        }
+        else
+        {
+            line.push_back((char)ch);
+        }
+    } while (ch != EOF);
+
+    fclose(list);
+    return true;
+}
+
+struct R_BatchJob
+{
+    std::filesystem::path input;
+    std::string           output;
+
+    // Filled in by the worker that renders this job.
+    bool        success = false;
+    std::string error;
+};
+
+// Picks an output path for each input. Outputs go in `params.output_directory` if set, otherwise next to the input.
+// If two inputs would produce the same output, later ones get a numeric suffix.
+static std::vector<R_BatchJob> R_MakeBatchJobs(const std::vector<std::filesystem::path>& inputs, const R_Parameters& params)
+{
+    const char* extension = params.output_container == R_OutputContainer::Flac ? ".flac" : ".wav";
+
+    std::vector<R_BatchJob> jobs;
+    std::set<std::string>   used;
+    for (const auto& input : inputs)
+    {
+        const std::filesystem::path directory =
+            params.output_directory.empty() ? input.parent_path() : params.output_directory;
+
+        std::filesystem::path output = directory / input.stem();
+        output += extension;
+        for (int suffix = 2; used.contains(output.generic_string()); ++suffix)
+        {
+            output = directory / input.stem();
+            output += "_";
+            output += std::to_string(suffix);
+            output += extension;
+        }
+        used.insert(output.generic_string());
+
+        R_BatchJob& job = jobs.emplace_back();
+        job.input       = input;
+        job.output      = output.generic_string();
+    }
+    return jobs;
+}
+
+// Copies everything written to `log` to stderr, indented under the job's result line, and closes it.
+static void R_PrintJobLog(FILE* log)
+{
+    rewind(log);
+    bool line_start = true;
+    int  ch;
+    while ((ch = fgetc(log)) != EOF)
+    {
+        if (line_start)
+        {
+            fputs("  ", stderr);
+        }
+        fputc(ch, stderr);
+        line_start = ch == '\n';
+    }
+    fclose(log);
+}
+
+bool R_RenderBatch(const R_Parameters& params)
+{
+    auto t_start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::filesystem::path> inputs;
+    if (!R_CollectBatchInputs(params.batch_path, inputs))
+    {
+        fprintf(stderr, "Failed to read batch list %s\n", params.batch_path.generic_string().c_str());
+        return false;
+    }
+
+    if (inputs.empty())
+    {
+        fprintf(stderr, "No MIDI files found in %s\n", params.batch_path.generic_string().c_str());
+        return false;
+    }
+
+    if (!params.output_directory.empty())
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(params.output_directory, ec);
+        if (ec)
+        {
+            fprintf(stderr, "Failed to create %s: %s\n", params.output_directory.generic_string().c_str(), ec.message().c_str());
+            return false;
+        }
+    }
+
+    std::vector<R_BatchJob> jobs = R_MakeBatchJobs(inputs, params);
+
+    R_RomContext context;
+    if (!R_LoadRomContext(params, context))
+    {
+        return false;
+    }
+
+    fprintf(stderr, "Gain set to %.2fdb\n", common::ScalarToDb(params.gain));
+
+    // Boot one emulator and give every worker a copy of it.
+    fprintf(stderr, "Initializing emulator...\n");
+    EMU_State boot_state;
+    {
+        Emulator boot;
+        if (!R_InitEmulator(boot, context, params, 0))
+        {
+            return false;
+        }
+        R_RunReset(boot, context.reset);
+        boot.SaveState(boot_state);
+    }
+
+    size_t worker_count = params.jobs;
+    if (worker_count == 0)
+    {
+        worker_count = std::max<size_t>(1, std::thread::hardware_concurrency() / params.instances);
+    }
+    worker_count = std::min(worker_count, jobs.size());
+
+    std::vector<std::vector<Emulator>> worker_emulators(worker_count);
+    for (auto& emulators : worker_emulators)
+    {
+        emulators.resize(params.instances);
+        for (size_t i = 0; i < params.instances; ++i)
+        {
+            if (!R_InitEmulator(emulators[i], context, params, i))
+            {
+                return false;
+            }
+        }
+    }
+
+    context.romset_info.PurgeRomData();
+
+    fprintf(stderr, "Rendering %zu files with %zu workers\n", jobs.size(), worker_count);
+
+    std::atomic<size_t> next_job = 0;
+    // Held while reporting a finished job so that its --debug output stays together.
+    std::mutex report_mutex;
+    size_t     jobs_finished = 0;
+
+    auto worker = [&](std::span<Emulator> emulators) {
+        while (true)
+        {
+            const size_t job_index = next_job.fetch_add(1);
+            if (job_index >= jobs.size())
+            {
+                break;
+            }
+
+            R_BatchJob& job = jobs[job_index];
+            auto t_job_start = std::chrono::high_resolution_clock::now();
+
+            // Jobs run at once, so --debug output is collected per job and printed when it finishes.
+            FILE* debug_log = params.debug ? tmpfile() : nullptr;
+
+            SMF_Data data;
+            if (!SMF_LoadEvents(job.input, data, job.error))
+            {
+                job.error = "couldn't load MIDI: " + job.error;
+            }
+            else
+            {
+                R_Parameters job_params = params;
+                job_params.output_filename = job.output;
+                if (debug_log)
+                {
+                    job_params.debug_output = debug_log;
+                }
+
+                const R_RenderPlan plan = R_PlanRender(data, job_params);
+
+                bool restored = true;
+                for (Emulator& emu : emulators)
+                {
+                    restored = restored && emu.LoadState(boot_state);
+                }
+
+                if (!restored)
+                {
+                    job.error = "couldn't restore emulator state";
+                }
+                else if (!R_RenderSong(data, plan, job_params, emulators, true))
+                {
+                    job.error = "couldn't write output";
+                }
+                else
+                {
+                    job.success = true;
+                }
+            }
+
+            const auto   t_job_diff = std::chrono::high_resolution_clock::now() - t_job_start;
+            const double t_job_sec  = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(t_job_diff).count() / 1e9;
+
+            std::scoped_lock lock(report_mutex);
+            const size_t     finished = ++jobs_finished;
+            if (job.success)
+            {
+                fprintf(stderr,
+                        "[%zu/%zu] %s -> %s (%.2fs)\n",
+                        finished,
+                        jobs.size(),
+                        job.input.generic_string().c_str(),
+                        job.output.c_str(),
+                        t_job_sec);
+            }
+            else
+            {
+                fprintf(stderr,
+                        "[%zu/%zu] %s FAILED: %s\n",
+                        finished,
+                        jobs.size(),
+                        job.input.generic_string().c_str(),
+                        job.error.c_str());
+            }
+            if (debug_log)
+            {
+                R_PrintJobLog(debug_log);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (auto& emulators : worker_emulators)
+    {
+        workers.emplace_back(worker, std::span<Emulator>(emulators));
+    }
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
+
+    size_t failures = 0;
+    for (const R_BatchJob& job : jobs)
+    {
+        if (!job.success)
+        {
+            ++failures;
+        }
+    }
+
+    auto t_finish = std::chrono::high_resolution_clock::now();
+    auto t_diff   = std::chrono::duration_cast<std::chrono::nanoseconds>(t_finish - t_start);
+    auto t_sec    = (double)t_diff.count() / 1e9;
+
+    fprintf(stderr, "Rendered %zu of %zu files in %.2fs\n", jobs.size() - failures, jobs.size(), t_sec);
+    if (failures)
+    {
+        fprintf(stderr, "%zu failed:\n", failures);
+        for (const R_BatchJob& job : jobs)
+        {
+            if (!job.success)
+            {
+                fprintf(stderr, "  %s: %s\n", job.input.generic_string().c_str(), job.error.c_str());
+            }
+        }
+    }
+
+    return failures == 0;
+}
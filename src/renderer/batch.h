@@ -0,0 +1,9 @@
+// Rendering many MIDI files in one process.
+
+#pragma once
+
+#include "params.h"
+
+// Renders every file named by `params.batch_path`. Roms are loaded and an emulator is booted only once; every render
+// starts from a snapshot of that emulator instead of booting again. Returns false if any file failed.
+bool R_RenderBatch(const R_Parameters& params);
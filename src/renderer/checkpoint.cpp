@@ -0,0 +1,127 @@
+#include "checkpoint.h"
+#include "panic.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+void R_CheckpointStore::Open(const std::filesystem::path& directory, size_t instances, uint64_t interval_ns)
+{
+    m_directory   = directory;
+    m_instances   = instances;
+    m_interval_ns = interval_ns;
+    m_restored.assign(instances, {});
+}
+
+void R_CheckpointStore::Save(size_t index, size_t instance, Emulator& emu, const R_CheckpointPosition& position)
+{
+    const std::filesystem::path path = GetPath(index, instance);
+
+    std::error_code ec;
+    if (std::filesystem::exists(path, ec))
+    {
+        return;
+    }
+    std::filesystem::create_directories(m_directory, ec);
+
+    EMU_State state;
+    emu.SaveState(state);
+
+    const Header header{
+        .magic            = {'S', 'C', '5', '5', 'C', 'K', 'P', 'T'},
+        .version          = VERSION,
+        .ns               = position.ns,
+        .next_event       = position.next_event,
+        .events_processed = position.events_processed,
+    };
+
+    // Write to a temporary file first so that an interrupted render never leaves a truncated checkpoint behind.
+    std::filesystem::path temp_path = path;
+    temp_path += ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary);
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)state.data.data(), (std::streamsize)state.data.size());
+        if (!file)
+        {
+            fprintf(stderr, "WARNING: Failed to write checkpoint %s\n", path.generic_string().c_str());
+            file.close();
+            std::filesystem::remove(temp_path, ec);
+            return;
+        }
+    }
+    std::filesystem::rename(temp_path, path, ec);
+}
+
+bool R_CheckpointStore::Restore(uint64_t ns, std::span<Emulator> emulators)
+{
+    std::vector<EMU_State>             states(m_instances);
+    std::vector<R_CheckpointPosition>& positions = m_restored;
+
+    for (size_t index = (size_t)(ns / m_interval_ns); index > 0; --index)
+    {
+        bool complete = true;
+        for (size_t i = 0; i < m_instances && complete; ++i)
+        {
+            // Instances run in lockstep, so they should all have stopped at the same step.
+            complete = Load(index, i, states[i], positions[i]) && positions[i].ns == positions[0].ns &&
+                       positions[i].ns <= ns;
+        }
+
+        if (complete && emulators[0].LoadState(states[0]))
+        {
+            for (size_t i = 1; i < m_instances; ++i)
+            {
+                if (!emulators[i].LoadState(states[i]))
+                {
+                    R_Panic("checkpoint instances were saved by different builds");
+                }
+            }
+            return true;
+        }
+    }
+
+    positions.assign(m_instances, {});
+    return false;
+}
+
+std::filesystem::path R_CheckpointStore::GetPath(size_t index, size_t instance) const
+{
+    return m_directory / (std::to_string(index) + "-" + std::to_string(instance) + ".state");
+}
+
+bool R_CheckpointStore::Load(size_t index, size_t instance, EMU_State& state, R_CheckpointPosition& position) const
+{
+    std::ifstream file(GetPath(index, instance), std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+        return false;
+    }
+
+    const std::streamoff size = file.tellg();
+    if (size < (std::streamoff)sizeof(Header))
+    {
+        return false;
+    }
+    file.seekg(0);
+
+    Header header;
+    file.read((char*)&header, sizeof(header));
+    if (!file || memcmp(header.magic, "SC55CKPT", sizeof(header.magic)) != 0 || header.version != VERSION)
+    {
+        return false;
+    }
+
+    // The emulator checks the size, version, and romset of the state itself when it is loaded.
+    state.data.resize((size_t)(size - (std::streamoff)sizeof(Header)));
+    file.read((char*)state.data.data(), (std::streamsize)state.data.size());
+    if (!file)
+    {
+        return false;
+    }
+
+    position.ns               = header.ns;
+    position.next_event       = header.next_event;
+    position.events_processed = header.events_processed;
+    return true;
+}
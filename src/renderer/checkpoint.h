@@ -0,0 +1,73 @@
+// Emulator checkpoints saved to disk so that renders of the same song can skip
+// ahead.
+
+#pragma once
+
+#include "emu.h"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+// Where an instance was in the song when a checkpoint was taken.
+struct R_CheckpointPosition
+{
+    // Time simulated so far. Always a whole number of steps.
+    uint64_t ns = 0;
+    // Index in the merged track of the first event that hasn't been played yet.
+    uint64_t next_event = 0;
+    uint64_t events_processed = 0;
+};
+
+// Emulator snapshots taken at regular points in a song so that later renders of the same song can skip ahead. Each
+// checkpoint is stored as one file per instance, named `<checkpoint>-<instance>.state`, in a directory that should be
+// unique to everything affecting what the emulators do (see R_CheckpointKey).
+//
+// Checkpoint N is taken at the first step at or after N times the interval, so that every instance takes it at the
+// same point.
+class R_CheckpointStore
+{
+public:
+    void Open(const std::filesystem::path& directory, size_t instances, uint64_t interval_ns);
+
+    uint64_t GetIntervalNS() const
+    {
+        return m_interval_ns;
+    }
+
+    // Saves the snapshot of `instance` for checkpoint `index` unless it already exists. Called from render threads.
+    void Save(size_t index, size_t instance, Emulator& emu, const R_CheckpointPosition& position);
+
+    // Restores every emulator from the latest checkpoint at or before `ns` that was saved by all instances. Emulators
+    // are left unchanged and false is returned when there is no such checkpoint.
+    bool Restore(uint64_t ns, std::span<Emulator> emulators);
+
+    // Where `instance` resumes in the song. Zero unless `Restore` succeeded.
+    const R_CheckpointPosition& GetRestoredPosition(size_t instance) const
+    {
+        return m_restored[instance];
+    }
+
+private:
+    static constexpr uint32_t VERSION = 1;
+
+    struct Header
+    {
+        char     magic[8];
+        uint32_t version;
+        uint32_t reserved = 0;
+        uint64_t ns;
+        uint64_t next_event;
+        uint64_t events_processed;
+    };
+
+    std::filesystem::path GetPath(size_t index, size_t instance) const;
+    bool Load(size_t index, size_t instance, EMU_State& state, R_CheckpointPosition& position) const;
+
+    std::filesystem::path m_directory;
+    size_t                m_instances   = 0;
+    uint64_t              m_interval_ns = 0;
+
+    std::vector<R_CheckpointPosition> m_restored;
+};
@@ -0,0 +1,780 @@
+// We use fopen()
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "flac.h"
+#include "cast.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+
+// Samples per FLAC frame. 4096 is what the reference encoder uses for 44.1/48 kHz audio and has a dedicated block size
+// code.
+constexpr size_t FLAC_BLOCK_SIZE = 4096;
+
+// Number of blocks handed to the worker at a time.
+constexpr size_t FLAC_BATCH_BLOCKS = 16;
+constexpr size_t FLAC_BATCH_FRAMES = FLAC_BLOCK_SIZE * FLAC_BATCH_BLOCKS;
+
+// Maximum number of batches waiting for the worker before Write blocks.
+constexpr size_t FLAC_MAX_QUEUED_BATCHES = 4;
+
+// Space for this many seek points is reserved when the file is opened. Unused points are written as placeholders.
+constexpr size_t FLAC_SEEK_POINTS = 128;
+
+constexpr size_t FLAC_STREAMINFO_SIZE = 34;
+constexpr size_t FLAC_SEEKPOINT_SIZE  = 18;
+constexpr size_t FLAC_HEADER_SIZE =
+    4 + (4 + FLAC_STREAMINFO_SIZE) + (4 + FLAC_SEEKPOINT_SIZE * FLAC_SEEK_POINTS);
+
+constexpr uint32_t FLAC_MAX_FIXED_ORDER     = 4;
+constexpr uint32_t FLAC_MAX_PARTITION_ORDER = 8;
+
+enum class FLAC_ChannelAssignment : uint8_t
+{
+    Independent = 0b0001,
+    LeftSide    = 0b1000,
+    RightSide   = 0b1001,
+    MidSide     = 0b1010,
+};
+
+static constexpr std::array<uint8_t, 256> FLAC_MakeCRC8Table()
+{
+    std::array<uint8_t, 256> table{};
+    for (size_t i = 0; i < 256; ++i)
+    {
+        uint8_t crc = (uint8_t)i;
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = (uint8_t)((crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1));
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+static constexpr std::array<uint16_t, 256> FLAC_MakeCRC16Table()
+{
+    std::array<uint16_t, 256> table{};
+    for (size_t i = 0; i < 256; ++i)
+    {
+        uint16_t crc = (uint16_t)(i << 8);
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = (uint16_t)((crc & 0x8000) ? (crc << 1) ^ 0x8005 : (crc << 1));
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+static constexpr auto FLAC_CRC8_TABLE  = FLAC_MakeCRC8Table();
+static constexpr auto FLAC_CRC16_TABLE = FLAC_MakeCRC16Table();
+
+static uint8_t FLAC_CRC8(std::span<const uint8_t> bytes)
+{
+    uint8_t crc = 0;
+    for (uint8_t b : bytes)
+    {
+        crc = FLAC_CRC8_TABLE[crc ^ b];
+    }
+    return crc;
+}
+
+static uint16_t FLAC_CRC16(std::span<const uint8_t> bytes)
+{
+    uint16_t crc = 0;
+    for (uint8_t b : bytes)
+    {
+        crc = (uint16_t)((crc << 8) ^ FLAC_CRC16_TABLE[(crc >> 8) ^ b]);
+    }
+    return crc;
+}
+
+// MSB-first bit writer.
+class FLAC_BitWriter
+{
+public:
+    void Clear()
+    {
+        m_bytes.clear();
+        m_acc   = 0;
+        m_nbits = 0;
+    }
+
+    // precondition: bits <= 32
+    void Write(uint64_t value, uint32_t bits)
+    {
+        if (bits == 0)
+        {
+            return;
+        }
+        m_acc = (m_acc << bits) | (value & ((uint64_t{1} << bits) - 1));
+        m_nbits += bits;
+        while (m_nbits >= 8)
+        {
+            m_nbits -= 8;
+            m_bytes.push_back((uint8_t)(m_acc >> m_nbits));
+        }
+    }
+
+    void WriteSigned(int64_t value, uint32_t bits)
+    {
+        Write((uint64_t)value, bits);
+    }
+
+    void WriteUnary(uint64_t zeros)
+    {
+        while (zeros >= 32)
+        {
+            Write(0, 32);
+            zeros -= 32;
+        }
+        Write(1, (uint32_t)zeros + 1);
+    }
+
+    void WriteRice(uint64_t value, uint32_t param)
+    {
+        WriteUnary(value >> param);
+        Write(value, param);
+    }
+
+    void AlignToByte()
+    {
+        if (m_nbits)
+        {
+            Write(0, 8 - m_nbits);
+        }
+    }
+
+    std::span<const uint8_t> Bytes() const
+    {
+        return m_bytes;
+    }
+
+private:
+    std::vector<uint8_t> m_bytes;
+    uint64_t             m_acc   = 0;
+    uint32_t             m_nbits = 0;
+};
+
+static uint64_t FLAC_Fold(int32_t residual)
+{
+    return residual >= 0 ? (uint64_t)residual << 1 : ((uint64_t)(-(int64_t)residual) << 1) - 1;
+}
+
+static void FLAC_ComputeFixedResidual(const int32_t* x, size_t n, uint32_t order, int32_t* residual)
+{
+    // Inputs are at most 25 bits (24-bit side channel) so order 4 residuals fit in 29 bits.
+    switch (order)
+    {
+    case 0:
+        for (size_t i = 0; i < n; ++i)
+        {
+            residual[i] = x[i];
+        }
+        break;
+    case 1:
+        for (size_t i = 1; i < n; ++i)
+        {
+            residual[i - 1] = x[i] - x[i - 1];
+        }
+        break;
+    case 2:
+        for (size_t i = 2; i < n; ++i)
+        {
+            residual[i - 2] = x[i] - 2 * x[i - 1] + x[i - 2];
+        }
+        break;
+    case 3:
+        for (size_t i = 3; i < n; ++i)
+        {
+            residual[i - 3] = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+        }
+        break;
+    case 4:
+        for (size_t i = 4; i < n; ++i)
+        {
+            residual[i - 4] = x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+        }
+        break;
+    }
+}
+
+enum class FLAC_SubframeType
+{
+    Constant,
+    Verbatim,
+    Fixed,
+};
+
+// Everything needed to write one subframe, plus its size in bits.
+struct FLAC_Subframe
+{
+    FLAC_SubframeType type = FLAC_SubframeType::Verbatim;
+    uint32_t          bps  = 0;
+    uint64_t          bits = 0;
+
+    // Fixed only
+    uint32_t             order           = 0;
+    uint32_t             partition_order = 0;
+    bool                 rice2           = false;
+    std::vector<uint8_t> params;
+    std::vector<int32_t> residual;
+
+    // Scratch for the order search
+    std::vector<int32_t> trial_residual;
+    std::vector<uint8_t> trial_params;
+};
+
+// Picks a partition order and rice parameters for `residual` and returns the size of the residual section in bits.
+static uint64_t FLAC_ChooseRice(const int32_t*        residual,
+                                size_t                block_size,
+                                uint32_t              order,
+                                uint32_t&             out_partition_order,
+                                bool&                 out_rice2,
+                                std::vector<uint8_t>& out_params)
+{
+    uint32_t max_order = 0;
+    while (max_order < FLAC_MAX_PARTITION_ORDER && (block_size % ((size_t)2 << max_order)) == 0 &&
+           (block_size >> (max_order + 1)) > order)
+    {
+        ++max_order;
+    }
+
+    // Sums and counts of folded residuals at the finest partitioning, merged pairwise for coarser ones.
+    uint64_t sums[1 << FLAC_MAX_PARTITION_ORDER];
+    size_t   counts[1 << FLAC_MAX_PARTITION_ORDER];
+
+    const size_t partitions = (size_t)1 << max_order;
+    const size_t part_size  = block_size >> max_order;
+    size_t       r          = 0;
+    for (size_t p = 0; p < partitions; ++p)
+    {
+        const size_t count = part_size - (p == 0 ? order : 0);
+        uint64_t     sum   = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            sum += FLAC_Fold(residual[r + i]);
+        }
+        r += count;
+        sums[p]   = sum;
+        counts[p] = count;
+    }
+
+    uint64_t best_bits = UINT64_MAX;
+    for (uint32_t porder = max_order + 1; porder-- > 0;)
+    {
+        const size_t n_parts = (size_t)1 << porder;
+        if (porder != max_order)
+        {
+            for (size_t p = 0; p < n_parts; ++p)
+            {
+                sums[p]   = sums[2 * p] + sums[2 * p + 1];
+                counts[p] = counts[2 * p] + counts[2 * p + 1];
+            }
+        }
+
+        uint8_t  params[1 << FLAC_MAX_PARTITION_ORDER];
+        uint64_t bits  = 0;
+        bool     rice2 = false;
+        for (size_t p = 0; p < n_parts; ++p)
+        {
+            // Estimate: each value costs (k + 1) bits plus its unary part, which is about sum >> k in total.
+            uint32_t k = 0;
+            while (k < 30 && ((uint64_t)counts[p] << (k + 1)) < sums[p])
+            {
+                ++k;
+            }
+            params[p] = (uint8_t)k;
+            rice2 |= k > 14;
+            bits += (uint64_t)counts[p] * (k + 1) + (sums[p] >> k);
+        }
+        bits += 2 + 4 + n_parts * (rice2 ? 5 : 4);
+
+        if (bits < best_bits)
+        {
+            best_bits           = bits;
+            out_partition_order = porder;
+            out_rice2           = rice2;
+            out_params.assign(params, params + n_parts);
+        }
+    }
+
+    return best_bits;
+}
+
+static void FLAC_AnalyzeSubframe(const int32_t* x, size_t n, uint32_t bps, FLAC_Subframe& sub)
+{
+    sub.bps = bps;
+
+    if (std::all_of(x, x + n, [x](int32_t v) { return v == x[0]; }))
+    {
+        sub.type = FLAC_SubframeType::Constant;
+        sub.bits = 8 + bps;
+        return;
+    }
+
+    sub.type = FLAC_SubframeType::Verbatim;
+    sub.bits = 8 + (uint64_t)n * bps;
+
+    sub.residual.resize(n);
+    sub.trial_residual.resize(n);
+
+    for (uint32_t order = 0; order <= FLAC_MAX_FIXED_ORDER && order < n; ++order)
+    {
+        FLAC_ComputeFixedResidual(x, n, order, sub.trial_residual.data());
+
+        uint32_t partition_order = 0;
+        bool     rice2           = false;
+        uint64_t bits = 8 + (uint64_t)order * bps +
+                        FLAC_ChooseRice(sub.trial_residual.data(), n, order, partition_order, rice2, sub.trial_params);
+
+        if (bits < sub.bits)
+        {
+            sub.type            = FLAC_SubframeType::Fixed;
+            sub.bits            = bits;
+            sub.order           = order;
+            sub.partition_order = partition_order;
+            sub.rice2           = rice2;
+            sub.params.swap(sub.trial_params);
+            sub.residual.swap(sub.trial_residual);
+        }
+    }
+}
+
+static void FLAC_WriteSubframe(FLAC_BitWriter& w, const int32_t* x, size_t n, const FLAC_Subframe& sub)
+{
+    switch (sub.type)
+    {
+    case FLAC_SubframeType::Constant:
+        w.Write(0b00000000, 8);
+        w.WriteSigned(x[0], sub.bps);
+        break;
+    case FLAC_SubframeType::Verbatim:
+        w.Write(0b00000010, 8);
+        for (size_t i = 0; i < n; ++i)
+        {
+            w.WriteSigned(x[i], sub.bps);
+        }
+        break;
+    case FLAC_SubframeType::Fixed: {
+        w.Write(0b00010000 | (sub.order << 1), 8);
+        for (size_t i = 0; i < sub.order; ++i)
+        {
+            w.WriteSigned(x[i], sub.bps);
+        }
+
+        w.Write(sub.rice2 ? 1 : 0, 2);
+        w.Write(sub.partition_order, 4);
+
+        const size_t partitions = (size_t)1 << sub.partition_order;
+        const size_t part_size  = n >> sub.partition_order;
+        size_t       r          = 0;
+        for (size_t p = 0; p < partitions; ++p)
+        {
+            const uint32_t k     = sub.params[p];
+            const size_t   count = part_size - (p == 0 ? sub.order : 0);
+            w.Write(k, sub.rice2 ? 5 : 4);
+            for (size_t i = 0; i < count; ++i)
+            {
+                w.WriteRice(FLAC_Fold(sub.residual[r + i]), k);
+            }
+            r += count;
+        }
+        break;
+    }
+    }
+}
+
+// Encodes whole frames. One instance lives on the worker thread.
+class FLAC_FrameEncoder
+{
+public:
+    FLAC_FrameEncoder(uint32_t sample_rate, uint32_t bits_per_sample)
+        : m_sample_rate(sample_rate)
+        , m_bps(bits_per_sample)
+    {
+    }
+
+    std::span<const uint8_t> Encode(const int32_t* left, const int32_t* right, size_t n, uint64_t frame_number)
+    {
+        m_mid.resize(n);
+        m_side.resize(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            m_mid[i]  = (left[i] + right[i]) >> 1;
+            m_side[i] = left[i] - right[i];
+        }
+
+        FLAC_AnalyzeSubframe(left, n, m_bps, m_left_sub);
+        FLAC_AnalyzeSubframe(right, n, m_bps, m_right_sub);
+        FLAC_AnalyzeSubframe(m_mid.data(), n, m_bps, m_mid_sub);
+        FLAC_AnalyzeSubframe(m_side.data(), n, m_bps + 1, m_side_sub);
+
+        const uint64_t cost_lr = m_left_sub.bits + m_right_sub.bits;
+        const uint64_t cost_ls = m_left_sub.bits + m_side_sub.bits;
+        const uint64_t cost_rs = m_right_sub.bits + m_side_sub.bits;
+        const uint64_t cost_ms = m_mid_sub.bits + m_side_sub.bits;
+
+        FLAC_ChannelAssignment assignment = FLAC_ChannelAssignment::Independent;
+        uint64_t               best       = cost_lr;
+        if (cost_ls < best)
+        {
+            assignment = FLAC_ChannelAssignment::LeftSide;
+            best       = cost_ls;
+        }
+        if (cost_rs < best)
+        {
+            assignment = FLAC_ChannelAssignment::RightSide;
+            best       = cost_rs;
+        }
+        if (cost_ms < best)
+        {
+            assignment = FLAC_ChannelAssignment::MidSide;
+        }
+
+        m_writer.Clear();
+        WriteFrameHeader(n, frame_number, assignment);
+
+        switch (assignment)
+        {
+        case FLAC_ChannelAssignment::Independent:
+            FLAC_WriteSubframe(m_writer, left, n, m_left_sub);
+            FLAC_WriteSubframe(m_writer, right, n, m_right_sub);
+            break;
+        case FLAC_ChannelAssignment::LeftSide:
+            FLAC_WriteSubframe(m_writer, left, n, m_left_sub);
+            FLAC_WriteSubframe(m_writer, m_side.data(), n, m_side_sub);
+            break;
+        case FLAC_ChannelAssignment::RightSide:
+            FLAC_WriteSubframe(m_writer, m_side.data(), n, m_side_sub);
+            FLAC_WriteSubframe(m_writer, right, n, m_right_sub);
+            break;
+        case FLAC_ChannelAssignment::MidSide:
+            FLAC_WriteSubframe(m_writer, m_mid.data(), n, m_mid_sub);
+            FLAC_WriteSubframe(m_writer, m_side.data(), n, m_side_sub);
+            break;
+        }
+
+        m_writer.AlignToByte();
+        m_writer.Write(FLAC_CRC16(m_writer.Bytes()), 16);
+
+        return m_writer.Bytes();
+    }
+
+private:
+    void WriteFrameHeader(size_t n, uint64_t frame_number, FLAC_ChannelAssignment assignment)
+    {
+        // Sync code, reserved bit, fixed blocksize
+        m_writer.Write(0xFFF8, 16);
+
+        const uint32_t block_size_code = n == FLAC_BLOCK_SIZE ? 0b1100 : 0b0111;
+
+        // Sample rates that don't fit in the header are read from STREAMINFO. This includes the 66207 Hz mk1 rate.
+        uint32_t sample_rate_code = 0b0000;
+        if (m_sample_rate <= 0xFFFF)
+        {
+            sample_rate_code = 0b1101;
+        }
+        else if (m_sample_rate % 10 == 0 && m_sample_rate / 10 <= 0xFFFF)
+        {
+            sample_rate_code = 0b1110;
+        }
+
+        m_writer.Write(block_size_code, 4);
+        m_writer.Write(sample_rate_code, 4);
+        m_writer.Write((uint32_t)assignment, 4);
+        m_writer.Write(m_bps == 16 ? 0b100 : 0b110, 3);
+        m_writer.Write(0, 1);
+
+        WriteUTF8(frame_number);
+
+        if (block_size_code == 0b0111)
+        {
+            m_writer.Write(n - 1, 16);
+        }
+
+        if (sample_rate_code == 0b1101)
+        {
+            m_writer.Write(m_sample_rate, 16);
+        }
+        else if (sample_rate_code == 0b1110)
+        {
+            m_writer.Write(m_sample_rate / 10, 16);
+        }
+
+        m_writer.Write(FLAC_CRC8(m_writer.Bytes()), 8);
+    }
+
+    // FLAC uses an extended UTF-8 encoding for frame numbers.
+    void WriteUTF8(uint64_t value)
+    {
+        if (value < 0x80)
+        {
+            m_writer.Write(value, 8);
+            return;
+        }
+
+        // A sequence of `len` bytes holds 5 * len + 1 bits.
+        uint32_t len = 2;
+        while (len < 7 && (value >> (5 * len + 1)) != 0)
+        {
+            ++len;
+        }
+
+        const uint32_t lead_mark = (0xFF00u >> len) & 0xFF;
+        m_writer.Write(lead_mark | (uint32_t)(value >> (6 * (len - 1))), 8);
+        for (uint32_t i = len - 1; i-- > 0;)
+        {
+            m_writer.Write(0x80 | ((value >> (6 * i)) & 0x3F), 8);
+        }
+    }
+
+private:
+    uint32_t m_sample_rate;
+    uint32_t m_bps;
+
+    std::vector<int32_t> m_mid;
+    std::vector<int32_t> m_side;
+
+    FLAC_Subframe m_left_sub;
+    FLAC_Subframe m_right_sub;
+    FLAC_Subframe m_mid_sub;
+    FLAC_Subframe m_side_sub;
+
+    FLAC_BitWriter m_writer;
+};
+
+static void FLAC_WriteU8(FILE* output, uint8_t value)
+{
+    fwrite(&value, 1, 1, output);
+}
+
+static void FLAC_WriteBE(FILE* output, uint64_t value, size_t bytes)
+{
+    for (size_t i = bytes; i-- > 0;)
+    {
+        FLAC_WriteU8(output, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+FLAC_Handle::~FLAC_Handle()
+{
+    if (m_worker.joinable())
+    {
+        SubmitPending(true);
+        m_worker.join();
+    }
+    Close();
+}
+
+void FLAC_Handle::SetSampleRate(uint32_t sample_rate)
+{
+    m_sample_rate = sample_rate;
+}
+
+bool FLAC_Handle::Open(const std::filesystem::path& filename, uint32_t bits_per_sample)
+{
+    assert(bits_per_sample == 16 || bits_per_sample == 24);
+
+    m_bits_per_sample = bits_per_sample;
+    m_output          = fopen(filename.generic_string().c_str(), "wb");
+    if (!m_output)
+    {
+        return false;
+    }
+    fseek(m_output, (long)FLAC_HEADER_SIZE, SEEK_SET);
+
+    m_pending.left.reserve(FLAC_BATCH_FRAMES);
+    m_pending.right.reserve(FLAC_BATCH_FRAMES);
+    return true;
+}
+
+void FLAC_Handle::Close()
+{
+    if (m_output)
+    {
+        fclose(m_output);
+    }
+    m_output = nullptr;
+}
+
+template <typename T, int Shift>
+void FLAC_Handle::WriteFrames(std::span<const AudioFrame<T>> frames)
+{
+    if (!m_worker_started)
+    {
+        StartWorker();
+    }
+
+    while (!frames.empty())
+    {
+        const size_t space = FLAC_BATCH_FRAMES - m_pending.left.size();
+        const size_t count = std::min(space, frames.size());
+        for (size_t i = 0; i < count; ++i)
+        {
+            m_pending.left.push_back((int32_t)frames[i].left >> Shift);
+            m_pending.right.push_back((int32_t)frames[i].right >> Shift);
+        }
+        frames = frames.subspan(count);
+
+        if (m_pending.left.size() == FLAC_BATCH_FRAMES)
+        {
+            SubmitPending(false);
+        }
+    }
+}
+
+void FLAC_Handle::Write(std::span<const AudioFrame<int16_t>> frames)
+{
+    assert(m_bits_per_sample == 16);
+    WriteFrames<int16_t, 0>(frames);
+}
+
+void FLAC_Handle::Write(std::span<const AudioFrame<int32_t>> frames)
+{
+    assert(m_bits_per_sample == 24);
+    WriteFrames<int32_t, 8>(frames);
+}
+
+void FLAC_Handle::SubmitPending(bool last)
+{
+    m_pending.last = last;
+
+    std::unique_lock lk(m_mutex);
+    m_cond.wait(lk, [this] { return m_batches.size() < FLAC_MAX_QUEUED_BATCHES; });
+
+    m_batches.emplace_back(std::move(m_pending));
+
+    if (!m_free_batches.empty())
+    {
+        m_pending = std::move(m_free_batches.back());
+        m_free_batches.pop_back();
+    }
+    else
+    {
+        m_pending = Batch{};
+        m_pending.left.reserve(FLAC_BATCH_FRAMES);
+        m_pending.right.reserve(FLAC_BATCH_FRAMES);
+    }
+    m_pending.left.clear();
+    m_pending.right.clear();
+    m_pending.last = false;
+
+    lk.unlock();
+    m_cond.notify_all();
+}
+
+void FLAC_Handle::StartWorker()
+{
+    m_worker_started = true;
+    m_worker         = std::thread(&FLAC_Handle::WorkerMain, this);
+}
+
+void FLAC_Handle::WorkerMain()
+{
+    FLAC_FrameEncoder encoder(m_sample_rate, m_bits_per_sample);
+
+    for (;;)
+    {
+        Batch batch;
+        {
+            std::unique_lock lk(m_mutex);
+            m_cond.wait(lk, [this] { return !m_batches.empty(); });
+            batch = std::move(m_batches.front());
+            m_batches.pop_front();
+        }
+        m_cond.notify_all();
+
+        const size_t total = batch.left.size();
+        for (size_t first = 0; first < total; first += FLAC_BLOCK_SIZE)
+        {
+            const size_t count = std::min(FLAC_BLOCK_SIZE, total - first);
+
+            auto bytes = encoder.Encode(&batch.left[first], &batch.right[first], count, m_frame_number);
+            fwrite(bytes.data(), 1, bytes.size(), m_output);
+
+            m_frames.push_back({m_total_samples, m_stream_bytes, (uint16_t)count});
+            m_min_frame = std::min(m_min_frame, (uint32_t)bytes.size());
+            m_max_frame = std::max(m_max_frame, (uint32_t)bytes.size());
+
+            ++m_frame_number;
+            m_total_samples += count;
+            m_stream_bytes += bytes.size();
+        }
+
+        const bool last = batch.last;
+        {
+            std::scoped_lock lk(m_mutex);
+            m_free_batches.emplace_back(std::move(batch));
+        }
+
+        if (last)
+        {
+            return;
+        }
+    }
+}
+
+void FLAC_Handle::WriteHeader()
+{
+    fseek(m_output, 0, SEEK_SET);
+
+    fwrite("fLaC", 1, 4, m_output);
+
+    // STREAMINFO
+    FLAC_WriteU8(m_output, 0x00);
+    FLAC_WriteBE(m_output, FLAC_STREAMINFO_SIZE, 3);
+    FLAC_WriteBE(m_output, FLAC_BLOCK_SIZE, 2);
+    FLAC_WriteBE(m_output, FLAC_BLOCK_SIZE, 2);
+    FLAC_WriteBE(m_output, m_frames.empty() ? 0 : m_min_frame, 3);
+    FLAC_WriteBE(m_output, m_max_frame, 3);
+    // 20 bits sample rate, 3 bits channels - 1, 5 bits bps - 1, 36 bits total samples
+    const uint64_t packed = ((uint64_t)m_sample_rate << 44) | ((uint64_t)(AudioFrame<int32_t>::channel_count - 1) << 41) |
+                            ((uint64_t)(m_bits_per_sample - 1) << 36) | (m_total_samples & 0xFFFFFFFFFull);
+    FLAC_WriteBE(m_output, packed, 8);
+    // MD5 of the decoded audio; all zero means it wasn't computed.
+    for (int i = 0; i < 16; ++i)
+    {
+        FLAC_WriteU8(m_output, 0);
+    }
+
+    // SEEKTABLE, last metadata block
+    FLAC_WriteU8(m_output, 0x80 | 0x03);
+    FLAC_WriteBE(m_output, FLAC_SEEKPOINT_SIZE * FLAC_SEEK_POINTS, 3);
+
+    const size_t used_points = std::min(FLAC_SEEK_POINTS, m_frames.size());
+    for (size_t i = 0; i < used_points; ++i)
+    {
+        const SeekPoint& point = m_frames[i * m_frames.size() / used_points];
+        FLAC_WriteBE(m_output, point.sample, 8);
+        FLAC_WriteBE(m_output, point.offset, 8);
+        FLAC_WriteBE(m_output, point.frame_samples, 2);
+    }
+    for (size_t i = used_points; i < FLAC_SEEK_POINTS; ++i)
+    {
+        // placeholder point
+        FLAC_WriteBE(m_output, UINT64_MAX, 8);
+        FLAC_WriteBE(m_output, 0, 8);
+        FLAC_WriteBE(m_output, 0, 2);
+    }
+
+    assert(ftell(m_output) == (long)FLAC_HEADER_SIZE);
+}
+
+void FLAC_Handle::Finish()
+{
+    if (!m_worker_started)
+    {
+        StartWorker();
+    }
+
+    SubmitPending(true);
+    m_worker.join();
+
+    WriteHeader();
+
+    Close();
+}
@@ -0,0 +1,89 @@
+// This is a minimal FLAC encoder. It only uses fixed predictors, which are
+// fast to search and get most of the way to what reference encoders achieve on
+// synthesized audio.
+//
+// Frames are encoded on a worker thread so the caller only pays for copying
+// samples.
+
+#pragma once
+
+#include "audio.h"
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+class FLAC_Handle
+{
+public:
+    FLAC_Handle() = default;
+    ~FLAC_Handle();
+    // noncopyable, nonmoveable because of the worker thread
+    FLAC_Handle(const FLAC_Handle&)            = delete;
+    FLAC_Handle& operator=(const FLAC_Handle&) = delete;
+    FLAC_Handle(FLAC_Handle&&)                 = delete;
+    FLAC_Handle& operator=(FLAC_Handle&&)      = delete;
+
+    // Must be called before the first Write.
+    void SetSampleRate(uint32_t sample_rate);
+
+    // `bits_per_sample` must be 16 or 24. 16-bit streams accept int16_t frames and 24-bit streams accept int32_t
+    // frames, of which the top 24 bits are kept. Returns false if the file couldn't be created.
+    bool Open(const std::filesystem::path& filename, uint32_t bits_per_sample);
+    void Close();
+    void Write(std::span<const AudioFrame<int16_t>> frames);
+    void Write(std::span<const AudioFrame<int32_t>> frames);
+    void Finish();
+
+private:
+    // Deinterleaved samples for a run of blocks, handed to the worker in one piece.
+    struct Batch
+    {
+        std::vector<int32_t> left;
+        std::vector<int32_t> right;
+        bool                 last = false;
+    };
+
+    struct SeekPoint
+    {
+        uint64_t sample;
+        uint64_t offset;
+        uint16_t frame_samples;
+    };
+
+    template <typename T, int Shift>
+    void WriteFrames(std::span<const AudioFrame<T>> frames);
+    void SubmitPending(bool last);
+    void StartWorker();
+    void WorkerMain();
+    void WriteHeader();
+
+private:
+    FILE*    m_output          = nullptr;
+    uint32_t m_sample_rate     = 0;
+    uint32_t m_bits_per_sample = 16;
+    bool     m_worker_started  = false;
+
+    // Owned by the producer.
+    Batch m_pending;
+
+    // Shared with the worker.
+    std::mutex              m_mutex;
+    std::condition_variable m_cond;
+    std::deque<Batch>       m_batches;
+    std::vector<Batch>      m_free_batches;
+    std::thread             m_worker;
+
+    // Owned by the worker until it is joined.
+    uint64_t               m_frame_number  = 0;
+    uint64_t               m_total_samples = 0;
+    uint64_t               m_stream_bytes  = 0;
+    uint32_t               m_min_frame     = UINT32_MAX;
+    uint32_t               m_max_frame     = 0;
+    std::vector<SeekPoint> m_frames;
+};
@@ -1,70 +1,20 @@
-#include "audio.h"
-#include "cast.h"
+#include "batch.h"
 #include "config.h"
-#include "emu.h"
-#include "math_util.h"
+#include "output_spec.h"
+#include "params.h"
+#include "render.h"
+#include "serve.h"
 #include "smf.h"
-#include "wav.h"
 #include <algorithm>
-#include <cinttypes>
-#include <condition_variable>
-#include <cstddef>
 #include <cstdio>
-#include <cstring>
-#include <functional>
-#include <memory>
-#include <mutex>
-#include <source_location>
 #include <string>
-#include <thread>
+#include <string_view>
 
 #include "common/command_line.h"
 #include "common/gain.h"
 #include "common/path_util.h"
 #include "common/rom_loader.h"
 
-#ifdef _WIN32
-#include <fcntl.h>
-#include <io.h>
-#endif
-
-using namespace std::chrono_literals;
-
-enum class R_EndBehavior
-{
-    // Cut the track at the last MIDI event.
-    Cut,
-    // Keep rendering until the emulator produces silence.
-    Release,
-};
-
-struct R_AdvancedParameters
-{
-    common::RomOverrides rom_overrides;
-};
-
-struct R_Parameters
-{
-    std::string_view input_filename;
-    std::string_view output_filename;
-    bool help = false;
-    bool version = false;
-    size_t instances = 1;
-    std::optional<EMU_SystemReset> reset;
-    std::filesystem::path rom_directory = std::filesystem::current_path();
-    AudioFormat output_format = AudioFormat::S16;
-    bool output_stdout = false;
-    bool disable_oversampling = false;
-    std::string_view romset_name;
-    bool debug = false;
-    R_EndBehavior end_behavior = R_EndBehavior::Cut;
-    std::filesystem::path nvram_filename;
-    bool legacy_romset_detection = false;
-    bool dump_emidi_loop_points = false;
-    float gain = 1.0f;
-    R_AdvancedParameters adv;
-};
-
 enum class R_ParseError
 {
     Success,
@@ -79,6 +29,33 @@ enum class R_ParseError
     EndInvalid,
     ResetInvalid,
     GainInvalid,
+    StemsRequiresOutput,
+    RateInvalid,
+    RateOutOfRange,
+    FlacRequiresOutput,
+    MaxQueuedChunksInvalid,
+    MaxQueuedChunksOutOfRange,
+    RoutingInvalid,
+    InstancesRequireVoiceRouting,
+    BatchNotFound,
+    BatchIncompatible,
+    OutputDirRequiresBatch,
+    JobsInvalid,
+    JobsOutOfRange,
+    ServeIncompatible,
+    ServeUnsupported,
+    MultipleOutputsIncompatible,
+    TimeInvalid,
+    TimeRangeEmpty,
+    RangeIncompatible,
+    CheckpointIntervalInvalid,
+    CheckpointIntervalOutOfRange,
+    CheckpointIncompatible,
+    EMIDILoopIncompatible,
+    LoudnessInvalid,
+    LoudnessOutOfRange,
+    NormalizeIncompatible,
+    ProgressJsonIncompatible,
 };
 
 const char* R_ParseErrorStr(R_ParseError err)
@@ -94,9 +71,9 @@ const char* R_ParseErrorStr(R_ParseError err)
         case R_ParseError::MultipleInputs:
             return "Multiple input files";
         case R_ParseError::InstancesInvalid:
-            return "Instances couldn't be parsed (should be 1-16)";
+            return "Instances couldn't be parsed (should be 1-16, or 1-64 with --routing voice)";
         case R_ParseError::InstancesOutOfRange:
-            return "Instances out of range (should be 1-16)";
+            return "Instances out of range (should be 1-16, or 1-64 with --routing voice)";
         case R_ParseError::UnexpectedEnd:
             return "Expected another argument";
         case R_ParseError::RomDirectoryNotFound:
@@ -109,10 +86,102 @@ const char* R_ParseErrorStr(R_ParseError err)
             return "Reset invalid (should be none, gs, or gm)";
         case R_ParseError::GainInvalid:
             return "Gain invalid (should be a number optionally ending in 'db')";
+        case R_ParseError::StemsRequiresOutput:
+            return "--stems requires an output file (pass -o)";
+        case R_ParseError::RateInvalid:
+            return "Rate couldn't be parsed (should be 8000-384000)";
+        case R_ParseError::RateOutOfRange:
+            return "Rate out of range (should be 8000-384000)";
+        case R_ParseError::FlacRequiresOutput:
+            return "FLAC output requires an output file (pass -o)";
+        case R_ParseError::MaxQueuedChunksInvalid:
+            return "Max queued chunks couldn't be parsed (should be 1-65536)";
+        case R_ParseError::MaxQueuedChunksOutOfRange:
+            return "Max queued chunks out of range (should be 1-65536)";
+        case R_ParseError::RoutingInvalid:
+            return "Routing invalid (should be modulo, balanced, or voice)";
+        case R_ParseError::InstancesRequireVoiceRouting:
+            return "More than 16 instances requires --routing voice";
+        case R_ParseError::BatchNotFound:
+            return "Batch list or directory doesn't exist";
+        case R_ParseError::BatchIncompatible:
+            return "--batch can't be combined with an input file, -o, --stdout, --stems, --nvram, or "
+                   "--dump-emidi-loop-points";
+        case R_ParseError::OutputDirRequiresBatch:
+            return "--output-dir requires --batch";
+        case R_ParseError::JobsInvalid:
+            return "Jobs couldn't be parsed (should be 1-256)";
+        case R_ParseError::JobsOutOfRange:
+            return "Jobs out of range (should be 1-256)";
+        case R_ParseError::ServeIncompatible:
+            return "--serve can't be combined with an input file, -o, --stdout, --stems, --nvram, "
+                   "--dump-emidi-loop-points, --batch, or FLAC output";
+        case R_ParseError::ServeUnsupported:
+            return "--serve is not supported on this platform";
+        case R_ParseError::MultipleOutputsIncompatible:
+            return "Multiple -o can't be combined with --stdout or --stems";
+        case R_ParseError::TimeInvalid:
+            return "Time couldn't be parsed (should be [[h:]m:]s, e.g. 2:30 or 150.5)";
+        case R_ParseError::TimeRangeEmpty:
+            return "--to must be later than --from";
+        case R_ParseError::RangeIncompatible:
+            return "--from, --to, and --checkpoint-dir can't be combined with --batch or --serve";
+        case R_ParseError::CheckpointIntervalInvalid:
+            return "Checkpoint interval couldn't be parsed (should be 1-3600 seconds)";
+        case R_ParseError::CheckpointIntervalOutOfRange:
+            return "Checkpoint interval out of range (should be 1-3600 seconds)";
+        case R_ParseError::CheckpointIncompatible:
+            return "--checkpoint-dir can't be combined with --nvram";
+        case R_ParseError::EMIDILoopIncompatible:
+            return "--emidi-loop requires WAVE output to a file and can't be combined with --from, --to, "
+                   "--checkpoint-dir, --batch, or --serve";
+        case R_ParseError::LoudnessInvalid:
+            return "Loudness couldn't be parsed (should be -70 to 0 LUFS)";
+        case R_ParseError::LoudnessOutOfRange:
+            return "Loudness out of range (should be -70 to 0 LUFS)";
+        case R_ParseError::NormalizeIncompatible:
+            return "--normalize-lufs can't be combined with --stdout, --stems, or --serve";
+        case R_ParseError::ProgressJsonIncompatible:
+            return "--progress-json can't be combined with --batch or --serve";
     }
     return "Unknown error";
 }
 
+// Parses an output format name as accepted by -f.
+// Parses a point in a song written as `[[h:]m:]s`, where seconds may have a fractional part.
+bool R_ParseTime(std::string_view text, uint64_t& ns)
+{
+    constexpr uint64_t ONE_SEC = 1'000'000'000;
+
+    uint64_t whole_minutes = 0;
+    size_t   fields        = 0;
+    for (size_t colon = text.find(':'); colon != std::string_view::npos; colon = text.find(':'))
+    {
+        uint64_t value;
+        if (++fields > 2 || !common::TryParse(text.substr(0, colon), value))
+        {
+            return false;
+        }
+        whole_minutes = whole_minutes * 60 + value;
+        text.remove_prefix(colon + 1);
+    }
+
+    double seconds;
+    if (!common::TryParse(text, seconds) || !(seconds >= 0.0) || (fields > 0 && seconds >= 60.0))
+    {
+        return false;
+    }
+
+    // Anything this long is certainly a typo and would overflow below.
+    if (whole_minutes > 1'000'000 || seconds > 1e9)
+    {
+        return false;
+    }
+
+    ns = whole_minutes * 60 * ONE_SEC + (uint64_t)(seconds * (double)ONE_SEC + 0.5);
+    return true;
+}
+
 R_ParseError R_ParseCommandLine(int argc, char* argv[], R_Parameters& result)
 {
     common::CommandLineReader reader(argc, argv);
@@ -126,7 +195,7 @@ R_ParseError R_ParseCommandLine(int argc, char* argv[], R_Parameters& result)
                 return R_ParseError::UnexpectedEnd;
             }
 
-            result.output_filename = reader.Arg();
+            result.outputs.push_back(R_ParseOutputSpec(reader.Arg()));
         }
         else if (reader.Any("-h", "--help", "-?"))
         {
@@ -154,11 +223,157 @@ R_ParseError R_ParseCommandLine(int argc, char* argv[], R_Parameters& result)
                 return R_ParseError::InstancesInvalid;
             }
 
-            if (result.instances < 1 || result.instances > 16)
+            if (result.instances < 1 || result.instances > R_MAX_INSTANCES)
             {
                 return R_ParseError::InstancesOutOfRange;
             }
         }
+        else if (reader.Any("--routing"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            if (reader.Arg() == "modulo")
+            {
+                result.routing = R_RoutingMode::Modulo;
+            }
+            else if (reader.Arg() == "balanced")
+            {
+                result.routing = R_RoutingMode::Balanced;
+            }
+            else if (reader.Arg() == "voice")
+            {
+                result.routing = R_RoutingMode::Voice;
+            }
+            else
+            {
+                return R_ParseError::RoutingInvalid;
+            }
+        }
+        else if (reader.Any("--batch"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            result.batch_path = reader.Arg();
+            if (!std::filesystem::exists(result.batch_path))
+            {
+                return R_ParseError::BatchNotFound;
+            }
+        }
+        else if (reader.Any("--serve"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+#ifdef _WIN32
+            return R_ParseError::ServeUnsupported;
+#else
+            result.serve_path = reader.Arg();
+#endif
+        }
+        else if (reader.Any("--from"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            if (!R_ParseTime(reader.Arg(), result.from_ns))
+            {
+                return R_ParseError::TimeInvalid;
+            }
+        }
+        else if (reader.Any("--to"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            if (!R_ParseTime(reader.Arg(), result.to_ns))
+            {
+                return R_ParseError::TimeInvalid;
+            }
+        }
+        else if (reader.Any("--checkpoint-dir"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            result.checkpoint_directory = reader.Arg();
+        }
+        else if (reader.Any("--checkpoint-interval"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            uint64_t seconds;
+            if (!reader.TryParse(seconds))
+            {
+                return R_ParseError::CheckpointIntervalInvalid;
+            }
+
+            if (seconds < 1 || seconds > 3600)
+            {
+                return R_ParseError::CheckpointIntervalOutOfRange;
+            }
+
+            result.checkpoint_interval_ns = seconds * 1'000'000'000;
+        }
+        else if (reader.Any("--output-dir"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            result.output_directory = reader.Arg();
+        }
+        else if (reader.Any("-j", "--jobs"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            if (!reader.TryParse(result.jobs))
+            {
+                return R_ParseError::JobsInvalid;
+            }
+
+            if (result.jobs < 1 || result.jobs > 256)
+            {
+                return R_ParseError::JobsOutOfRange;
+            }
+        }
+        else if (reader.Any("--max-queued-chunks"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            if (!reader.TryParse(result.max_queued_chunks))
+            {
+                return R_ParseError::MaxQueuedChunksInvalid;
+            }
+
+            if (result.max_queued_chunks < 1 || result.max_queued_chunks > 65536)
+            {
+                return R_ParseError::MaxQueuedChunksOutOfRange;
+            }
+        }
         else if (reader.Any("-r", "--reset"))
         {
             if (!reader.Next())
@@ -221,19 +436,8 @@ R_ParseError R_ParseCommandLine(int argc, char* argv[], R_Parameters& result)
                 return R_ParseError::UnexpectedEnd;
             }
 
-            if (reader.Arg() == "s16")
-            {
-                result.output_format = AudioFormat::S16;
-            }
-            else if (reader.Arg() == "s32")
-            {
-                result.output_format = AudioFormat::S32;
-            }
-            else if (reader.Arg() == "f32")
-            {
-                result.output_format = AudioFormat::F32;
-            }
-            else
+            if (!R_ParseFormat(
+                    reader.Arg(), result.output_format, result.output_container, result.flac_bits_per_sample))
             {
                 return R_ParseError::FormatInvalid;
             }
@@ -246,6 +450,27 @@ R_ParseError R_ParseCommandLine(int argc, char* argv[], R_Parameters& result)
         {
             result.disable_oversampling = true;
         }
+        else if (reader.Any("--rate"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            if (!reader.TryParse(result.output_rate))
+            {
+                return R_ParseError::RateInvalid;
+            }
+
+            if (result.output_rate < 8000 || result.output_rate > 384000)
+            {
+                return R_ParseError::RateOutOfRange;
+            }
+        }
+        else if (reader.Any("--idle-bypass"))
+        {
+            result.idle_bypass = true;
+        }
         else if (reader.Any("--gain"))
         {
             if (!reader.Next())
@@ -258,6 +483,26 @@ R_ParseError R_ParseCommandLine(int argc, char* argv[], R_Parameters& result)
                 return R_ParseError::GainInvalid;
             }
         }
+        else if (reader.Any("--normalize-lufs"))
+        {
+            if (!reader.Next())
+            {
+                return R_ParseError::UnexpectedEnd;
+            }
+
+            double lufs;
+            if (!reader.TryParse(lufs))
+            {
+                return R_ParseError::LoudnessInvalid;
+            }
+
+            if (!(lufs >= -70.0 && lufs <= 0.0))
+            {
+                return R_ParseError::LoudnessOutOfRange;
+            }
+
+            result.normalize_lufs = lufs;
+        }
         else if (reader.Any("--legacy-romset-detection"))
         {
             result.legacy_romset_detection = true;
@@ -358,6 +603,18 @@ R_ParseError R_ParseCommandLine(int argc, char* argv[], R_Parameters& result)
         {
             result.dump_emidi_loop_points = true;
         }
+        else if (reader.Any("--emidi-loop"))
+        {
+            result.emidi_loop = true;
+        }
+        else if (reader.Any("--stems"))
+        {
+            result.stems = true;
+        }
+        else if (reader.Any("--progress-json"))
+        {
+            result.progress_json = true;
+        }
         else
         {
             if (result.input_filename.size())
@@ -368,1147 +625,196 @@ R_ParseError R_ParseCommandLine(int argc, char* argv[], R_Parameters& result)
         }
     }
 
-    if (result.input_filename.size() == 0)
+    // Fill in settings not given with -o now that -f and --gain are known.
+    for (R_OutputSpec& spec : result.outputs)
     {
-        return R_ParseError::NoInput;
-    }
-
-    if (result.output_filename.size() == 0 && !result.output_stdout)
-    {
-        return R_ParseError::NoOutput;
-    }
-
-    return R_ParseError::Success;
-}
-
-[[noreturn]]
-void R_Panic(const char* msg, const std::source_location where = std::source_location::current())
-{
-    fprintf(stderr, "%s:%d: in %s: %s", where.file_name(), (int)where.line(), where.function_name(), msg);
-    exit(1);
-}
-
-// Audio frame chunk. Points to a header followed by a dynamically sized buffer containing audio data. The buffer
-// contains audio data. This type has reference semantics and represents unowned memory like a bare pointer, so take
-// care making copies of it.
-class R_FrameChunk
-{
-public:
-    [[nodiscard]]
-    static R_FrameChunk Alloc(size_t size_bytes)
-    {
-        R_FrameChunk c;
-
-        // TODO: use a better allocator. We allocate a bit more space because malloc has weak alignment guarantees, and
-        // we want the buffer to be 64-byte aligned for max SIMD compatibility.
-        size_t alloc_size = 64 + sizeof(Header) + size_bytes;
-
-        void* ptr = malloc(alloc_size);
-        if (!ptr)
-        {
-            return c;
-        }
-
-        // This should never fail or adjust ptr so passing the aligned pointer back to free should be ok.
-        if (!std::align(alignof(Header), sizeof(Header), ptr, alloc_size))
+        if (!spec.has_format)
         {
-            R_Panic("failed to align header");
+            spec.format               = result.output_format;
+            spec.container            = result.output_container;
+            spec.flac_bits_per_sample = result.flac_bits_per_sample;
         }
-
-        Header* h = new (ptr) Header();
-        ptr = (uint8_t*)ptr + sizeof(Header);
-
-        if (!std::align(64, size_bytes, ptr, alloc_size))
+        if (!spec.has_gain)
         {
-            R_Panic("failed to align buffer");
+            spec.gain = result.gain;
         }
-
-        h->buffer      = ptr;
-        c.m_alloc      = h;
-        c.m_alloc->cap = size_bytes;
-
-        return c;
     }
 
-    static void Free(R_FrameChunk c)
+    if (result.outputs.size() == 1)
     {
-        free(c.m_alloc);
-        c.m_alloc = nullptr;
+        const R_OutputSpec& spec    = result.outputs[0];
+        result.output_format        = spec.format;
+        result.output_container     = spec.container;
+        result.flac_bits_per_sample = spec.flac_bits_per_sample;
+        result.gain                 = spec.gain;
     }
 
-    [[nodiscard]]
-    size_t GetBufferLength() const
+    if (!result.outputs.empty())
     {
-        return m_alloc->len;
+        result.output_filename = result.outputs[0].filename;
     }
 
-    [[nodiscard]]
-    void* DataFirst()
+    if (result.outputs.size() > 1 && (result.output_stdout || result.stems))
     {
-        return std::assume_aligned<64>(m_alloc->buffer);
+        return R_ParseError::MultipleOutputsIncompatible;
     }
 
-    [[nodiscard]]
-    void* DataLast()
+    if (!result.serve_path.empty())
     {
-        // We cannot assume the end is 64-byte aligned because audio frames may be much smaller.
-        return (uint8_t*)DataFirst() + m_alloc->len;
-    }
+        if (result.input_filename.size() || result.output_filename.size() || result.output_stdout || result.stems ||
+            !result.nvram_filename.empty() || result.dump_emidi_loop_points || !result.batch_path.empty() ||
+            result.output_container == R_OutputContainer::Flac)
+        {
+            return R_ParseError::ServeIncompatible;
+        }
 
-    void Write(const void* src, size_t src_len)
-    {
-        memcpy(DataLast(), src, src_len);
-        m_alloc->len += src_len;
+        if (!result.output_directory.empty())
+        {
+            return R_ParseError::OutputDirRequiresBatch;
+        }
     }
-
-    [[nodiscard]]
-    bool IsNull() const
+    else if (!result.batch_path.empty())
     {
-        return m_alloc == nullptr;
+        if (result.input_filename.size() || result.output_filename.size() || result.output_stdout || result.stems ||
+            !result.nvram_filename.empty() || result.dump_emidi_loop_points)
+        {
+            return R_ParseError::BatchIncompatible;
+        }
     }
-
-    void SetNext(R_FrameChunk c)
+    else
     {
-        m_alloc->next = c.m_alloc;
-    }
+        if (!result.output_directory.empty())
+        {
+            return R_ParseError::OutputDirRequiresBatch;
+        }
 
-    [[nodiscard]]
-    R_FrameChunk GetNext()
-    {
-        R_FrameChunk next;
-        next.m_alloc = m_alloc->next;
-        return next;
-    }
+        if (result.input_filename.size() == 0)
+        {
+            return R_ParseError::NoInput;
+        }
 
-    [[nodiscard]]
-    bool IsBufferFull() const
-    {
-        return m_alloc->len == m_alloc->cap;
+        if (result.output_filename.size() == 0 && !result.output_stdout)
+        {
+            return R_ParseError::NoOutput;
+        }
     }
 
-private:
-    struct Header
-    {
-        Header* next = nullptr;
-        size_t  len  = 0;
-        size_t  cap  = 0;
-        void*   buffer;
-    };
-
-private:
-    Header* m_alloc = nullptr;
-};
-
-// Manages a chunk and frees it when it goes out of scope, similar to unique_ptr. Code outside of the chunk queue should
-// only use this type.
-class R_OwnedChunk
-{
-public:
-    R_OwnedChunk() = default;
-
-    explicit R_OwnedChunk(R_FrameChunk c)
-        : m_chunk(c)
+    const bool has_range = result.from_ns != 0 || result.to_ns != UINT64_MAX || !result.checkpoint_directory.empty();
+    if (has_range && (!result.serve_path.empty() || !result.batch_path.empty()))
     {
+        return R_ParseError::RangeIncompatible;
     }
 
-    ~R_OwnedChunk()
+    if (result.to_ns <= result.from_ns)
     {
-        Free();
+        return R_ParseError::TimeRangeEmpty;
     }
 
-    // Non-copyable
-    R_OwnedChunk(const R_OwnedChunk&)            = delete;
-    R_OwnedChunk& operator=(const R_OwnedChunk&) = delete;
-
-    // Moveable
-    R_OwnedChunk(R_OwnedChunk&& rhs)
+    if (!result.checkpoint_directory.empty() && !result.nvram_filename.empty())
     {
-        m_chunk = rhs.Unmanage();
+        return R_ParseError::CheckpointIncompatible;
     }
 
-    R_OwnedChunk& operator=(R_OwnedChunk&& rhs)
+    const bool all_wav = std::ranges::all_of(result.outputs, [](const R_OutputSpec& spec) {
+        return spec.container == R_OutputContainer::Wav;
+    });
+    if (result.emidi_loop &&
+        (has_range || result.output_stdout || !all_wav ||
+         !result.serve_path.empty() || !result.batch_path.empty()))
     {
-        Free();
-        m_chunk = rhs.Unmanage();
-        return *this;
+        return R_ParseError::EMIDILoopIncompatible;
     }
 
-    void Free()
+    if (result.normalize_lufs && (result.output_stdout || result.stems || !result.serve_path.empty()))
     {
-        R_FrameChunk::Free(m_chunk);
-        m_chunk = R_FrameChunk();
+        return R_ParseError::NormalizeIncompatible;
     }
 
-    void Manage(R_FrameChunk rhs)
+    if (result.progress_json && (!result.serve_path.empty() || !result.batch_path.empty()))
     {
-        Free();
-        m_chunk = rhs;
+        return R_ParseError::ProgressJsonIncompatible;
     }
 
-    [[nodiscard]]
-    R_FrameChunk Unmanage()
+    if (result.instances > R_MAX_CHANNEL_INSTANCES && result.routing != R_RoutingMode::Voice)
     {
-        R_FrameChunk ptr = m_chunk;
-        m_chunk          = R_FrameChunk();
-        return ptr;
+        return R_ParseError::InstancesRequireVoiceRouting;
     }
 
-    void Write(const void* src, size_t src_len)
+    if (result.stems && result.output_filename.size() == 0)
     {
-        m_chunk.Write(src, src_len);
+        return R_ParseError::StemsRequiresOutput;
     }
 
-    [[nodiscard]]
-    bool IsBufferFull() const
+    if (result.output_container == R_OutputContainer::Flac && result.output_stdout)
     {
-        return m_chunk.IsBufferFull();
+        return R_ParseError::FlacRequiresOutput;
     }
 
-    [[nodiscard]]
-    void* DataFirst()
-    {
-        return m_chunk.DataFirst();
-    }
+    return R_ParseError::Success;
+}
 
-    [[nodiscard]]
-    void* DataLast()
-    {
-        return m_chunk.DataLast();
-    }
+void R_Usage()
+{
+    constexpr const char* USAGE_STR = R"(Renders a standard MIDI file to a WAVE file using nuked-sc55.
 
-    [[nodiscard]]
-    bool IsNull() const
-    {
-        return m_chunk.IsNull();
-    }
+Usage: %s [options] -o <output> <input>
+       %s [options] --batch <list or directory> [--output-dir <dir>]
+       %s [options] --serve <socket>
 
-    [[nodiscard]]
-    size_t GetBufferLength() const
-    {
-        return m_chunk.GetBufferLength();
-    }
+General options:
+  -? -h, --help                Display this information.
+  -v, --version                Display version information.
+  -o [settings:]<filename>     Render WAVE file to filename. Can be repeated to write several files
+                               from one render. Settings are an optional format and/or gain for
+                               this file only, e.g. -o f32,-3db:master.wav. The gain needs a db
+                               suffix or must be written as gain=<amount>.
+  --stdout                     Render raw sample data to stdout. No header
+  --progress-json              Report progress as JSON lines on stderr.
 
-private:
-    R_FrameChunk m_chunk;
-};
+Batch options:
+  --batch <path>               Render every MIDI file in a directory, or every file listed (one per
+                               line) in a text file. Roms are loaded and emulators booted only once.
+  --output-dir <dir>           Write batch outputs to <dir> instead of next to each input.
+  -j, --jobs <count>           Number of files to render at once. Default: cores / instances
 
-// Threadsafe queue for chunks of audio. The intent is that emulators should be able to expand the queue as fast as
-// possible while it may drain at a different rate. Contention is kept low by creating chunks of data and enqueuing or
-// dequeuing chunks at a time. For a buffer size of ~64k, expect each thread to take a lock once per second.
-class R_ChunkQueue
-{
-public:
-    R_ChunkQueue() = default;
+Server options:
+  --serve <socket>             Render MIDI files sent over a unix domain socket. See the docs for
+                               the protocol. Use -j to limit how many render at once.
 
-    void Enqueue(R_OwnedChunk chunk)
-    {
-        std::scoped_lock lk(m_mutex);
-
-        R_FrameChunk raw = chunk.Unmanage();
-        if (!m_last.IsNull())
-        {
-            m_last.SetNext(raw);
-            m_last = raw;
-        }
-        else
-        {
-            m_first = raw;
-            m_last  = raw;
-        }
-        ++m_count;
-    }
-
-    void Dequeue(R_OwnedChunk& chunk)
-    {
-        std::scoped_lock lk(m_mutex);
-
-        if (!m_first.IsNull())
-        {
-            chunk.Manage(m_first);
-            m_first = m_first.GetNext();
-            if (m_first.IsNull())
-            {
-                m_last = m_first;
-            }
-        }
-        else
-        {
-            R_Panic("empty queue");
-        }
-        --m_count;
-    }
-
-    size_t ChunkCount() const
-    {
-        return m_count;
-    }
-
-private:
-    std::mutex          m_mutex;
-    R_FrameChunk        m_first;
-    R_FrameChunk        m_last;
-    std::atomic<size_t> m_count = 0;
-};
-
-class R_Mixer
-{
-public:
-    // Blocks the calling thread until there's enough data in queues to mix.
-    void WaitForWork()
-    {
-        std::unique_lock lk(m_mutex);
-        m_cond.wait(lk, [this]() { return GetReadyChunkCount() > 0; });
-    }
-
-    // Returns chunk size in frame count.
-    size_t GetChunkSize() const
-    {
-        return m_chunk_size;
-    }
-
-    size_t GetFramesWritten(size_t queue_id) const
-    {
-        return m_frames_written[queue_id];
-    }
-
-    // Sets number of queues and prepares a chunk builder for each.
-    // precondition: 0 <= count <= QUEUE_COUNT
-    template <typename T>
-    void SetQueueCount(size_t count)
-    {
-        m_queues_in_use = count;
-        for (size_t i = 0; i < count; ++i)
-        {
-            m_chunks[i] = AllocChunk<T>();
-        }
-    }
-
-    // Writes a frame to the chunk currently being built for queue_id. If the chunk becomes full, it is moved into its
-    // queue and a new chunk becomes available.
-    template <typename T>
-    void SubmitFrame(size_t queue_id, const AudioFrame<T>& frame)
-    {
-        m_chunks[queue_id].Write(&frame, sizeof(frame));
-        if (m_chunks[queue_id].IsBufferFull())
-        {
-            m_queues[queue_id].Enqueue(std::move(m_chunks[queue_id]));
-            m_cond.notify_one();
-            m_chunks[queue_id] = AllocChunk<T>();
-        }
-        ++m_frames_written[queue_id];
-    }
-
-    // Enqueues whatever data is left in the chunk builder for queue_id and marks it as complete. After this call, no
-    // more data may be submitted to queue_id.
-    void MarkComplete(size_t queue_id)
-    {
-        m_queue_complete[queue_id] = true;
-        m_queues[queue_id].Enqueue(std::move(m_chunks[queue_id]));
-        m_cond.notify_one();
-    }
-
-    // Returns the number N of chunks that can be dequeued from each queue to call MixFrames N times.
-    size_t GetReadyChunkCount()
-    {
-        size_t count = (size_t)-1;
-        for (size_t i = 0; i < m_queues_in_use; ++i)
-        {
-            // It seems possible to end up in a rare state where e.g. at the end of the midi we have two queues marked
-            // as complete but only one has data. Normally this shouldn't happen because the emulators should be stepped
-            // for roughly the same amount of time and produce roughly the same number of samples. I have not
-            // encountered this problem yet, but multi instance rendering tends to desync slightly. On some midi files,
-            // one emulator steps for longer than the other despite the two sharing end-of-track messages with the same
-            // SMF tick timestamp. I can only guess this is caused by the integer division converting SMF ticks to
-            // microseconds. Until I can find a good test midi or construct one I'm not sure how to solve this, or if
-            // it's even a real problem. However, I have observed 400us/28 frame differences.
-            //
-            // To try to deal with this, we do not consider queues marked as complete and having zero chunks, as they
-            // will never receive new data. However, if another queue is incomplete and has zero chunks, the emulator
-            // responsible for filling that queue will enqueue one eventually. In that case, MixFrames should still mix
-            // samples from that queue without waiting for the complete queue.
-
-            size_t cc = m_queues[i].ChunkCount();
-            if (!(m_queue_complete[i] && cc == 0))
-            {
-                count = Min(count, cc);
-            }
-        }
-        return count;
-    }
-
-    // Dequeues a chunk from each queue and mixes the corresponding audio frames from each chunk into a single buffer.
-    // precondition: GetReadyChunkCount() > 0
-    template <typename T, typename MixFn>
-    size_t MixFrames(std::vector<AudioFrame<T>>& output_buffer, MixFn mix)
-    {
-        output_buffer.clear();
-
-        R_OwnedChunk chunks[QUEUE_COUNT];
-
-        // precalcluate the output buffer size so that we don't need to bounds check or reallocate in the mix loop
-        size_t size_requested = 0;
-
-        for (size_t queue_id = 0; queue_id < m_queues_in_use; ++queue_id)
-        {
-            size_t cc = m_queues[queue_id].ChunkCount();
-            if (m_queue_complete[queue_id] && cc == 0)
-            {
-                // See comment in GetReadyChunkCount.
-                continue;
-            }
-            m_queues[queue_id].Dequeue(chunks[queue_id]);
-            size_requested = std::max(size_requested, chunks[queue_id].GetBufferLength());
-        }
-
-        output_buffer.resize(size_requested / sizeof(AudioFrame<T>));
-        for (size_t queue_id = 0; queue_id < m_queues_in_use; ++queue_id)
-        {
-            if (chunks[queue_id].IsNull())
-            {
-                // Attempt to deal with errors from the prior loop
-                continue;
-            }
-            mix(output_buffer.data(), chunks[queue_id].DataFirst(), chunks[queue_id].DataLast());
-        }
-
-        return size_requested / sizeof(AudioFrame<T>);
-    }
-
-    // Returns true when all queues are marked as complete and are empty.
-    bool IsFinished() const
-    {
-        for (size_t i = 0; i < m_queues_in_use; ++i)
-        {
-            if (!m_queue_complete[i] || m_queues[i].ChunkCount() != 0)
-            {
-                return false;
-            }
-        }
-
-        return true;
-    }
-
-private:
-    template <typename T>
-    R_OwnedChunk AllocChunk()
-    {
-        R_FrameChunk raw = R_FrameChunk::Alloc(m_chunk_size * sizeof(AudioFrame<T>));
-        return R_OwnedChunk(raw);
-    }
-
-    void DebugPrintQueues()
-    {
-        for (size_t i = 0; i < m_queues_in_use; ++i)
-        {
-            fprintf(stderr, "Queue %zu has %zu chunks\n", i, m_queues[i].ChunkCount());
-        }
-    }
-
-private:
-    // a bit less than 1 second of audio
-    static constexpr size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
-    // one queue per emulator
-    static constexpr size_t QUEUE_COUNT = 16;
-
-    R_ChunkQueue m_queues[QUEUE_COUNT];
-    R_OwnedChunk m_chunks[QUEUE_COUNT];
-    bool         m_queue_complete[QUEUE_COUNT]{};
-    size_t       m_frames_written[QUEUE_COUNT]{};
-
-    size_t m_queues_in_use = 0;
-
-    // Size of chunks in bytes.
-    size_t m_chunk_size = DEFAULT_CHUNK_SIZE;
-
-    // Synchronization between producers/consumer.
-    std::mutex              m_mutex;
-    std::condition_variable m_cond;
-};
-
-enum R_LoopPointType
-{
-    TrackStart,
-    TrackEnd,
-    GlobalStart,
-    GlobalEnd,
-};
-
-struct R_LoopPoint
-{
-    R_LoopPointType type;
-    uint64_t        frame;
-    uint64_t        timestamp_ns;
-    uint16_t        midi_track;
-    uint8_t         midi_channel;
-};
-
-class R_LoopPointRecorder
-{
-public:
-    void Record(const R_LoopPoint& point)
-    {
-        std::scoped_lock lk(m_mutex);
-        m_loop_points.emplace_back(point);
-    }
-
-    void SortByTrack()
-    {
-        std::stable_sort(m_loop_points.begin(), m_loop_points.end(), [](const auto& a, const auto& b) {
-            return a.midi_track < b.midi_track;
-        });
-    }
-
-    std::span<const R_LoopPoint> GetLoopPoints() const
-    {
-        return m_loop_points;
-    }
-
-private:
-    std::mutex                    m_mutex;
-    std::vector<R_LoopPoint> m_loop_points;
-};
-
-struct R_TrackRenderState
-{
-    Emulator emu;
-    R_Mixer* mixer = nullptr;
-    size_t queue_id = 0;
-    size_t ns_simulated = 0;
-    const SMF_Track* track = nullptr;
-    std::thread thread;
-    std::chrono::high_resolution_clock::duration elapsed;
-    size_t num_silent_frames = 0;
-    R_EndBehavior end_behavior;
-    R_LoopPointRecorder* loop_recorder;
-    AudioFormat output_format;
-    float gain = 1.0f;
-
-    // these fields are accessed from main thread during render process
-    std::atomic<size_t> events_processed = 0;
-    std::atomic<bool> done;
-};
-
-struct R_SilenceModelNone
-{
-    static constexpr bool IsSilence(const AudioFrame<int32_t>& in_raw)
-    {
-        (void)in_raw;
-        return false;
-    }
-};
-
-struct R_SilenceModelGeneric
-{
-    static constexpr bool IsSilence(const AudioFrame<int32_t>& in_raw)
-    {
-        // The emulator doesn't produce exact zeroes when no notes are playing.
-        constexpr int32_t MIN = -0x4000;
-        constexpr int32_t MAX = +0x4000;
-        return MIN <= in_raw.left && in_raw.left <= MAX && MIN <= in_raw.right && in_raw.right <= MAX;
-    }
-};
-
-struct R_SilenceModelMK1
-{
-    static constexpr bool IsSilence(const AudioFrame<int32_t>& in_raw)
-    {
-        constexpr int32_t DC_OFFSET = 0x1000000;
-        constexpr int32_t MIN       = DC_OFFSET - 0x10000;
-        constexpr int32_t MAX       = DC_OFFSET + 0x10000;
-        return MIN <= in_raw.left && in_raw.left <= MAX && MIN <= in_raw.right && in_raw.right <= MAX;
-    }
-};
-
-template <typename SampleT, typename SilenceModel, bool ApplyGain>
-void R_ReceiveSample(void* userdata, const AudioFrame<int32_t>& in)
-{
-    R_TrackRenderState* state = (R_TrackRenderState*)userdata;
-
-    AudioFrame<SampleT> out;
-    Normalize(in, out);
-
-    // Skip silence processing until end of track
-    if constexpr (!std::is_same_v<SilenceModel, R_SilenceModelNone>)
-    {
-        if (SilenceModel::IsSilence(in))
-        {
-            ++state->num_silent_frames;
-        }
-        else
-        {
-            state->num_silent_frames = 0;
-        }
-    }
-
-    if constexpr (ApplyGain)
-    {
-        Scale(out, state->gain);
-    }
-
-    state->mixer->SubmitFrame(state->queue_id, out);
-}
-
-void R_RunReset(Emulator& emu, EMU_SystemReset reset)
-{
-    emu.PostSystemReset(reset);
-
-    for (size_t i = 0; i < 24'000'000; ++i)
-    {
-        emu.Step();
-    }
-}
-
-void R_PostEvent(Emulator& emu, const SMF_Data& data, const SMF_Event& ev)
-{
-    emu.PostMIDI(ev.status);
-    emu.PostMIDI(ev.GetData(data.bytes));
-}
-
-struct R_TrackList
-{
-    std::vector<SMF_Track> tracks;
-};
-
-// Splits a track into `n` tracks, each track can be processed by a single
-// emulator instance.
-R_TrackList R_SplitTrackModulo(const SMF_Track& merged_track, size_t n)
-{
-    R_TrackList result;
-    result.tracks.resize(n);
-
-    for (auto& event : merged_track.events)
-    {
-        // System events need to be processed by all emulators
-        if (event.IsSystem())
-        {
-            for (auto& dest : result.tracks)
-            {
-                dest.events.emplace_back(event);
-            }
-        }
-        else
-        {
-            auto& dest = result.tracks[event.GetChannel() % n];
-            dest.events.emplace_back(event);
-        }
-    }
-
-    for (auto& track : result.tracks)
-    {
-        SMF_SetDeltasFromTimestamps(track);
-    }
-
-    return result;
-}
-
-uint64_t R_NSPerStep(Emulator& emu)
-{
-    // These are best guesses.
-    if (emu.GetMCU().is_mk1 || emu.GetMCU().is_jv880)
-    {
-        return 600;
-    }
-    else
-    {
-        return 500;
-    }
-}
-
-void R_NsToTimeString(uint64_t ns, std::string& result)
-{
-    // one second in nanoseconds
-    constexpr uint64_t ONE_SEC = 1'000'000'000;
-
-    const uint64_t min  = ns / (60 * ONE_SEC);
-    const uint64_t sec  = (ns / ONE_SEC) % 60;
-    const uint64_t fsec = (uint64_t)(100.0 * ((double)(ns % ONE_SEC) / (double)ONE_SEC));
-
-    result.clear();
-    if (min < 10)
-    {
-        result += '0';
-    }
-    result += std::to_string(min);
-    result += ':';
-    if (sec < 10)
-    {
-        result += '0';
-    }
-    result += std::to_string(sec);
-    result += '.';
-    if (fsec < 10)
-    {
-        result += '0';
-    }
-    result += std::to_string(fsec);
-}
-
-bool R_IsEMIDITrackLoopStart(const SMF_Data& data, const SMF_Event& ev)
-{
-    return ev.IsControlChange() && ev.GetData(data.bytes)[0] == 116;
-}
-
-bool R_IsEMIDITrackLoopEnd(const SMF_Data& data, const SMF_Event& ev)
-{
-    return ev.IsControlChange() && ev.GetData(data.bytes)[0] == 117;
-}
-
-bool R_IsEMIDIGlobalLoopStart(const SMF_Data& data, const SMF_Event& ev)
-{
-    return ev.IsControlChange() && ev.GetData(data.bytes)[0] == 118;
-}
-
-bool R_IsEMIDIGlobalLoopEnd(const SMF_Data& data, const SMF_Event& ev)
-{
-    return ev.IsControlChange() && ev.GetData(data.bytes)[0] == 119;
-}
-
-template <typename SilenceModel>
-constexpr mcu_sample_callback R_PickCallback(const R_TrackRenderState& state)
-{
-    if (state.gain != 1.0f)
-    {
-        switch (state.output_format)
-        {
-        case AudioFormat::S16:
-            return R_ReceiveSample<int16_t, SilenceModel, true>;
-        case AudioFormat::S32:
-            return R_ReceiveSample<int32_t, SilenceModel, true>;
-        case AudioFormat::F32:
-            return R_ReceiveSample<float, SilenceModel, true>;
-        }
-    }
-    else
-    {
-        switch (state.output_format)
-        {
-        case AudioFormat::S16:
-            return R_ReceiveSample<int16_t, SilenceModel, false>;
-        case AudioFormat::S32:
-            return R_ReceiveSample<int32_t, SilenceModel, false>;
-        case AudioFormat::F32:
-            return R_ReceiveSample<float, SilenceModel, false>;
-        }
-    }
-
-    fprintf(stderr, "output_format = %d\n", (int)state.output_format);
-    fprintf(stderr, "gain = %f\n", state.gain);
-    R_Panic("no valid callback for state");
-}
-
-void R_HandleLoopPoint(R_TrackRenderState& state, const SMF_Data& data, const SMF_Event& event)
-{
-    // Save loop points - they will be processed on the main thread later
-    if (R_IsEMIDITrackLoopStart(data, event))
-    {
-        state.loop_recorder->Record({
-            .type         = R_LoopPointType::TrackStart,
-            .frame        = state.mixer->GetFramesWritten(state.queue_id),
-            .timestamp_ns = state.ns_simulated,
-            .midi_track   = event.track_id,
-            .midi_channel = event.GetChannel(),
-        });
-    }
-    else if (R_IsEMIDITrackLoopEnd(data, event))
-    {
-        state.loop_recorder->Record({
-            .type         = R_LoopPointType::TrackEnd,
-            .frame        = state.mixer->GetFramesWritten(state.queue_id),
-            .timestamp_ns = state.ns_simulated,
-            .midi_track   = event.track_id,
-            .midi_channel = event.GetChannel(),
-        });
-    }
-    else if (R_IsEMIDIGlobalLoopStart(data, event))
-    {
-        state.loop_recorder->Record({
-            .type         = R_LoopPointType::GlobalStart,
-            .frame        = state.mixer->GetFramesWritten(state.queue_id),
-            .timestamp_ns = state.ns_simulated,
-            .midi_track   = event.track_id,
-            .midi_channel = event.GetChannel(),
-        });
-    }
-    else if (R_IsEMIDIGlobalLoopEnd(data, event))
-    {
-        state.loop_recorder->Record({
-            .type         = R_LoopPointType::GlobalEnd,
-            .frame        = state.mixer->GetFramesWritten(state.queue_id),
-            .timestamp_ns = state.ns_simulated,
-            .midi_track   = event.track_id,
-            .midi_channel = event.GetChannel(),
-        });
-    }
-}
-
-void R_RenderOne(const SMF_Data& data, R_TrackRenderState& state)
-{
-    uint64_t division = data.header.division;
-    uint64_t us_per_qn = 500000;
-
-    const SMF_Track& track = (const SMF_Track&)*state.track;
-
-    const uint64_t ns_per_step = R_NSPerStep(state.emu);
-
-    auto t_start = std::chrono::high_resolution_clock::now();
-    for (const SMF_Event& event : track.events)
-    {
-        const uint64_t this_event_time_ns =
-            state.ns_simulated + 1000 * SMF_TicksToUS(event.delta_time, us_per_qn, division);
-
-        while (state.ns_simulated < this_event_time_ns)
-        {
-            state.emu.Step();
-            state.ns_simulated += ns_per_step;
-        }
-
-        if (event.IsTempo(data.bytes))
-        {
-            us_per_qn = event.GetTempoUS(data.bytes);
-        }
-
-        // Fire the event.
-        if (!event.IsMetaEvent())
-        {
-            R_PostEvent(state.emu, data, event);
-        }
-
-        R_HandleLoopPoint(state, data, event);
-
-        ++state.events_processed;
-    }
-
-    if (state.end_behavior == R_EndBehavior::Release)
-    {
-        // Enable silence processing callback
-        if (state.emu.GetMCU().is_mk1)
-        {
-            state.emu.SetSampleCallback(R_PickCallback<R_SilenceModelMK1>(state), &state);
-        }
-        else
-        {
-            state.emu.SetSampleCallback(R_PickCallback<R_SilenceModelGeneric>(state), &state);
-        }
-
-        const uint32_t frequency = PCM_GetOutputFrequency(state.emu.GetPCM());
-        // TODO: make this configurable? do we care? currently 100ms
-        const size_t silence_time = frequency / 10;
-        while (state.num_silent_frames < silence_time)
-        {
-            state.emu.Step();
-        }
-    }
-    state.elapsed = std::chrono::high_resolution_clock::now() - t_start;
-
-    state.mixer->MarkComplete(state.queue_id);
-
-    state.done = true;
-}
-
-void R_CursorUpLines(int n)
-{
-    fprintf(stderr, "\x1b[%dF", n);
-}
-
-struct R_MixOutState
-{
-    R_Mixer* mixer = nullptr;
-
-    // Written by mix thread, read by main thread
-    std::atomic<size_t> frames_mixed = 0;
-
-    // Eventually we need to abstract over this to stream to other outputs.
-    WAV_Handle* output = nullptr;
-};
-
-void R_Mix(int16_t* dest, int16_t* src_first, int16_t* src_last)
-{
-    // TODO more correct to clip *after* summation? we need an intermediate buffer of a larger type?
-    HorizontalSatAddI16(dest, src_first, src_last);
-}
-
-void R_Mix(int32_t* dest, int32_t* src_first, int32_t* src_last)
-{
-    HorizontalSatAddI32(dest, src_first, src_last);
-}
-
-void R_Mix(float* dest, float* src_first, float* src_last)
-{
-    HorizontalAddF32(dest, src_first, src_last);
-}
-
-template <typename T>
-void R_MixOut(R_MixOutState& state)
-{
-    std::vector<AudioFrame<T>> mix_buffer;
-    mix_buffer.reserve(state.mixer->GetChunkSize());
-
-    while (!state.mixer->IsFinished())
-    {
-        state.mixer->WaitForWork();
-
-        state.frames_mixed += state.mixer->MixFrames(mix_buffer, [](void* dest, void* src_first, void* src_last) {
-            R_Mix((T*)dest, (T*)src_first, (T*)src_last);
-        });
-
-        for (auto& frame : mix_buffer)
-        {
-            state.output->Write(frame);
-        }
-    }
-
-    state.output->Finish();
-}
-
-bool R_RenderTrack(const SMF_Data& data, const R_Parameters& params)
-{
-    const size_t instances = params.instances;
-    auto t_start = std::chrono::high_resolution_clock::now();
-
-    // First combine all of the events so it's easier to process
-    const SMF_Track merged_track = SMF_MergeTracks(data);
-    // Then create a track specifically for each emulator instance
-    const R_TrackList split_tracks = R_SplitTrackModulo(merged_track, instances);
-
-    AllRomsetInfo romset_info;
-
-    common::LoadRomsetResult load_result;
-
-    common::LoadRomsetError err = common::LoadRomset(romset_info,
-                                                     params.rom_directory,
-                                                     params.romset_name,
-                                                     params.legacy_romset_detection,
-                                                     params.adv.rom_overrides,
-                                                     load_result);
-
-    common::PrintLoadRomsetDiagnostics(stderr, err, load_result, romset_info);
-
-    if (err != common::LoadRomsetError{})
-    {
-        return false;
-    }
-
-    EMU_SystemReset reset = EMU_SystemReset::NONE;
-    if (params.reset)
-    {
-        reset = *params.reset;
-    }
-    else if (!params.reset && load_result.romset == Romset::MK2)
-    {
-        // user didn't explicitly pass a reset and we're using a buggy romset
-        fprintf(stderr, "WARNING: No reset specified with mk2 romset; using gs\n");
-        reset = EMU_SystemReset::GS_RESET;
-    }
-
-    fprintf(stderr, "Gain set to %.2fdb\n", common::ScalarToDb(params.gain));
-
-    R_Mixer mixer;
-    switch (params.output_format)
-    {
-    case AudioFormat::S16:
-        mixer.SetQueueCount<int16_t>(instances);
-        break;
-    case AudioFormat::S32:
-        mixer.SetQueueCount<int32_t>(instances);
-        break;
-    case AudioFormat::F32:
-        mixer.SetQueueCount<float>(instances);
-        break;
-    }
-
-    R_LoopPointRecorder loop_recorder;
-
-    R_TrackRenderState render_states[SMF_CHANNEL_COUNT];
-    for (size_t i = 0; i < instances; ++i)
-    {
-        std::filesystem::path this_nvram = params.nvram_filename;
-        if (!this_nvram.empty())
-        {
-            // append instance number so that multiple instances don't clobber each other's nvram
-            this_nvram += std::to_string(i);
-        }
-
-        render_states[i].emu.Init({.lcd_backend = nullptr, .nvram_filename = this_nvram});
-
-        RomLocationSet loaded{};
-        if (!render_states[i].emu.LoadRoms(load_result.romset, romset_info, &loaded))
-        {
-            fprintf(stderr, "FATAL: Failed to load roms for instance #%02zu\n", i);
-            return false;
-        }
-
-        render_states[i].emu.Reset();
-        render_states[i].emu.GetPCM().enable_oversampling = !params.disable_oversampling;
-
-        fprintf(stderr, "Initializing emulator #%02zu...\n", i);
-        R_RunReset(render_states[i].emu, reset);
-
-        render_states[i].track = &split_tracks.tracks[i];
-        render_states[i].mixer = &mixer;
-        render_states[i].queue_id = i;
-        render_states[i].end_behavior = params.end_behavior;
-        render_states[i].loop_recorder = &loop_recorder;
-        render_states[i].output_format = params.output_format;
-        render_states[i].gain = params.gain;
-
-        render_states[i].emu.SetSampleCallback(R_PickCallback<R_SilenceModelNone>(render_states[i]), &render_states[i]);
-
-        render_states[i].thread = std::thread(R_RenderOne, std::cref(data), std::ref(render_states[i]));
-    }
-
-    romset_info.PurgeRomData();
-
-    WAV_Handle render_output;
-    if (params.output_stdout)
-    {
-#ifdef _WIN32
-        // On Windows, stdout is opened in text mode, which causes newline translation to occur.
-        _setmode(_fileno(stdout), O_BINARY);
-#endif
-        render_output.OpenStdout(params.output_format);
-    }
-    else
-    {
-        render_output.Open(params.output_filename, params.output_format);
-    }
-    render_output.SetSampleRate(PCM_GetOutputFrequency(render_states[0].emu.GetPCM()));
-
-    R_MixOutState mix_out_state;
-    mix_out_state.mixer = &mixer;
-    mix_out_state.output = &render_output;
-    std::thread mix_out_thread;
-
-    switch (params.output_format)
-    {
-    case AudioFormat::S16:
-        mix_out_thread = std::thread(R_MixOut<int16_t>, std::ref(mix_out_state));
-        break;
-    case AudioFormat::S32:
-        mix_out_thread = std::thread(R_MixOut<int32_t>, std::ref(mix_out_state));
-        break;
-    case AudioFormat::F32:
-        mix_out_thread = std::thread(R_MixOut<float>, std::ref(mix_out_state));
-        break;
-    }
-
-    // Now we wait.
-    bool all_done = false;
-    while (!all_done)
-    {
-        all_done = true;
-
-        fprintf(stderr, "Rendered %zu frames\n", mix_out_state.frames_mixed.load());
-
-        for (size_t i = 0; i < instances; ++i)
-        {
-            if (!render_states[i].done)
-            {
-                all_done = false;
-            }
-
-            const size_t processed    = render_states[i].events_processed;
-            const size_t total        = render_states[i].track->events.size();
-            const float  percent_done = 100.f * (float)processed / (float)total;
-
-            fprintf(stderr, "#%02zu %6.2f%% [%zu / %zu]\n", i, percent_done, processed, total);
-        }
-
-        if (!all_done)
-        {
-            R_CursorUpLines(RangeCast<int>(1 + instances));
-        }
-
-        std::this_thread::sleep_for(1000ms);
-    }
-
-    for (size_t i = 0; i < instances; ++i)
-    {
-        render_states[i].thread.join();
-    }
-
-    mix_out_thread.join();
-
-    if (params.dump_emidi_loop_points)
-    {
-        loop_recorder.SortByTrack();
-
-        const uint32_t frequency = PCM_GetOutputFrequency(render_states[0].emu.GetPCM());
-        fprintf(stderr, "rate=%zu\n", (size_t)frequency);
-
-        std::string time_str;
-        for (const auto& point : loop_recorder.GetLoopPoints())
-        {
-            R_NsToTimeString(point.timestamp_ns, time_str);
-            switch (point.type)
-            {
-            case R_LoopPointType::TrackStart:
-                fprintf(stderr,
-                        "track %d loop start at sample=%" PRIu64 " timestamp=%s\n",
-                        point.midi_track,
-                        point.frame,
-                        time_str.c_str());
-                break;
-            case R_LoopPointType::TrackEnd:
-                fprintf(stderr,
-                        "track %d loop end at sample=%" PRIu64 " timestamp=%s\n",
-                        point.midi_track,
-                        point.frame,
-                        time_str.c_str());
-                break;
-            case R_LoopPointType::GlobalStart:
-                fprintf(
-                    stderr, "global loop start at sample=%" PRIu64 " timestamp=%s\n", point.frame, time_str.c_str());
-                break;
-            case R_LoopPointType::GlobalEnd:
-                fprintf(stderr, "global loop end at sample=%" PRIu64 " timestamp=%s\n", point.frame, time_str.c_str());
-                break;
-            }
-        }
-    }
-
-    if (params.debug)
-    {
-        for (size_t i = 0; i < instances; ++i)
-        {
-            auto t_instance_sec = (double)render_states[i].elapsed.count() / 1e9;
-            fprintf(stderr, "#%02zu took %.2fs\n", i, t_instance_sec);
-        }
-    }
-
-    auto t_finish = std::chrono::high_resolution_clock::now();
-    auto t_diff   = std::chrono::duration_cast<std::chrono::nanoseconds>(t_finish - t_start);
-    auto t_sec    = (double)t_diff.count() / 1e9;
-
-    fprintf(stderr, "Done in %.2fs!\n", t_sec);
-
-    return true;
-}
-
-void R_Usage()
-{
-    constexpr const char* USAGE_STR = R"(Renders a standard MIDI file to a WAVE file using nuked-sc55.
-
-Usage: %s [options] -o <output> <input>
-
-General options:
-  -? -h, --help                Display this information.
-  -v, --version                Display version information.
-  -o <filename>                Render WAVE file to filename.
-  --stdout                     Render raw sample data to stdout. No header
-
-Audio options:
-  -f, --format s16|s32|f32     Set output format.
-  --disable-oversampling       Halves output frequency.
-  --gain <amount>              Apply gain to the output.
-  --end cut|release            Choose how the end of the track is handled:
-        cut (default)              Stop rendering at the last MIDI event
-        release                    Continue to render audio after the last MIDI event until silence
+Audio options:
+  -f, --format <format>        Set output format:
+        s16 (default)              Signed 16-bit WAVE
+        s32                        Signed 32-bit WAVE
+        f32                        32-bit floating-point WAVE
+        flac                       16-bit FLAC
+        flac24                     24-bit FLAC
+  --disable-oversampling       Halves output frequency.
+  --rate <freq>                Convert the output to sample rate <freq>, e.g. 44100 or 48000.
+  --idle-bypass                Skip sound processing while the emulator is silent. Renders long
+                               silences much faster, but output is not bit-exact.
+  --gain <amount>              Apply gain to the output.
+  --normalize-lufs <target>    Scale the output to an integrated loudness of <target> LUFS,
+                               e.g. -14. Measured while rendering; outputs are written at the end.
+  --end cut|release            Choose how the end of the track is handled:
+        cut (default)              Stop rendering at the last MIDI event
+        release                    Continue to render audio after the last MIDI event until silence
+  --from <time>                Only output audio after <time>, written as [[h:]m:]s, e.g. 2:30.
+  --to <time>                  Stop rendering at <time>.
+  --checkpoint-dir <dir>       Cache emulator snapshots in <dir> so later renders of the same song
+                               can start close to --from instead of at the beginning.
+  --checkpoint-interval <sec>  Seconds of song between cached snapshots. Default: 10
 
 Emulator options:
   -r, --reset     none|gs|gm   Send GS or GM reset before rendering.
   -n, --instances <count>      Number of emulators to use (increases effective polyphony, but
                                takes longer to render)
+  --routing <mode>             Choose how MIDI events are assigned to instances:
+        modulo (default)           Channel N is played by instance N mod <count>
+        balanced                   Spread channels so each instance plays as few notes at once as possible
+        voice                      Play each note on the least busy instance. Allows up to 64 instances
   --nvram <filename>           Saves and loads NVRAM to/from disk. JV-880 only.
+  --max-queued-chunks <count>  Maximum number of audio chunks (16384 frames each) an emulator may
+                               render ahead of the output before it waits. Default: 256
 
 ROM management options:
   -d, --rom-directory <dir>    Sets the directory to load roms from. Romset will be autodetected when
@@ -1518,11 +824,16 @@ ROM management options:
 
 MIDI options:
   --dump-emidi-loop-points     Prints any encountered EMIDI loop points to stderr when finished.
+  --emidi-loop                 Render up to the end of the EMIDI loop so that the loop repeats
+                               seamlessly, carrying the sound ringing at the loop end into the loop
+                               start. The loop is stored in the WAVE file's smpl chunk.
+  --stems                      Render each MIDI channel on its own emulator and write one WAVE file
+                               per channel next to the mixed output. Overrides --instances.
 
 )";
 
     std::string name = common::GetProcessPath().stem().generic_string();
-    fprintf(stderr, USAGE_STR, name.c_str());
+    fprintf(stderr, USAGE_STR, name.c_str(), name.c_str(), name.c_str());
 
     common::PrintRomsets(stderr);
 }
@@ -1554,9 +865,26 @@ int main(int argc, char* argv[])
         return 0;
     }
 
+#ifndef _WIN32
+    if (!params.serve_path.empty())
+    {
+        return R_Serve(params) ? 0 : 1;
+    }
+#endif
+
+    if (!params.batch_path.empty())
+    {
+        return R_RenderBatch(params) ? 0 : 1;
+    }
+
     SMF_Data data;
     data = SMF_LoadEvents(params.input_filename);
 
+    if (params.debug)
+    {
+        SMF_PrintStats(data);
+    }
+
     if (!R_RenderTrack(data, params))
     {
         fprintf(stderr, "Failed to render track\n");
@@ -0,0 +1,283 @@
+#include "output.h"
+#include "math_util.h"
+#include "panic.h"
+#include <cmath>
+#include <limits>
+#include <type_traits>
+
+void R_OutputFile::OpenStdout(AudioFormat format)
+{
+    m_wav.OpenStdout(format);
+}
+
+void R_OutputFile::OpenStream(FILE* output, AudioFormat format, bool wav_header)
+{
+    m_wav.OpenStream(output, format, wav_header);
+}
+
+bool R_OutputFile::Open(const std::filesystem::path& path,
+                        AudioFormat                  format,
+                        R_OutputContainer            container,
+                        uint32_t                     flac_bits_per_sample)
+{
+    switch (container)
+    {
+    case R_OutputContainer::Wav:
+        return m_wav.Open(path, format);
+    case R_OutputContainer::Flac:
+        m_flac = std::make_unique<FLAC_Handle>();
+        return m_flac->Open(path, flac_bits_per_sample);
+    }
+    return false;
+}
+
+void R_OutputFile::SetSampleRate(uint32_t sample_rate)
+{
+    if (m_flac)
+    {
+        m_flac->SetSampleRate(sample_rate);
+    }
+    else
+    {
+        m_wav.SetSampleRate(sample_rate);
+    }
+}
+
+template <typename T>
+void R_OutputFile::Write(std::span<const AudioFrame<T>> frames)
+{
+    if (m_flac)
+    {
+        if constexpr (std::is_same_v<T, float>)
+        {
+            R_Panic("FLAC output does not accept float samples");
+        }
+        else
+        {
+            m_flac->Write(frames);
+        }
+    }
+    else
+    {
+        m_wav.Write(frames);
+    }
+}
+
+template void R_OutputFile::Write(std::span<const AudioFrame<int16_t>> frames);
+template void R_OutputFile::Write(std::span<const AudioFrame<int32_t>> frames);
+template void R_OutputFile::Write(std::span<const AudioFrame<float>> frames);
+
+void R_OutputFile::SetLoop(uint64_t start, uint64_t end)
+{
+    if (m_flac)
+    {
+        R_Panic("FLAC output does not support loops");
+    }
+    m_wav.SetLoop(start, end);
+}
+
+void R_OutputFile::Finish()
+{
+    if (m_flac)
+    {
+        m_flac->Finish();
+    }
+    else
+    {
+        m_wav.Finish();
+    }
+}
+
+// Converts the contents of `scratch.output` back to T and writes it to `output`.
+template <typename T>
+static void R_WriteResampled(R_OutputFile& output, R_ResampleScratch<T>& scratch)
+{
+    scratch.converted.resize(scratch.output.size());
+    for (size_t i = 0; i < scratch.output.size(); ++i)
+    {
+        scratch.converted[i] = common::FromResamplerFrame<T>(scratch.output[i]);
+    }
+    output.Write(std::span<const AudioFrame<T>>(scratch.converted));
+}
+
+template <typename T>
+void R_WriteFrames(R_OutputFile&         output,
+                   common::Resampler*    resampler,
+                   R_ResampleScratch<T>& scratch,
+                   const AudioFrame<T>*  first,
+                   const AudioFrame<T>*  last)
+{
+    if (!resampler)
+    {
+        output.Write(std::span<const AudioFrame<T>>(first, last));
+        return;
+    }
+
+    scratch.input.clear();
+    for (; first != last; ++first)
+    {
+        scratch.input.push_back(common::ToResamplerFrame(*first));
+    }
+
+    scratch.output.clear();
+    resampler->Process(scratch.input, scratch.output);
+    R_WriteResampled(output, scratch);
+}
+
+template <typename T>
+void R_FinishOutput(R_OutputFile&         output,
+                    common::Resampler*    resampler,
+                    R_ResampleScratch<T>& scratch,
+                    const R_LoopFrames*   loop)
+{
+    if (resampler)
+    {
+        scratch.output.clear();
+        resampler->Finish(scratch.output);
+        R_WriteResampled(output, scratch);
+    }
+
+    if (loop)
+    {
+        R_LoopFrames converted = *loop;
+        if (resampler)
+        {
+            converted.start = resampler->ConvertFramePosition(converted.start);
+            converted.end   = resampler->ConvertFramePosition(converted.end);
+        }
+        if (converted.start < converted.end)
+        {
+            output.SetLoop(converted.start, converted.end);
+        }
+    }
+
+    output.Finish();
+}
+
+template void R_WriteFrames(R_OutputFile&, common::Resampler*, R_ResampleScratch<int16_t>&, const AudioFrame<int16_t>*,
+                            const AudioFrame<int16_t>*);
+template void R_WriteFrames(R_OutputFile&, common::Resampler*, R_ResampleScratch<int32_t>&, const AudioFrame<int32_t>*,
+                            const AudioFrame<int32_t>*);
+template void R_WriteFrames(R_OutputFile&, common::Resampler*, R_ResampleScratch<float>&, const AudioFrame<float>*,
+                            const AudioFrame<float>*);
+
+template void R_FinishOutput(R_OutputFile&, common::Resampler*, R_ResampleScratch<int16_t>&, const R_LoopFrames*);
+template void R_FinishOutput(R_OutputFile&, common::Resampler*, R_ResampleScratch<int32_t>&, const R_LoopFrames*);
+template void R_FinishOutput(R_OutputFile&, common::Resampler*, R_ResampleScratch<float>&, const R_LoopFrames*);
+
+// Applies `gain` to a block of the mix and converts it to T, clipping only once at the end.
+template <typename T, typename MixT>
+static void R_ConvertMix(const std::vector<AudioFrame<MixT>>& mix, float gain, std::vector<AudioFrame<T>>& output)
+{
+    // Same scale as Normalize: S16 is S32 >> 16 and F32 is S32 / 2^30.
+    double scale = 1.0;
+    if constexpr (std::is_same_v<MixT, float>)
+    {
+        scale = 1073741824.0;
+    }
+    if constexpr (std::is_same_v<T, int16_t>)
+    {
+        scale /= 65536.0;
+    }
+    else if constexpr (std::is_same_v<T, float>)
+    {
+        scale /= 1073741824.0;
+    }
+    const double factor = scale * (double)gain;
+
+    const auto convert = [factor](MixT sample) -> T {
+        const double value = (double)sample * factor;
+        if constexpr (std::is_same_v<T, float>)
+        {
+            return (float)value;
+        }
+        else
+        {
+            return (T)Clamp<double>(std::floor(value), std::numeric_limits<T>::min(), std::numeric_limits<T>::max());
+        }
+    };
+
+    output.resize(mix.size());
+    for (size_t i = 0; i < mix.size(); ++i)
+    {
+        output[i] = {convert(mix[i].left), convert(mix[i].right)};
+    }
+}
+
+template <typename MixT>
+void R_FanOutWriter<MixT>::Start(R_OutputFile&       output,
+                                 AudioFormat         format,
+                                 float               gain,
+                                 common::Resampler*  resampler,
+                                 const R_LoopFrames* loop)
+{
+    m_output    = &output;
+    m_gain      = gain;
+    m_resampler = resampler;
+    m_loop      = loop;
+
+    switch (format)
+    {
+    case AudioFormat::S16:
+        m_thread = std::thread(&R_FanOutWriter::Run<int16_t>, this);
+        break;
+    case AudioFormat::S32:
+        m_thread = std::thread(&R_FanOutWriter::Run<int32_t>, this);
+        break;
+    case AudioFormat::F32:
+        m_thread = std::thread(&R_FanOutWriter::Run<float>, this);
+        break;
+    }
+}
+
+template <typename MixT>
+void R_FanOutWriter<MixT>::Push(R_MixBlock<MixT> block)
+{
+    std::unique_lock lock(m_mutex);
+    m_cond.wait(lock, [this] { return m_blocks.size() < MAX_QUEUED_BLOCKS; });
+    m_blocks.push_back(std::move(block));
+    m_cond.notify_all();
+}
+
+template <typename MixT>
+void R_FanOutWriter<MixT>::Finish()
+{
+    {
+        std::scoped_lock lock(m_mutex);
+        m_finished = true;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+}
+
+template <typename MixT>
+template <typename T>
+void R_FanOutWriter<MixT>::Run()
+{
+    R_ResampleScratch<T>       scratch;
+    std::vector<AudioFrame<T>> converted;
+
+    for (;;)
+    {
+        R_MixBlock<MixT> block;
+        {
+            std::unique_lock lock(m_mutex);
+            m_cond.wait(lock, [this] { return !m_blocks.empty() || m_finished; });
+            if (m_blocks.empty())
+            {
+                break;
+            }
+            block = std::move(m_blocks.front());
+            m_blocks.pop_front();
+        }
+        m_cond.notify_all();
+
+        R_ConvertMix(*block, m_gain, converted);
+        R_WriteFrames(*m_output, m_resampler, scratch, converted.data(), converted.data() + converted.size());
+    }
+
+    R_FinishOutput<T>(*m_output, m_resampler, scratch, m_loop);
+}
+
+template class R_FanOutWriter<int64_t>;
+template class R_FanOutWriter<float>;
@@ -0,0 +1,128 @@
+// Writing rendered audio to files, optionally through a resampler, and fanning
+// one mix out to several files at once.
+
+#pragma once
+
+#include "audio.h"
+#include "flac.h"
+#include "output_spec.h"
+#include "wav.h"
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "common/resampler.h"
+
+// Output frames at the EMIDI loop markers, before any sample rate conversion.
+struct R_LoopFrames
+{
+    uint64_t start = 0;
+    uint64_t end   = 0;
+};
+
+// Audio file being rendered to. Forwards to the writer for the selected container.
+class R_OutputFile
+{
+public:
+    void OpenStdout(AudioFormat format);
+
+    // Only WAVE can be streamed. If `wav_header` is set, SetSampleRate must be called first.
+    void OpenStream(FILE* output, AudioFormat format, bool wav_header);
+
+    // Returns false if the file couldn't be created.
+    bool Open(const std::filesystem::path& path,
+              AudioFormat                  format,
+              R_OutputContainer            container,
+              uint32_t                     flac_bits_per_sample);
+
+    void SetSampleRate(uint32_t sample_rate);
+
+    // Defined for int16_t, int32_t and float. FLAC output does not accept float samples.
+    template <typename T>
+    void Write(std::span<const AudioFrame<T>> frames);
+
+    // Only supported for WAVE files; see WAV_Handle::SetLoop.
+    void SetLoop(uint64_t start, uint64_t end);
+
+    void Finish();
+
+private:
+    WAV_Handle                   m_wav;
+    std::unique_ptr<FLAC_Handle> m_flac;
+};
+
+// Buffers reused by R_WriteFrames across calls.
+template <typename T>
+struct R_ResampleScratch
+{
+    std::vector<AudioFrame<float>> input;
+    std::vector<AudioFrame<float>> output;
+    std::vector<AudioFrame<T>>     converted;
+};
+
+// Writes frames to `output`, passing them through `resampler` first if it is non-null. Defined for int16_t, int32_t
+// and float.
+template <typename T>
+void R_WriteFrames(R_OutputFile&         output,
+                   common::Resampler*    resampler,
+                   R_ResampleScratch<T>& scratch,
+                   const AudioFrame<T>*  first,
+                   const AudioFrame<T>*  last);
+
+// Writes out whatever `resampler` still has buffered and finalizes `output`. If `loop` is set, the output is marked as
+// looping between those frames. Defined for int16_t, int32_t and float.
+template <typename T>
+void R_FinishOutput(R_OutputFile&         output,
+                    common::Resampler*    resampler,
+                    R_ResampleScratch<T>& scratch,
+                    const R_LoopFrames*   loop);
+
+// Block of the mix shared by every writer when rendering to multiple outputs. Frames are the unclipped sum of each
+// instance's output: S32 (as int64_t) normally, or F32 for --normalize-lufs.
+template <typename MixT>
+using R_MixBlock = std::shared_ptr<const std::vector<AudioFrame<MixT>>>;
+
+// Writes one of several outputs on its own thread, so that converting, resampling, and encoding for each output runs
+// in parallel with the others and with the mixer. Defined for int64_t and float mixes.
+template <typename MixT>
+class R_FanOutWriter
+{
+public:
+    // Starts writing blocks passed to Push to `output` as `format`, after applying `gain`. `resampler` and `loop` are
+    // as for R_FinishOutput.
+    void Start(R_OutputFile&       output,
+               AudioFormat         format,
+               float               gain,
+               common::Resampler*  resampler,
+               const R_LoopFrames* loop);
+
+    // Queues a block for writing. Blocks while the writer is too far behind.
+    void Push(R_MixBlock<MixT> block);
+
+    // Writes everything that was pushed, finalizes the output, and stops the thread.
+    void Finish();
+
+private:
+    static constexpr size_t MAX_QUEUED_BLOCKS = 16;
+
+    template <typename T>
+    void Run();
+
+    R_OutputFile*       m_output    = nullptr;
+    float               m_gain      = 1.0f;
+    common::Resampler*  m_resampler = nullptr;
+    const R_LoopFrames* m_loop      = nullptr;
+    std::thread         m_thread;
+
+    std::mutex                   m_mutex;
+    std::condition_variable      m_cond;
+    std::deque<R_MixBlock<MixT>> m_blocks;
+    bool                         m_finished = false;
+};
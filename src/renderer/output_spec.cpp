@@ -0,0 +1,90 @@
+#include "output_spec.h"
+
+#include "common/gain.h"
+
+bool R_ParseFormat(std::string_view name, AudioFormat& format, R_OutputContainer& container, uint32_t& flac_bits)
+{
+    container = R_OutputContainer::Wav;
+    if (name == "s16")
+    {
+        format = AudioFormat::S16;
+    }
+    else if (name == "s32")
+    {
+        format = AudioFormat::S32;
+    }
+    else if (name == "f32")
+    {
+        format = AudioFormat::F32;
+    }
+    else if (name == "flac")
+    {
+        format    = AudioFormat::S16;
+        container = R_OutputContainer::Flac;
+        flac_bits = 16;
+    }
+    else if (name == "flac24")
+    {
+        format    = AudioFormat::S32;
+        container = R_OutputContainer::Flac;
+        flac_bits = 24;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// Parses a gain in an output's settings. Plain numbers are rejected so that they are taken as part of the filename.
+static bool R_ParseOutputGain(std::string_view item, float& gain)
+{
+    constexpr std::string_view PREFIX = "gain=";
+    if (item.starts_with(PREFIX))
+    {
+        item.remove_prefix(PREFIX.size());
+    }
+    else if (!item.ends_with("db"))
+    {
+        return false;
+    }
+    return common::ParseGain(item, gain) == common::ParseGainResult{};
+}
+
+R_OutputSpec R_ParseOutputSpec(std::string_view arg)
+{
+    R_OutputSpec spec;
+    spec.filename = arg;
+
+    const size_t colon = arg.find(':');
+    if (colon == std::string_view::npos || colon == 0)
+    {
+        return spec;
+    }
+
+    R_OutputSpec     parsed;
+    std::string_view settings = arg.substr(0, colon);
+    while (!settings.empty())
+    {
+        const size_t           comma = settings.find(',');
+        const std::string_view item  = settings.substr(0, comma);
+        settings                     = comma == std::string_view::npos ? "" : settings.substr(comma + 1);
+
+        if (!parsed.has_format &&
+            R_ParseFormat(item, parsed.format, parsed.container, parsed.flac_bits_per_sample))
+        {
+            parsed.has_format = true;
+        }
+        else if (!parsed.has_gain && R_ParseOutputGain(item, parsed.gain))
+        {
+            parsed.has_gain = true;
+        }
+        else
+        {
+            return spec;
+        }
+    }
+
+    parsed.filename = arg.substr(colon + 1);
+    return parsed;
+}
@@ -0,0 +1,35 @@
+// Parsing the format and gain settings of an output file given on the command
+// line.
+
+#pragma once
+
+#include "audio.h"
+#include <cstdint>
+#include <string_view>
+
+enum class R_OutputContainer
+{
+    Wav,
+    Flac,
+};
+
+// A file to render to, given with -o. Format and gain default to the ones given with -f and --gain.
+struct R_OutputSpec
+{
+    std::string_view  filename;
+    AudioFormat       format               = AudioFormat::S16;
+    R_OutputContainer container            = R_OutputContainer::Wav;
+    uint32_t          flac_bits_per_sample = 16;
+    float             gain                 = 1.0f;
+    bool              has_format           = false;
+    bool              has_gain             = false;
+};
+
+// Parses a format name as given to -f. Returns false if `name` isn't one.
+bool R_ParseFormat(std::string_view name, AudioFormat& format, R_OutputContainer& container, uint32_t& flac_bits);
+
+// Parses the argument of -o, which is `[settings:]filename` where settings is a comma separated list of a format and/or
+// a gain, e.g. `f32,-6db:master.wav`. A gain must either be in decibels with a `db` suffix or be written as
+// `gain=<amount>`, so that a filename like `1:take.wav` is never mistaken for a gain. If the part before the first
+// colon isn't a valid list of settings, the whole argument is the filename, so that paths like `C:\out.wav` still work.
+R_OutputSpec R_ParseOutputSpec(std::string_view arg);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <source_location>
+
+// Reports a bug in the renderer and exits.
+[[noreturn]]
+inline void R_Panic(const char* msg, const std::source_location where = std::source_location::current())
+{
+    fprintf(stderr, "%s:%d: in %s: %s", where.file_name(), (int)where.line(), where.function_name(), msg);
+    exit(1);
+}
@@ -0,0 +1,102 @@
+// Settings for a render, as given on the command line.
+
+#pragma once
+
+#include "audio.h"
+#include "emu.h"
+#include "output_spec.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "common/rom_loader.h"
+
+// Routing by channel can't make use of more than SMF_CHANNEL_COUNT instances, but voice routing can.
+constexpr size_t R_MAX_CHANNEL_INSTANCES = 16;
+constexpr size_t R_MAX_INSTANCES         = 64;
+
+enum class R_EndBehavior
+{
+    // Cut the track at the last MIDI event.
+    Cut,
+    // Keep rendering until the emulator produces silence.
+    Release,
+};
+
+enum class R_RoutingMode
+{
+    // Channel N is played by instance N mod the instance count.
+    Modulo,
+    // Channels are assigned to instances based on how many notes they play at once.
+    Balanced,
+    // Each note is played by the instance with the fewest notes playing. Other channel messages go to all instances.
+    Voice,
+};
+
+struct R_AdvancedParameters
+{
+    common::RomOverrides rom_overrides;
+};
+
+struct R_Parameters
+{
+    std::string_view input_filename;
+    // Same as the first of `outputs`.
+    std::string_view output_filename;
+    // Every -o, with format and gain filled in. When there is exactly one, its settings are also copied to
+    // `output_format`, `output_container`, `flac_bits_per_sample`, and `gain`.
+    std::vector<R_OutputSpec> outputs;
+    bool help = false;
+    bool version = false;
+    size_t instances = 1;
+    R_RoutingMode routing = R_RoutingMode::Modulo;
+    std::optional<EMU_SystemReset> reset;
+    std::filesystem::path rom_directory = std::filesystem::current_path();
+    AudioFormat output_format = AudioFormat::S16;
+    R_OutputContainer output_container = R_OutputContainer::Wav;
+    // Only used for FLAC output.
+    uint32_t flac_bits_per_sample = 16;
+    bool output_stdout = false;
+    bool disable_oversampling = false;
+    bool idle_bypass = false;
+    // 0 means the emulator's native output frequency.
+    uint32_t output_rate = 0;
+    size_t max_queued_chunks = 256;
+    std::string_view romset_name;
+    bool debug = false;
+    // Where --debug output goes. Batch mode gives each job its own so that jobs running at once don't interleave.
+    FILE* debug_output = stderr;
+    R_EndBehavior end_behavior = R_EndBehavior::Cut;
+    std::filesystem::path nvram_filename;
+    bool legacy_romset_detection = false;
+    bool dump_emidi_loop_points = false;
+    // Render the song up to the end of its EMIDI loop, with the loop body played a second time as a seamless loop.
+    bool emidi_loop = false;
+    bool stems = false;
+    float gain = 1.0f;
+    // Target integrated loudness in LUFS. When set, the mix is measured before any output is written and every output
+    // is scaled to reach this loudness.
+    std::optional<double> normalize_lufs;
+    // Report progress as JSON lines instead of redrawing a status display.
+    bool progress_json = false;
+    // Directory of MIDI files or a file listing one MIDI file per line. Rendered in a single process when set.
+    std::filesystem::path batch_path;
+    // Where batch outputs go. Empty means next to each input.
+    std::filesystem::path output_directory;
+    // Number of files rendered at once in batch or server mode. 0 means pick based on the number of cores.
+    size_t jobs = 0;
+    // Unix domain socket to accept render requests on. Runs as a server when set.
+    std::filesystem::path serve_path;
+    // Output before this point in the song is discarded.
+    uint64_t from_ns = 0;
+    // Rendering stops at this point in the song. UINT64_MAX renders to the end.
+    uint64_t to_ns = UINT64_MAX;
+    // Where emulator checkpoints are cached between renders. Empty disables checkpoints.
+    std::filesystem::path checkpoint_directory;
+    uint64_t checkpoint_interval_ns = 10'000'000'000;
+    R_AdvancedParameters adv;
+};
@@ -0,0 +1,2674 @@
+#include "render.h"
+#include "audio.h"
+#include "cast.h"
+#include "math_util.h"
+#include "output.h"
+#include "panic.h"
+#include "spool.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+#include "common/gain.h"
+#include "common/resampler.h"
+#include "common/rom_loader.h"
+
+extern "C"
+{
+#include "sha/sha.h"
+}
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std::chrono_literals;
+
+// Audio frame chunk. Points to a header followed by a dynamically sized buffer containing audio data. The buffer
+// contains audio data. This type has reference semantics and represents unowned memory like a bare pointer, so take
+// care making copies of it.
+class R_FrameChunk
+{
+public:
+    [[nodiscard]]
+    static R_FrameChunk Alloc(size_t size_bytes)
+    {
+        R_FrameChunk c;
+
+        // TODO: use a better allocator. We allocate a bit more space because malloc has weak alignment guarantees, and
+        // we want the buffer to be 64-byte aligned for max SIMD compatibility.
+        size_t alloc_size = 64 + sizeof(Header) + size_bytes;
+
+        void* ptr = malloc(alloc_size);
+        if (!ptr)
+        {
+            return c;
+        }
+
+        // This should never fail or adjust ptr so passing the aligned pointer back to free should be ok.
+        if (!std::align(alignof(Header), sizeof(Header), ptr, alloc_size))
+        {
+            R_Panic("failed to align header");
+        }
+
+        Header* h = new (ptr) Header();
+        ptr = (uint8_t*)ptr + sizeof(Header);
+
+        if (!std::align(64, size_bytes, ptr, alloc_size))
+        {
+            R_Panic("failed to align buffer");
+        }
+
+        h->buffer      = ptr;
+        c.m_alloc      = h;
+        c.m_alloc->cap = size_bytes;
+
+        return c;
+    }
+
+    static void Free(R_FrameChunk c)
+    {
+        free(c.m_alloc);
+        c.m_alloc = nullptr;
+    }
+
+    [[nodiscard]]
+    size_t GetBufferLength() const
+    {
+        return m_alloc->len;
+    }
+
+    [[nodiscard]]
+    void* DataFirst()
+    {
+        return std::assume_aligned<64>(m_alloc->buffer);
+    }
+
+    [[nodiscard]]
+    void* DataLast()
+    {
+        // We cannot assume the end is 64-byte aligned because audio frames may be much smaller.
+        return (uint8_t*)DataFirst() + m_alloc->len;
+    }
+
+    void Write(const void* src, size_t src_len)
+    {
+        memcpy(DataLast(), src, src_len);
+        m_alloc->len += src_len;
+    }
+
+    // Discards the audio data so that the chunk can be filled again.
+    void Clear()
+    {
+        m_alloc->len = 0;
+    }
+
+    [[nodiscard]]
+    bool IsNull() const
+    {
+        return m_alloc == nullptr;
+    }
+
+    [[nodiscard]]
+    bool IsBufferFull() const
+    {
+        return m_alloc->len == m_alloc->cap;
+    }
+
+private:
+    struct Header
+    {
+        size_t  len  = 0;
+        size_t  cap  = 0;
+        void*   buffer;
+    };
+
+private:
+    Header* m_alloc = nullptr;
+};
+
+// Manages a chunk and frees it when it goes out of scope, similar to unique_ptr. Code outside of the chunk queue should
+// only use this type.
+class R_OwnedChunk
+{
+public:
+    R_OwnedChunk() = default;
+
+    explicit R_OwnedChunk(R_FrameChunk c)
+        : m_chunk(c)
+    {
+    }
+
+    ~R_OwnedChunk()
+    {
+        Free();
+    }
+
+    // Non-copyable
+    R_OwnedChunk(const R_OwnedChunk&)            = delete;
+    R_OwnedChunk& operator=(const R_OwnedChunk&) = delete;
+
+    // Moveable
+    R_OwnedChunk(R_OwnedChunk&& rhs)
+    {
+        m_chunk = rhs.Unmanage();
+    }
+
+    R_OwnedChunk& operator=(R_OwnedChunk&& rhs)
+    {
+        Free();
+        m_chunk = rhs.Unmanage();
+        return *this;
+    }
+
+    void Free()
+    {
+        R_FrameChunk::Free(m_chunk);
+        m_chunk = R_FrameChunk();
+    }
+
+    void Manage(R_FrameChunk rhs)
+    {
+        Free();
+        m_chunk = rhs;
+    }
+
+    [[nodiscard]]
+    R_FrameChunk Unmanage()
+    {
+        R_FrameChunk ptr = m_chunk;
+        m_chunk          = R_FrameChunk();
+        return ptr;
+    }
+
+    void Write(const void* src, size_t src_len)
+    {
+        m_chunk.Write(src, src_len);
+    }
+
+    [[nodiscard]]
+    bool IsBufferFull() const
+    {
+        return m_chunk.IsBufferFull();
+    }
+
+    [[nodiscard]]
+    void* DataFirst()
+    {
+        return m_chunk.DataFirst();
+    }
+
+    [[nodiscard]]
+    void* DataLast()
+    {
+        return m_chunk.DataLast();
+    }
+
+    [[nodiscard]]
+    bool IsNull() const
+    {
+        return m_chunk.IsNull();
+    }
+
+    [[nodiscard]]
+    size_t GetBufferLength() const
+    {
+        return m_chunk.GetBufferLength();
+    }
+
+private:
+    R_FrameChunk m_chunk;
+};
+
+// Bounded single-producer single-consumer ring of chunks. Lock-free; the producer only writes m_tail and the consumer
+// only writes m_head.
+class R_ChunkRing
+{
+public:
+    R_ChunkRing() = default;
+
+    ~R_ChunkRing()
+    {
+        R_FrameChunk chunk;
+        while (TryPop(chunk))
+        {
+            R_FrameChunk::Free(chunk);
+        }
+    }
+
+    R_ChunkRing(const R_ChunkRing&)            = delete;
+    R_ChunkRing& operator=(const R_ChunkRing&) = delete;
+
+    // Must be called before the ring is shared between threads.
+    void SetCapacity(size_t capacity)
+    {
+        m_slots    = std::make_unique<R_FrameChunk[]>(capacity);
+        m_capacity = capacity;
+    }
+
+    size_t GetCapacity() const
+    {
+        return m_capacity;
+    }
+
+    // Producer only. Returns false if the ring is full.
+    [[nodiscard]]
+    bool TryPush(R_FrameChunk chunk)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == m_capacity)
+        {
+            return false;
+        }
+        m_slots[tail % m_capacity] = chunk;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Returns false if the ring is empty.
+    [[nodiscard]]
+    bool TryPop(R_FrameChunk& chunk)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        chunk = m_slots[head % m_capacity];
+        m_head.store(head + 1, std::memory_order_release);
+        m_head.notify_one();
+        return true;
+    }
+
+    // Producer only. Blocks until the consumer pops a chunk if the ring is full.
+    void WaitForSpace()
+    {
+        size_t head = m_head.load(std::memory_order_acquire);
+        while (m_tail.load(std::memory_order_relaxed) - head == m_capacity)
+        {
+            m_head.wait(head, std::memory_order_acquire);
+            head = m_head.load(std::memory_order_acquire);
+        }
+    }
+
+    size_t Count() const
+    {
+        // Load head first; tail can only move away from it.
+        const size_t head = m_head.load(std::memory_order_acquire);
+        return m_tail.load(std::memory_order_acquire) - head;
+    }
+
+private:
+    std::unique_ptr<R_FrameChunk[]> m_slots;
+    size_t                          m_capacity = 0;
+
+    // Kept on separate cache lines so the producer and consumer don't invalidate each other's index.
+    alignas(64) std::atomic<size_t> m_head = 0;
+    alignas(64) std::atomic<size_t> m_tail = 0;
+};
+
+// Queue for chunks of audio from one emulator to the mixer. The intent is that emulators should be able to expand the
+// queue as fast as possible while it may drain at a different rate. Filled chunks travel to the mixer through one ring,
+// and the mixer hands them back through another once they have been mixed so that the emulator can reuse the memory
+// instead of allocating a new chunk.
+class R_ChunkQueue
+{
+public:
+    R_ChunkQueue() = default;
+
+    // Sets the number of filled chunks that may be waiting for the mixer. Must be called before the queue is shared
+    // between threads.
+    void SetCapacity(size_t capacity)
+    {
+        m_ready.SetCapacity(capacity);
+        // Every chunk that exists is either ready, free, being filled, or being mixed.
+        m_free.SetCapacity(capacity + 2);
+    }
+
+    // Producer only. Returns an empty chunk of `size_bytes`, reusing a previously mixed chunk if there is one.
+    R_OwnedChunk Acquire(size_t size_bytes)
+    {
+        R_FrameChunk raw;
+        if (m_free.TryPop(raw))
+        {
+            raw.Clear();
+            return R_OwnedChunk(raw);
+        }
+        m_chunks_allocated.fetch_add(1, std::memory_order_relaxed);
+        return R_OwnedChunk(R_FrameChunk::Alloc(size_bytes));
+    }
+
+    // Producer only. Blocks until the mixer catches up if the queue is full.
+    void Enqueue(R_OwnedChunk chunk)
+    {
+        if (m_ready.Count() == m_ready.GetCapacity())
+        {
+            m_producer_stalls.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_ready.WaitForSpace();
+        if (!m_ready.TryPush(chunk.Unmanage()))
+        {
+            R_Panic("full queue");
+        }
+
+        const size_t count = m_ready.Count();
+        if (count > m_peak_count.load(std::memory_order_relaxed))
+        {
+            m_peak_count.store(count, std::memory_order_relaxed);
+        }
+    }
+
+    // Consumer only.
+    void Dequeue(R_OwnedChunk& chunk)
+    {
+        R_FrameChunk raw;
+        if (!m_ready.TryPop(raw))
+        {
+            R_Panic("empty queue");
+        }
+        chunk.Manage(raw);
+    }
+
+    // Consumer only. Hands a mixed chunk back to the producer.
+    void Recycle(R_OwnedChunk chunk)
+    {
+        R_FrameChunk raw = chunk.Unmanage();
+        if (!m_free.TryPush(raw))
+        {
+            R_FrameChunk::Free(raw);
+        }
+    }
+
+    size_t ChunkCount() const
+    {
+        return m_ready.Count();
+    }
+
+    // Highest number of chunks that were waiting for the mixer at once.
+    size_t GetPeakChunkCount() const
+    {
+        return m_peak_count.load(std::memory_order_relaxed);
+    }
+
+    // Number of chunks this queue has allocated. Chunks are never freed before the mixer is destroyed, so this is also
+    // the peak.
+    size_t GetAllocatedChunkCount() const
+    {
+        return m_chunks_allocated.load(std::memory_order_relaxed);
+    }
+
+    // Number of times the producer had to wait because the queue was full.
+    size_t GetProducerStallCount() const
+    {
+        return m_producer_stalls.load(std::memory_order_relaxed);
+    }
+
+private:
+    R_ChunkRing m_ready;
+    R_ChunkRing m_free;
+
+    // Statistics; only written by the producer.
+    std::atomic<size_t> m_peak_count       = 0;
+    std::atomic<size_t> m_chunks_allocated = 0;
+    std::atomic<size_t> m_producer_stalls  = 0;
+};
+
+class R_Mixer
+{
+public:
+    // Blocks the calling thread until there's enough data in queues to mix.
+    void WaitForWork()
+    {
+        for (;;)
+        {
+            // Read the epoch before checking so that a submission between the check and the wait isn't missed.
+            const uint32_t epoch = m_work_epoch.load(std::memory_order_acquire);
+            if (GetReadyChunkCount() > 0)
+            {
+                return;
+            }
+            m_work_epoch.wait(epoch, std::memory_order_acquire);
+        }
+    }
+
+    // Returns chunk size in frame count.
+    size_t GetChunkSize() const
+    {
+        return m_chunk_size;
+    }
+
+    size_t GetFramesWritten(size_t queue_id) const
+    {
+        return m_frames_written[queue_id];
+    }
+
+    // Returns chunk size in bytes. Only valid after SetQueueCount.
+    size_t GetChunkSizeBytes() const
+    {
+        return m_chunk_size_bytes;
+    }
+
+    const R_ChunkQueue& GetQueue(size_t queue_id) const
+    {
+        return m_queues[queue_id];
+    }
+
+    // Sets number of queues and prepares a chunk builder for each. Each queue holds at most `capacity` chunks waiting
+    // to be mixed; producers block in SubmitFrame once it is full.
+    // precondition: 0 <= count <= QUEUE_COUNT
+    // precondition: capacity > 0
+    template <typename T>
+    void SetQueueCount(size_t count, size_t capacity)
+    {
+        m_queues_in_use    = count;
+        m_chunk_size_bytes = m_chunk_size * sizeof(AudioFrame<T>);
+        for (size_t i = 0; i < count; ++i)
+        {
+            m_queues[i].SetCapacity(capacity);
+            m_chunks[i] = AcquireChunk<T>(i);
+        }
+    }
+
+    // Writes a frame to the chunk currently being built for queue_id. If the chunk becomes full, it is moved into its
+    // queue and a new chunk becomes available.
+    template <typename T>
+    void SubmitFrame(size_t queue_id, const AudioFrame<T>& frame)
+    {
+        m_chunks[queue_id].Write(&frame, sizeof(frame));
+        if (m_chunks[queue_id].IsBufferFull())
+        {
+            m_queues[queue_id].Enqueue(std::move(m_chunks[queue_id]));
+            NotifyWork();
+            m_chunks[queue_id] = AcquireChunk<T>(queue_id);
+        }
+        ++m_frames_written[queue_id];
+    }
+
+    // Enqueues whatever data is left in the chunk builder for queue_id and marks it as complete. After this call, no
+    // more data may be submitted to queue_id.
+    void MarkComplete(size_t queue_id)
+    {
+        // Enqueue first so that the mixer never sees a complete queue that is still missing its last chunk.
+        m_queues[queue_id].Enqueue(std::move(m_chunks[queue_id]));
+        m_queue_complete[queue_id].store(true, std::memory_order_release);
+        NotifyWork();
+    }
+
+    // Returns the number N of chunks that can be dequeued from each queue to call MixFrames N times.
+    size_t GetReadyChunkCount()
+    {
+        size_t count = (size_t)-1;
+        for (size_t i = 0; i < m_queues_in_use; ++i)
+        {
+            // Instances step in lockstep while playing the track, since event times come from a shared tempo map.
+            // With `--end release` however, each instance keeps rendering until it is silent, so some queues finish
+            // before others. Queues that are complete and have zero chunks will never receive new data, so they are
+            // not considered. If another queue is incomplete and has zero chunks, the emulator responsible for filling
+            // it will enqueue one eventually, and MixFrames still mixes it without waiting for the complete queue.
+
+            // Check completion first; once a queue is complete its chunk count can only go down.
+            const bool   complete = m_queue_complete[i].load(std::memory_order_acquire);
+            const size_t cc       = m_queues[i].ChunkCount();
+            if (!(complete && cc == 0))
+            {
+                count = Min(count, cc);
+            }
+        }
+        return count;
+    }
+
+    // Dequeues a chunk of T frames from each queue and mixes the corresponding audio frames from each chunk into a
+    // single zero-initialized buffer. The buffer may use a wider type than T so that `mix` can sum without clipping.
+    // precondition: GetReadyChunkCount() > 0
+    template <typename T, typename AccumT, typename MixFn>
+    size_t MixFrames(std::vector<AudioFrame<AccumT>>& output_buffer, MixFn mix)
+    {
+        output_buffer.clear();
+
+        R_OwnedChunk chunks[QUEUE_COUNT];
+
+        // precalcluate the output buffer size so that we don't need to bounds check or reallocate in the mix loop
+        size_t size_requested = 0;
+
+        for (size_t queue_id = 0; queue_id < m_queues_in_use; ++queue_id)
+        {
+            const bool   complete = m_queue_complete[queue_id].load(std::memory_order_acquire);
+            const size_t cc       = m_queues[queue_id].ChunkCount();
+            if (complete && cc == 0)
+            {
+                // See comment in GetReadyChunkCount.
+                continue;
+            }
+            m_queues[queue_id].Dequeue(chunks[queue_id]);
+            size_requested = std::max(size_requested, chunks[queue_id].GetBufferLength());
+        }
+
+        output_buffer.resize(size_requested / sizeof(AudioFrame<T>));
+        for (size_t queue_id = 0; queue_id < m_queues_in_use; ++queue_id)
+        {
+            if (chunks[queue_id].IsNull())
+            {
+                // Attempt to deal with errors from the prior loop
+                continue;
+            }
+            mix(queue_id, output_buffer.data(), chunks[queue_id].DataFirst(), chunks[queue_id].DataLast());
+            m_queues[queue_id].Recycle(std::move(chunks[queue_id]));
+        }
+
+        return size_requested / sizeof(AudioFrame<T>);
+    }
+
+    // Returns true when all queues are marked as complete and are empty.
+    bool IsFinished() const
+    {
+        for (size_t i = 0; i < m_queues_in_use; ++i)
+        {
+            if (!m_queue_complete[i] || m_queues[i].ChunkCount() != 0)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    template <typename T>
+    R_OwnedChunk AcquireChunk(size_t queue_id)
+    {
+        return m_queues[queue_id].Acquire(m_chunk_size_bytes);
+    }
+
+    void NotifyWork()
+    {
+        m_work_epoch.fetch_add(1, std::memory_order_release);
+        m_work_epoch.notify_one();
+    }
+
+    void DebugPrintQueues()
+    {
+        for (size_t i = 0; i < m_queues_in_use; ++i)
+        {
+            fprintf(stderr, "Queue %zu has %zu chunks\n", i, m_queues[i].ChunkCount());
+        }
+    }
+
+private:
+    // a quarter second of audio; chunks are recycled so a small size doesn't cost allocations
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 16 * 1024;
+    // one queue per emulator
+    static constexpr size_t QUEUE_COUNT = R_MAX_INSTANCES;
+
+    R_ChunkQueue m_queues[QUEUE_COUNT];
+    R_OwnedChunk m_chunks[QUEUE_COUNT];
+    std::atomic<bool> m_queue_complete[QUEUE_COUNT]{};
+    size_t       m_frames_written[QUEUE_COUNT]{};
+
+    size_t m_queues_in_use = 0;
+
+    // Size of chunks in frames.
+    size_t m_chunk_size = DEFAULT_CHUNK_SIZE;
+    // Size of chunks in bytes.
+    size_t m_chunk_size_bytes = 0;
+
+    // Incremented by producers whenever they submit a chunk or complete a queue. The consumer waits on it.
+    std::atomic<uint32_t> m_work_epoch = 0;
+};
+
+enum R_LoopPointType
+{
+    TrackStart,
+    TrackEnd,
+    GlobalStart,
+    GlobalEnd,
+};
+
+struct R_LoopPoint
+{
+    R_LoopPointType type;
+    uint64_t        frame;
+    uint64_t        timestamp_ns;
+    uint16_t        midi_track;
+    uint8_t         midi_channel;
+};
+
+class R_LoopPointRecorder
+{
+public:
+    void Record(const R_LoopPoint& point)
+    {
+        std::scoped_lock lk(m_mutex);
+        m_loop_points.emplace_back(point);
+    }
+
+    void SortByTrack()
+    {
+        std::stable_sort(m_loop_points.begin(), m_loop_points.end(), [](const auto& a, const auto& b) {
+            return a.midi_track < b.midi_track;
+        });
+    }
+
+    std::span<const R_LoopPoint> GetLoopPoints() const
+    {
+        return m_loop_points;
+    }
+
+private:
+    std::mutex                    m_mutex;
+    std::vector<R_LoopPoint> m_loop_points;
+};
+
+struct R_TrackRenderState
+{
+    Emulator* emu = nullptr;
+    R_Mixer* mixer = nullptr;
+    size_t queue_id = 0;
+    size_t ns_simulated = 0;
+    const R_EventRouter* router = nullptr;
+    // Number of events routed to this instance.
+    size_t event_count = 0;
+    // Index in the merged track of the first event to play. Nonzero when resuming from a checkpoint.
+    size_t first_event = 0;
+    // Samples are thrown away until `start_ns` has been simulated.
+    uint64_t start_ns = 0;
+    bool discarding = false;
+    // Rendering stops once `end_ns` has been simulated.
+    uint64_t end_ns = UINT64_MAX;
+    // Null if checkpoints are disabled.
+    R_CheckpointStore* checkpoints = nullptr;
+    uint64_t next_checkpoint_ns = 0;
+    // Merged event indices and times of the loop markers for --emidi-loop. SIZE_MAX if not rendering a loop.
+    size_t loop_start_event = SIZE_MAX;
+    size_t loop_end_event = SIZE_MAX;
+    uint64_t loop_start_ns = 0;
+    uint64_t loop_end_ns = 0;
+    R_LoopFrames loop_frames;
+    // Set by the mix thread when the output can no longer be written. Null if the output can't fail mid-render.
+    const std::atomic<bool>* cancel = nullptr;
+    std::thread thread;
+    std::chrono::high_resolution_clock::duration elapsed;
+    size_t num_silent_frames = 0;
+    R_EndBehavior end_behavior;
+    R_LoopPointRecorder* loop_recorder;
+    AudioFormat output_format;
+    float gain = 1.0f;
+
+    // these fields are accessed from main thread during render process
+    std::atomic<size_t> events_processed = 0;
+    // Copy of `ns_simulated` for progress reports.
+    std::atomic<uint64_t> ns_progress = 0;
+    std::atomic<bool> done;
+};
+
+struct R_SilenceModelNone
+{
+    static constexpr bool IsSilence(const AudioFrame<int32_t>& in_raw)
+    {
+        (void)in_raw;
+        return false;
+    }
+};
+
+struct R_SilenceModelGeneric
+{
+    static constexpr bool IsSilence(const AudioFrame<int32_t>& in_raw)
+    {
+        // The emulator doesn't produce exact zeroes when no notes are playing.
+        constexpr int32_t MIN = -0x4000;
+        constexpr int32_t MAX = +0x4000;
+        return MIN <= in_raw.left && in_raw.left <= MAX && MIN <= in_raw.right && in_raw.right <= MAX;
+    }
+};
+
+struct R_SilenceModelMK1
+{
+    static constexpr bool IsSilence(const AudioFrame<int32_t>& in_raw)
+    {
+        constexpr int32_t DC_OFFSET = 0x1000000;
+        constexpr int32_t MIN       = DC_OFFSET - 0x10000;
+        constexpr int32_t MAX       = DC_OFFSET + 0x10000;
+        return MIN <= in_raw.left && in_raw.left <= MAX && MIN <= in_raw.right && in_raw.right <= MAX;
+    }
+};
+
+template <typename SampleT, typename SilenceModel, bool ApplyGain>
+void R_ReceiveSample(void* userdata, const AudioFrame<int32_t>& in)
+{
+    R_TrackRenderState* state = (R_TrackRenderState*)userdata;
+
+    AudioFrame<SampleT> out;
+    Normalize(in, out);
+
+    // Skip silence processing until end of track
+    if constexpr (!std::is_same_v<SilenceModel, R_SilenceModelNone>)
+    {
+        if (SilenceModel::IsSilence(in))
+        {
+            ++state->num_silent_frames;
+        }
+        else
+        {
+            state->num_silent_frames = 0;
+        }
+    }
+
+    if constexpr (ApplyGain)
+    {
+        Scale(out, state->gain);
+    }
+
+    state->mixer->SubmitFrame(state->queue_id, out);
+}
+
+// Used before the start of the requested time range.
+void R_DiscardSample(void* userdata, const AudioFrame<int32_t>& in)
+{
+    (void)userdata;
+    (void)in;
+}
+
+void R_RunReset(Emulator& emu, EMU_SystemReset reset)
+{
+    emu.PostSystemReset(reset);
+
+    for (size_t i = 0; i < 24'000'000; ++i)
+    {
+        emu.Step();
+    }
+}
+
+void R_PostEvent(Emulator& emu, const SMF_Data& data, const SMF_Event& ev)
+{
+    emu.PostMIDI(ev.status);
+    emu.PostMIDI(ev.GetData(data.bytes));
+}
+
+// Routes channel N to instance N mod `n`.
+R_ChannelMap R_MakeModuloChannelMap(size_t n)
+{
+    R_ChannelMap map;
+    for (size_t channel = 0; channel < SMF_CHANNEL_COUNT; ++channel)
+    {
+        map[channel] = channel % n;
+    }
+    return map;
+}
+
+// Polyphony of a single channel over the course of a track.
+struct R_ChannelLoad
+{
+    // Highest number of notes held at once within each time bucket.
+    std::vector<uint8_t> profile;
+    uint8_t  peak_polyphony = 0;
+    uint64_t note_count     = 0;
+};
+
+// Number of time slices the track is divided into when estimating polyphony.
+constexpr size_t R_LOAD_BUCKETS = 1024;
+
+// Estimates how many voices each channel needs over time. This counts held notes, including notes held by the
+// sustain pedal, but not release tails. It is only meant to compare channels against each other.
+std::array<R_ChannelLoad, SMF_CHANNEL_COUNT> R_EstimateChannelLoad(const SMF_Data& data)
+{
+    std::array<R_ChannelLoad, SMF_CHANNEL_COUNT> result;
+    for (auto& load : result)
+    {
+        load.profile.resize(R_LOAD_BUCKETS);
+    }
+
+    uint64_t last_timestamp = 0;
+    for (const SMF_Track& track : data.tracks)
+    {
+        if (!track.events.empty())
+        {
+            last_timestamp = std::max(last_timestamp, track.events.back().timestamp);
+        }
+    }
+    const uint64_t track_length = last_timestamp + 1;
+
+    // Per channel and key: number of note-ons that haven't been released yet, and whether a note-off arrived while
+    // the sustain pedal was down.
+    uint8_t held[SMF_CHANNEL_COUNT][128]{};
+    bool    sustained[SMF_CHANNEL_COUNT][128]{};
+    bool    pedal[SMF_CHANNEL_COUNT]{};
+    uint8_t polyphony[SMF_CHANNEL_COUNT]{};
+
+    // Last bucket each channel's profile has been filled up to.
+    size_t current_bucket[SMF_CHANNEL_COUNT]{};
+
+    // Starts each bucket up to `bucket` at the polyphony carried over from the end of the previous one, since notes
+    // held across a boundary still occupy voices. Buckets without events keep the carried value.
+    auto advance = [&](uint8_t channel, size_t bucket) {
+        R_ChannelLoad& load = result[channel];
+        while (current_bucket[channel] < bucket)
+        {
+            ++current_bucket[channel];
+            load.profile[current_bucket[channel]] = polyphony[channel];
+        }
+    };
+
+    auto release = [&](uint8_t channel, uint8_t key) {
+        if (held[channel][key] > 0)
+        {
+            --held[channel][key];
+            --polyphony[channel];
+        }
+    };
+
+    SMF_TrackMerger merger(data);
+    while (const SMF_Event* next = merger.Next())
+    {
+        const SMF_Event& event = *next;
+        if (event.IsSystem())
+        {
+            continue;
+        }
+
+        const uint8_t      channel = event.GetChannel();
+        const uint8_t      type    = event.status & 0xf0;
+        const SMF_ByteSpan bytes   = event.GetData(data.bytes);
+        const size_t       bucket  = (size_t)(event.timestamp * R_LOAD_BUCKETS / track_length);
+
+        advance(channel, bucket);
+
+        if (type == 0x90 && bytes.size() >= 2 && bytes[1] != 0)
+        {
+            const uint8_t key = bytes[0] & 0x7f;
+            if (held[channel][key] < UINT8_MAX && polyphony[channel] < UINT8_MAX)
+            {
+                ++held[channel][key];
+                ++polyphony[channel];
+            }
+            sustained[channel][key] = false;
+            ++result[channel].note_count;
+        }
+        else if ((type == 0x80 || type == 0x90) && bytes.size() >= 1)
+        {
+            const uint8_t key = bytes[0] & 0x7f;
+            if (pedal[channel])
+            {
+                sustained[channel][key] = true;
+            }
+            else
+            {
+                release(channel, key);
+            }
+        }
+        else if (type == 0xb0 && bytes.size() >= 2 && bytes[0] == 64)
+        {
+            pedal[channel] = bytes[1] >= 64;
+            if (!pedal[channel])
+            {
+                for (uint8_t key = 0; key < 128; ++key)
+                {
+                    if (sustained[channel][key])
+                    {
+                        sustained[channel][key] = false;
+                        release(channel, key);
+                    }
+                }
+            }
+        }
+        else
+        {
+            continue;
+        }
+
+        R_ChannelLoad& load  = result[channel];
+        load.profile[bucket] = std::max(load.profile[bucket], polyphony[channel]);
+        load.peak_polyphony  = std::max(load.peak_polyphony, polyphony[channel]);
+    }
+
+    // Notes still held when the track ends (e.g. a missing note-off) occupy the remaining buckets.
+    for (uint8_t channel = 0; channel < SMF_CHANNEL_COUNT; ++channel)
+    {
+        advance(channel, R_LOAD_BUCKETS - 1);
+    }
+
+    return result;
+}
+
+// Assigns channels to `n` instances so that the combined polyphony of each instance stays as low as possible.
+//
+// Channels are placed one at a time, busiest first, on whichever instance ends up with the lowest peak polyphony
+// after adding the channel. Ties go to the instance with fewer notes so that work is spread out too. Unused
+// channels fall back to the modulo assignment.
+R_ChannelMap R_MakeBalancedChannelMap(const std::array<R_ChannelLoad, SMF_CHANNEL_COUNT>& loads, size_t n)
+{
+    R_ChannelMap map = R_MakeModuloChannelMap(n);
+
+    std::array<uint8_t, SMF_CHANNEL_COUNT> order;
+    for (uint8_t channel = 0; channel < SMF_CHANNEL_COUNT; ++channel)
+    {
+        order[channel] = channel;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint8_t a, uint8_t b) {
+        if (loads[a].peak_polyphony != loads[b].peak_polyphony)
+        {
+            return loads[a].peak_polyphony > loads[b].peak_polyphony;
+        }
+        return loads[a].note_count > loads[b].note_count;
+    });
+
+    std::vector<std::vector<uint32_t>> instance_profiles(n, std::vector<uint32_t>(R_LOAD_BUCKETS));
+    std::vector<uint64_t>              instance_notes(n);
+
+    for (uint8_t channel : order)
+    {
+        const R_ChannelLoad& load = loads[channel];
+        if (load.note_count == 0)
+        {
+            continue;
+        }
+
+        size_t   best_instance = 0;
+        uint32_t best_peak     = UINT32_MAX;
+        for (size_t instance = 0; instance < n; ++instance)
+        {
+            uint32_t peak = 0;
+            for (size_t bucket = 0; bucket < R_LOAD_BUCKETS; ++bucket)
+            {
+                peak = std::max(peak, instance_profiles[instance][bucket] + load.profile[bucket]);
+            }
+
+            if (peak < best_peak || (peak == best_peak && instance_notes[instance] < instance_notes[best_instance]))
+            {
+                best_instance = instance;
+                best_peak     = peak;
+            }
+        }
+
+        map[channel] = best_instance;
+        for (size_t bucket = 0; bucket < R_LOAD_BUCKETS; ++bucket)
+        {
+            instance_profiles[best_instance][bucket] += load.profile[bucket];
+        }
+        instance_notes[best_instance] += load.note_count;
+    }
+
+    return map;
+}
+
+// Prints which channels each instance plays along with the estimated load.
+void R_PrintChannelMap(FILE*                                               output,
+                       const R_ChannelMap&                                 channel_map,
+                       const std::array<R_ChannelLoad, SMF_CHANNEL_COUNT>& loads,
+                       size_t                                              n)
+{
+    fprintf(output, "Channel assignment:\n");
+    for (size_t instance = 0; instance < n; ++instance)
+    {
+        std::string channels;
+        uint32_t    peak  = 0;
+        uint64_t    notes = 0;
+        std::vector<uint32_t> profile(R_LOAD_BUCKETS);
+
+        for (uint8_t channel = 0; channel < SMF_CHANNEL_COUNT; ++channel)
+        {
+            // Channels without notes are left out to keep this readable.
+            if (channel_map[channel] != instance || loads[channel].note_count == 0)
+            {
+                continue;
+            }
+
+            if (!channels.empty())
+            {
+                channels += ",";
+            }
+            channels += std::to_string(channel + 1);
+
+            notes += loads[channel].note_count;
+            for (size_t bucket = 0; bucket < R_LOAD_BUCKETS; ++bucket)
+            {
+                profile[bucket] += loads[channel].profile[bucket];
+                peak = std::max(peak, profile[bucket]);
+            }
+        }
+
+        fprintf(output,
+                "#%02zu channels %s: %" PRIu64 " notes, est. peak polyphony %" PRIu32 "\n",
+                instance,
+                channels.empty() ? "(none)" : channels.c_str(),
+                notes,
+                peak);
+    }
+}
+
+// Result of R_AssignVoices, for --debug output.
+struct R_VoiceRoutingStats
+{
+    std::vector<uint64_t> note_count;
+    std::vector<uint32_t> peak_polyphony;
+};
+
+// Routes events to `n` instances by sending each note to the instance that has the fewest notes playing. Note-offs
+// follow their note-on and all other channel messages (program changes, controllers, pitch bend, ...) are sent to
+// every instance so that each of them has the same channel state. Returns a mask for each event of the merged track.
+//
+// Like R_EstimateChannelLoad, notes count as playing while held by a key or the sustain pedal. Release tails are
+// not tracked.
+std::vector<R_InstanceMask> R_AssignVoices(const SMF_Data& data, size_t n, R_VoiceRoutingStats& stats)
+{
+    std::vector<R_InstanceMask> result;
+
+    stats.note_count.assign(n, 0);
+    stats.peak_polyphony.assign(n, 0);
+
+    // Instances playing each key, oldest note first.
+    std::vector<uint8_t> owners[SMF_CHANNEL_COUNT][128];
+    // Per channel and instance: notes released while the sustain pedal was down.
+    std::vector<uint32_t> sustained[SMF_CHANNEL_COUNT];
+    bool pedal[SMF_CHANNEL_COUNT]{};
+    std::vector<uint32_t> polyphony(n);
+
+    for (auto& channel_sustained : sustained)
+    {
+        channel_sustained.assign(n, 0);
+    }
+
+    auto broadcast = [&]() {
+        result.push_back(R_AllInstances(n));
+    };
+
+    auto send_to = [&](size_t instance) {
+        result.push_back(R_InstanceMask{1} << instance);
+    };
+
+    auto release_sustained = [&](uint8_t channel) {
+        for (size_t instance = 0; instance < n; ++instance)
+        {
+            polyphony[instance] -= sustained[channel][instance];
+            sustained[channel][instance] = 0;
+        }
+    };
+
+    // Releases the oldest note on `key` and returns the instance playing it, or n if the key isn't playing.
+    auto release_key = [&](uint8_t channel, uint8_t key) {
+        std::vector<uint8_t>& key_owners = owners[channel][key];
+        if (key_owners.empty())
+        {
+            return n;
+        }
+
+        const size_t instance = key_owners.front();
+        key_owners.erase(key_owners.begin());
+        if (pedal[channel])
+        {
+            ++sustained[channel][instance];
+        }
+        else
+        {
+            --polyphony[instance];
+        }
+        return instance;
+    };
+
+    SMF_TrackMerger merger(data);
+    while (const SMF_Event* next = merger.Next())
+    {
+        const SMF_Event& event = *next;
+
+        // System events need to be processed by all emulators
+        if (event.IsSystem())
+        {
+            broadcast();
+            continue;
+        }
+
+        const uint8_t      channel = event.GetChannel();
+        const uint8_t      type    = event.status & 0xf0;
+        const SMF_ByteSpan bytes   = event.GetData(data.bytes);
+
+        if (type == 0x90 && bytes.size() >= 2 && bytes[1] != 0)
+        {
+            size_t best = 0;
+            for (size_t instance = 1; instance < n; ++instance)
+            {
+                if (polyphony[instance] < polyphony[best] ||
+                    (polyphony[instance] == polyphony[best] && stats.note_count[instance] < stats.note_count[best]))
+                {
+                    best = instance;
+                }
+            }
+
+            owners[channel][bytes[0] & 0x7f].push_back((uint8_t)best);
+            ++polyphony[best];
+            ++stats.note_count[best];
+            stats.peak_polyphony[best] = std::max(stats.peak_polyphony[best], polyphony[best]);
+            send_to(best);
+        }
+        else if ((type == 0x80 || type == 0x90) && bytes.size() >= 1)
+        {
+            const size_t instance = release_key(channel, bytes[0] & 0x7f);
+            if (instance < n)
+            {
+                send_to(instance);
+            }
+            else
+            {
+                // Unmatched note-off; harmless to send everywhere.
+                broadcast();
+            }
+        }
+        else if (type == 0xa0 && bytes.size() >= 1)
+        {
+            // Polyphonic aftertouch only matters to the instances playing the key.
+            const std::vector<uint8_t>& key_owners = owners[channel][bytes[0] & 0x7f];
+            if (key_owners.empty())
+            {
+                broadcast();
+            }
+            else
+            {
+                R_InstanceMask mask = 0;
+                for (uint8_t owner : key_owners)
+                {
+                    mask |= R_InstanceMask{1} << owner;
+                }
+                result.push_back(mask);
+            }
+        }
+        else if (type == 0xb0 && bytes.size() >= 1 && bytes[0] >= 116 && bytes[0] <= 119)
+        {
+            // EMIDI loop markers don't affect the synth. Send them to one instance so loop points are recorded once.
+            send_to(0);
+        }
+        else
+        {
+            broadcast();
+
+            if (type == 0xb0 && bytes.size() >= 2)
+            {
+                const uint8_t controller = bytes[0];
+                if (controller == 64)
+                {
+                    pedal[channel] = bytes[1] >= 64;
+                    if (!pedal[channel])
+                    {
+                        release_sustained(channel);
+                    }
+                }
+                else if (controller == 121)
+                {
+                    // Reset all controllers also releases the sustain pedal.
+                    pedal[channel] = false;
+                    release_sustained(channel);
+                }
+                else if (controller == 120 || controller == 123 || (controller >= 124 && controller <= 127))
+                {
+                    // All sound off, all notes off, and mode changes end every held note.
+                    for (uint8_t key = 0; key < 128; ++key)
+                    {
+                        while (!owners[channel][key].empty())
+                        {
+                            release_key(channel, key);
+                        }
+                    }
+                    if (controller == 120)
+                    {
+                        release_sustained(channel);
+                    }
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+// Returns the channels that have at least one channel message, in ascending order.
+std::vector<uint8_t> R_FindUsedChannels(const SMF_Data& data)
+{
+    bool used[SMF_CHANNEL_COUNT]{};
+
+    for (const SMF_Track& track : data.tracks)
+    {
+        for (const SMF_Event& event : track.events)
+        {
+            if (!event.IsSystem())
+            {
+                used[event.GetChannel()] = true;
+            }
+        }
+    }
+
+    std::vector<uint8_t> result;
+    for (uint8_t channel = 0; channel < SMF_CHANNEL_COUNT; ++channel)
+    {
+        if (used[channel])
+        {
+            result.push_back(channel);
+        }
+    }
+    return result;
+}
+
+// Returns the path for the stem of `channel` (zero-based) next to `output`,
+// e.g. song.wav -> song_ch01.wav
+std::filesystem::path R_StemPath(const std::filesystem::path& output, uint8_t channel)
+{
+    char suffix[8];
+    snprintf(suffix, sizeof(suffix), "_ch%02d", channel + 1);
+
+    std::filesystem::path result = output.parent_path();
+    result /= output.stem();
+    result += suffix;
+    result += output.extension();
+    return result;
+}
+
+uint64_t R_NSPerStep(Emulator& emu)
+{
+    // These are best guesses.
+    if (emu.GetMCU().is_mk1 || emu.GetMCU().is_jv880)
+    {
+        return 600;
+    }
+    else
+    {
+        return 500;
+    }
+}
+
+void R_NsToTimeString(uint64_t ns, std::string& result)
+{
+    // one second in nanoseconds
+    constexpr uint64_t ONE_SEC = 1'000'000'000;
+
+    const uint64_t min  = ns / (60 * ONE_SEC);
+    const uint64_t sec  = (ns / ONE_SEC) % 60;
+    const uint64_t fsec = (uint64_t)(100.0 * ((double)(ns % ONE_SEC) / (double)ONE_SEC));
+
+    result.clear();
+    if (min < 10)
+    {
+        result += '0';
+    }
+    result += std::to_string(min);
+    result += ':';
+    if (sec < 10)
+    {
+        result += '0';
+    }
+    result += std::to_string(sec);
+    result += '.';
+    if (fsec < 10)
+    {
+        result += '0';
+    }
+    result += std::to_string(fsec);
+}
+
+bool R_IsEMIDITrackLoopStart(const SMF_Data& data, const SMF_Event& ev)
+{
+    return ev.IsControlChange() && ev.GetData(data.bytes)[0] == 116;
+}
+
+bool R_IsEMIDITrackLoopEnd(const SMF_Data& data, const SMF_Event& ev)
+{
+    return ev.IsControlChange() && ev.GetData(data.bytes)[0] == 117;
+}
+
+bool R_IsEMIDIGlobalLoopStart(const SMF_Data& data, const SMF_Event& ev)
+{
+    return ev.IsControlChange() && ev.GetData(data.bytes)[0] == 118;
+}
+
+bool R_IsEMIDIGlobalLoopEnd(const SMF_Data& data, const SMF_Event& ev)
+{
+    return ev.IsControlChange() && ev.GetData(data.bytes)[0] == 119;
+}
+
+template <typename SilenceModel>
+constexpr mcu_sample_callback R_PickCallback(const R_TrackRenderState& state)
+{
+    if (state.gain != 1.0f)
+    {
+        switch (state.output_format)
+        {
+        case AudioFormat::S16:
+            return R_ReceiveSample<int16_t, SilenceModel, true>;
+        case AudioFormat::S32:
+            return R_ReceiveSample<int32_t, SilenceModel, true>;
+        case AudioFormat::F32:
+            return R_ReceiveSample<float, SilenceModel, true>;
+        }
+    }
+    else
+    {
+        switch (state.output_format)
+        {
+        case AudioFormat::S16:
+            return R_ReceiveSample<int16_t, SilenceModel, false>;
+        case AudioFormat::S32:
+            return R_ReceiveSample<int32_t, SilenceModel, false>;
+        case AudioFormat::F32:
+            return R_ReceiveSample<float, SilenceModel, false>;
+        }
+    }
+
+    fprintf(stderr, "output_format = %d\n", (int)state.output_format);
+    fprintf(stderr, "gain = %f\n", state.gain);
+    R_Panic("no valid callback for state");
+}
+
+void R_HandleLoopPoint(R_TrackRenderState& state, const SMF_Data& data, const SMF_Event& event)
+{
+    // Loop points are reported relative to the output, which doesn't contain anything before the start
+    if (state.discarding)
+    {
+        return;
+    }
+
+    // Save loop points - they will be processed on the main thread later
+    if (R_IsEMIDITrackLoopStart(data, event))
+    {
+        state.loop_recorder->Record({
+            .type         = R_LoopPointType::TrackStart,
+            .frame        = state.mixer->GetFramesWritten(state.queue_id),
+            .timestamp_ns = state.ns_simulated,
+            .midi_track   = event.track_id,
+            .midi_channel = event.GetChannel(),
+        });
+    }
+    else if (R_IsEMIDITrackLoopEnd(data, event))
+    {
+        state.loop_recorder->Record({
+            .type         = R_LoopPointType::TrackEnd,
+            .frame        = state.mixer->GetFramesWritten(state.queue_id),
+            .timestamp_ns = state.ns_simulated,
+            .midi_track   = event.track_id,
+            .midi_channel = event.GetChannel(),
+        });
+    }
+    else if (R_IsEMIDIGlobalLoopStart(data, event))
+    {
+        state.loop_recorder->Record({
+            .type         = R_LoopPointType::GlobalStart,
+            .frame        = state.mixer->GetFramesWritten(state.queue_id),
+            .timestamp_ns = state.ns_simulated,
+            .midi_track   = event.track_id,
+            .midi_channel = event.GetChannel(),
+        });
+    }
+    else if (R_IsEMIDIGlobalLoopEnd(data, event))
+    {
+        state.loop_recorder->Record({
+            .type         = R_LoopPointType::GlobalEnd,
+            .frame        = state.mixer->GetFramesWritten(state.queue_id),
+            .timestamp_ns = state.ns_simulated,
+            .midi_track   = event.track_id,
+            .midi_channel = event.GetChannel(),
+        });
+    }
+}
+
+// True once the mix thread has given up on the output.
+bool R_IsCancelled(const R_TrackRenderState& state)
+{
+    return state.cancel && state.cancel->load(std::memory_order_relaxed);
+}
+
+// Steps the emulator until `ns` has been simulated. Output starts once `start_ns` is reached and checkpoints are saved
+// as they are passed. `next_event` is the index of the first merged event that hasn't been played yet. Returns early if
+// the render is cancelled.
+void R_StepUntil(R_TrackRenderState& state, uint64_t ns, size_t next_event, uint64_t ns_per_step)
+{
+    while (state.ns_simulated < ns)
+    {
+        // Run to the next point where something other than stepping has to happen.
+        uint64_t stop_ns = ns;
+        if (state.discarding)
+        {
+            stop_ns = std::min(stop_ns, state.start_ns);
+        }
+        if (state.checkpoints)
+        {
+            stop_ns = std::min(stop_ns, state.next_checkpoint_ns);
+        }
+
+        while (state.ns_simulated < stop_ns)
+        {
+            if (R_IsCancelled(state))
+            {
+                return;
+            }
+            state.emu->Step();
+            state.ns_simulated += ns_per_step;
+            state.ns_progress.store(state.ns_simulated, std::memory_order_relaxed);
+        }
+
+        if (state.discarding && state.ns_simulated >= state.start_ns)
+        {
+            state.discarding = false;
+            state.emu->SetSampleCallback(R_PickCallback<R_SilenceModelNone>(state), &state);
+        }
+
+        if (state.checkpoints && state.ns_simulated >= state.next_checkpoint_ns)
+        {
+            const uint64_t interval_ns = state.checkpoints->GetIntervalNS();
+            state.checkpoints->Save((size_t)(state.next_checkpoint_ns / interval_ns),
+                                    state.queue_id,
+                                    *state.emu,
+                                    {
+                                        .ns               = state.ns_simulated,
+                                        .next_event       = next_event,
+                                        .events_processed = state.events_processed,
+                                    });
+            state.next_checkpoint_ns += interval_ns;
+        }
+    }
+}
+
+// Plays the loop body for --emidi-loop a second time, starting from the state the emulator is in at the end of the
+// first time through. Sound still ringing at the loop end carries over into the start of the replayed loop just like
+// it does whenever the song jumps back, so the replay's audio wraps around without a seam.
+void R_ReplayLoop(const SMF_Data& data, R_TrackRenderState& state, uint64_t ns_per_step)
+{
+    const R_InstanceMask instance_bit = R_InstanceMask{1} << state.queue_id;
+
+    // Events are shifted by one loop length.
+    const uint64_t offset_ns = state.loop_end_ns - state.loop_start_ns;
+
+    SMF_TrackMerger merger(data);
+    size_t          index = 0;
+    while (index < state.loop_start_event && merger.Next())
+    {
+        ++index;
+    }
+
+    while (const SMF_Event* next = merger.Next())
+    {
+        if (R_IsCancelled(state))
+        {
+            return;
+        }
+
+        const SMF_Event& event       = *next;
+        const size_t     event_index = index++;
+        const uint64_t   event_ns    = data.tempo_map.TicksToNS(event.timestamp) + offset_ns;
+        const bool       routed      = (state.router->GetInstanceMask(event_index, event) & instance_bit) != 0;
+
+        if (event_index == state.loop_end_event)
+        {
+            R_StepUntil(state, event_ns, event_index, ns_per_step);
+            state.loop_frames.end = state.mixer->GetFramesWritten(state.queue_id);
+            if (routed)
+            {
+                R_HandleLoopPoint(state, data, event);
+            }
+            return;
+        }
+
+        if (!routed)
+        {
+            continue;
+        }
+
+        R_StepUntil(state, event_ns, event_index, ns_per_step);
+
+        if (!event.IsMetaEvent())
+        {
+            R_PostEvent(*state.emu, data, event);
+        }
+
+        R_HandleLoopPoint(state, data, event);
+
+        ++state.events_processed;
+    }
+}
+
+void R_RenderOne(const SMF_Data& data, R_TrackRenderState& state)
+{
+    const R_InstanceMask instance_bit = R_InstanceMask{1} << state.queue_id;
+
+    const uint64_t ns_per_step = R_NSPerStep(*state.emu);
+
+    auto t_start = std::chrono::high_resolution_clock::now();
+
+    SMF_TrackMerger merger(data);
+    size_t          index = 0;
+
+    // Skip events that were already played before the checkpoint this render resumed from.
+    while (index < state.first_event && merger.Next())
+    {
+        ++index;
+    }
+
+    bool reached_end = false;
+    while (const SMF_Event* next = merger.Next())
+    {
+        if (R_IsCancelled(state))
+        {
+            break;
+        }
+
+        const SMF_Event& event       = *next;
+        const size_t     event_index = index++;
+
+        // Every instance stops at the loop markers, even ones that don't play them, so that they agree on where the
+        // loop is in the output. The first time through, the loop body only brings the emulator to the state it is in
+        // at the loop end, so its audio is discarded; R_ReplayLoop renders the loop that ends up in the output.
+        if (event_index == state.loop_start_event)
+        {
+            R_StepUntil(state, state.loop_start_ns, event_index, ns_per_step);
+            state.loop_frames.start = state.mixer->GetFramesWritten(state.queue_id);
+
+            // R_StepUntil switches back to the regular callback once the loop end is reached.
+            state.discarding = true;
+            state.start_ns   = state.loop_end_ns;
+            state.emu->SetSampleCallback(R_DiscardSample, &state);
+        }
+        else if (event_index == state.loop_end_event)
+        {
+            R_StepUntil(state, state.loop_end_ns, event_index, ns_per_step);
+            R_ReplayLoop(data, state, ns_per_step);
+            break;
+        }
+
+        if ((state.router->GetInstanceMask(event_index, event) & instance_bit) == 0)
+        {
+            continue;
+        }
+
+        // Event times come from the tempo map shared by all instances instead of being accumulated from deltas, so
+        // every instance fires events on the same tick after exactly the same number of steps.
+        const uint64_t this_event_time_ns = data.tempo_map.TicksToNS(event.timestamp);
+
+        if (this_event_time_ns > state.end_ns)
+        {
+            R_StepUntil(state, state.end_ns, event_index, ns_per_step);
+            reached_end = true;
+            break;
+        }
+
+        R_StepUntil(state, this_event_time_ns, event_index, ns_per_step);
+
+        // Fire the event.
+        if (!event.IsMetaEvent())
+        {
+            R_PostEvent(*state.emu, data, event);
+        }
+
+        R_HandleLoopPoint(state, data, event);
+
+        ++state.events_processed;
+    }
+
+    // There's no tail to release if the song was cut short or nothing was rendered
+    if (state.end_behavior == R_EndBehavior::Release && !reached_end && !state.discarding && !R_IsCancelled(state))
+    {
+        // Enable silence processing callback
+        if (state.emu->GetMCU().is_mk1)
+        {
+            state.emu->SetSampleCallback(R_PickCallback<R_SilenceModelMK1>(state), &state);
+        }
+        else
+        {
+            state.emu->SetSampleCallback(R_PickCallback<R_SilenceModelGeneric>(state), &state);
+        }
+
+        const uint32_t frequency = PCM_GetOutputFrequency(state.emu->GetPCM());
+        // TODO: make this configurable? do we care? currently 100ms
+        const size_t silence_time = frequency / 10;
+
+        while (state.num_silent_frames < silence_time && !R_IsCancelled(state))
+        {
+            state.emu->Step();
+            state.ns_simulated += ns_per_step;
+            state.ns_progress.store(state.ns_simulated, std::memory_order_relaxed);
+        }
+    }
+    state.elapsed = std::chrono::high_resolution_clock::now() - t_start;
+
+    state.mixer->MarkComplete(state.queue_id);
+
+    state.done = true;
+}
+
+void R_CursorUpLines(int n)
+{
+    fprintf(stderr, "\x1b[%dF", n);
+}
+
+struct R_MixOutState
+{
+    R_Mixer* mixer = nullptr;
+
+    // Written by mix thread, read by main thread
+    std::atomic<size_t> frames_mixed = 0;
+
+    // Eventually we need to abstract over this to stream to other outputs.
+    R_OutputFile* output = nullptr;
+
+    // When rendering stems, one output per queue that receives the unmixed audio.
+    R_OutputFile* stem_outputs = nullptr;
+
+    // When converting the sample rate, one resampler for `output` and one for each of `stem_outputs`.
+    common::Resampler* resampler       = nullptr;
+    common::Resampler* stem_resamplers = nullptr;
+
+    // Set for --emidi-loop. Filled in by the first instance before it completes.
+    const R_LoopFrames* loop = nullptr;
+
+    // When streaming, the file `output` writes to. The first failed write sets `cancel` so that instances stop
+    // rendering audio that nobody will receive; the rest of the mix is drained and discarded.
+    FILE*              stream = nullptr;
+    std::atomic<bool>* cancel = nullptr;
+};
+
+template <typename T>
+void R_MixOut(R_MixOutState& state)
+{
+    using AccumT = AudioAccumulatorT<T>;
+
+    // Instances are summed in a wider type and clipped once when converting to T.
+    std::vector<AudioFrame<AccumT>> accum_buffer;
+    accum_buffer.reserve(state.mixer->GetChunkSize());
+    std::vector<AudioFrame<T>> mix_buffer;
+    mix_buffer.reserve(state.mixer->GetChunkSize());
+
+    R_ResampleScratch<T> scratch;
+
+    while (!state.mixer->IsFinished())
+    {
+        state.mixer->WaitForWork();
+
+        state.frames_mixed += state.mixer->template MixFrames<T>(
+            accum_buffer, [&state, &scratch](size_t queue_id, void* dest, void* src_first, void* src_last) {
+                const auto* first = (const AudioFrame<T>*)src_first;
+                const auto* last  = (const AudioFrame<T>*)src_last;
+                if (state.stem_outputs)
+                {
+                    R_WriteFrames(state.stem_outputs[queue_id],
+                                  state.stem_resamplers ? &state.stem_resamplers[queue_id] : nullptr,
+                                  scratch,
+                                  first,
+                                  last);
+                }
+                AccumulateFrames((AudioFrame<AccumT>*)dest, first, (size_t)(last - first));
+            });
+
+        if (state.cancel && state.cancel->load(std::memory_order_relaxed))
+        {
+            continue;
+        }
+
+        mix_buffer.resize(accum_buffer.size());
+        NarrowFrames(mix_buffer.data(), accum_buffer.data(), accum_buffer.size());
+
+        R_WriteFrames(*state.output, state.resampler, scratch, mix_buffer.data(), mix_buffer.data() + mix_buffer.size());
+
+        if (state.stream && ferror(state.stream))
+        {
+            state.cancel->store(true, std::memory_order_relaxed);
+        }
+    }
+
+    R_FinishOutput<T>(*state.output, state.resampler, scratch, state.loop);
+}
+
+// Mixes instances rendering S32 into a single unclipped mix and hands each block of it to every writer.
+void R_MixOutFanOut(R_MixOutState& state, std::span<R_FanOutWriter<int64_t>> writers)
+{
+    while (!state.mixer->IsFinished())
+    {
+        state.mixer->WaitForWork();
+
+        auto block = std::make_shared<std::vector<AudioFrame<int64_t>>>();
+        block->reserve(state.mixer->GetChunkSize());
+        state.frames_mixed += state.mixer->template MixFrames<int32_t>(
+            *block, [](size_t queue_id, void* dest, void* src_first, void* src_last) {
+                (void)queue_id;
+                const auto* first = (const AudioFrame<int32_t>*)src_first;
+                const auto* last  = (const AudioFrame<int32_t>*)src_last;
+                AccumulateFrames((AudioFrame<int64_t>*)dest, first, (size_t)(last - first));
+            });
+
+        for (R_FanOutWriter<int64_t>& writer : writers)
+        {
+            writer.Push(block);
+        }
+    }
+
+    for (R_FanOutWriter<int64_t>& writer : writers)
+    {
+        writer.Finish();
+    }
+}
+
+// Mixes instances rendering F32 into `spool` for --normalize-lufs.
+void R_MixOutSpool(R_MixOutState& state, R_LoudnessSpool& spool)
+{
+    std::vector<AudioFrame<float>> accum_buffer;
+    accum_buffer.reserve(state.mixer->GetChunkSize());
+
+    while (!state.mixer->IsFinished())
+    {
+        state.mixer->WaitForWork();
+
+        state.frames_mixed += state.mixer->template MixFrames<float>(
+            accum_buffer, [](size_t queue_id, void* dest, void* src_first, void* src_last) {
+                (void)queue_id;
+                const auto* first = (const AudioFrame<float>*)src_first;
+                const auto* last  = (const AudioFrame<float>*)src_last;
+                AccumulateFrames((AudioFrame<float>*)dest, first, (size_t)(last - first));
+            });
+
+        spool.Write(accum_buffer);
+    }
+}
+
+// Full scale of `format` in F32 units. Integer outputs have 6dB more headroom than F32; see Normalize.
+constexpr double R_FullScale(AudioFormat format)
+{
+    return format == AudioFormat::F32 ? 1.0 : 2.0;
+}
+
+// Finishes the stems once the mix thread is done. Needs the sample type to convert buffered resampler output.
+template <typename T>
+void R_FinishStems(R_MixOutState& state, size_t count)
+{
+    R_ResampleScratch<T> scratch;
+    for (size_t i = 0; i < count; ++i)
+    {
+        R_FinishOutput<T>(state.stem_outputs[i],
+                          state.stem_resamplers ? &state.stem_resamplers[i] : nullptr,
+                          scratch,
+                          state.loop);
+    }
+}
+
+// Finds the global loop (CC 118/119), or the first track loop (CC 116/117) if the song doesn't have one.
+std::optional<R_EMIDILoop> R_FindEMIDILoop(const SMF_Data& data)
+{
+    std::optional<size_t>      global_start;
+    uint64_t                   global_start_ns = 0;
+    std::optional<size_t>      track_start;
+    uint64_t                   track_start_ns    = 0;
+    uint16_t                   track_start_track = 0;
+    std::optional<R_EMIDILoop> track_loop;
+
+    SMF_TrackMerger merger(data);
+    size_t          index = 0;
+    while (const SMF_Event* event = merger.Next())
+    {
+        const size_t   event_index = index++;
+        const uint64_t event_ns    = data.tempo_map.TicksToNS(event->timestamp);
+        if (R_IsEMIDIGlobalLoopStart(data, *event) && !global_start)
+        {
+            global_start    = event_index;
+            global_start_ns = event_ns;
+        }
+        else if (R_IsEMIDIGlobalLoopEnd(data, *event) && global_start)
+        {
+            return R_EMIDILoop{*global_start, event_index, global_start_ns, event_ns};
+        }
+        else if (R_IsEMIDITrackLoopStart(data, *event) && !track_start)
+        {
+            track_start       = event_index;
+            track_start_ns    = event_ns;
+            track_start_track = event->track_id;
+        }
+        else if (R_IsEMIDITrackLoopEnd(data, *event) && track_start && !track_loop &&
+                 event->track_id == track_start_track)
+        {
+            track_loop = R_EMIDILoop{*track_start, event_index, track_start_ns, event_ns};
+        }
+    }
+
+    return track_loop;
+}
+
+R_RenderPlan R_PlanRender(const SMF_Data& data, const R_Parameters& params)
+{
+    R_RenderPlan plan;
+    plan.instances = params.instances;
+
+    // First decide which instance each channel goes to. For stems, every channel that is used gets its own instance.
+    R_ChannelMap channel_map = R_MakeModuloChannelMap(plan.instances);
+    std::array<R_ChannelLoad, SMF_CHANNEL_COUNT> channel_loads;
+    if (params.routing == R_RoutingMode::Balanced || params.debug)
+    {
+        channel_loads = R_EstimateChannelLoad(data);
+    }
+    if (params.routing == R_RoutingMode::Balanced)
+    {
+        channel_map = R_MakeBalancedChannelMap(channel_loads, plan.instances);
+    }
+    if (params.stems)
+    {
+        plan.stem_channels = R_FindUsedChannels(data);
+        if (plan.stem_channels.empty())
+        {
+            fprintf(stderr, "No channel messages found; rendering a single stem for channel 1\n");
+            plan.stem_channels.push_back(0);
+        }
+
+        channel_map.fill(0);
+        for (size_t i = 0; i < plan.stem_channels.size(); ++i)
+        {
+            channel_map[plan.stem_channels[i]] = i;
+        }
+        plan.instances = plan.stem_channels.size();
+    }
+
+    plan.router.instances   = plan.instances;
+    plan.router.channel_map = channel_map;
+
+    // Then decide which instances play each event
+    if (params.routing == R_RoutingMode::Voice && !params.stems)
+    {
+        R_VoiceRoutingStats voice_stats;
+        plan.router.voice_masks = R_AssignVoices(data, plan.instances, voice_stats);
+
+        if (params.debug)
+        {
+            fprintf(params.debug_output, "Voice assignment:\n");
+            for (size_t i = 0; i < plan.instances; ++i)
+            {
+                fprintf(params.debug_output,
+                        "#%02zu %" PRIu64 " notes, est. peak polyphony %" PRIu32 "\n",
+                        i,
+                        voice_stats.note_count[i],
+                        voice_stats.peak_polyphony[i]);
+            }
+        }
+    }
+    else if (params.debug)
+    {
+        R_PrintChannelMap(params.debug_output, channel_map, channel_loads, plan.instances);
+    }
+
+    if (params.emidi_loop)
+    {
+        plan.loop = R_FindEMIDILoop(data);
+    }
+
+    // Count events per instance for progress output. The loop body is played twice; see R_RenderOne.
+    plan.event_counts.assign(plan.instances, 0);
+    SMF_TrackMerger merger(data);
+    size_t          index = 0;
+    while (const SMF_Event* event = merger.Next())
+    {
+        if (plan.loop && index == plan.loop->end_event)
+        {
+            break;
+        }
+
+        const size_t plays = plan.loop && index >= plan.loop->start_event ? 2 : 1;
+        for (R_InstanceMask mask = plan.router.GetInstanceMask(index++, *event); mask; mask &= mask - 1)
+        {
+            plan.event_counts[(size_t)std::countr_zero(mask)] += plays;
+        }
+    }
+
+    return plan;
+}
+
+bool R_LoadRomContext(const R_Parameters& params, R_RomContext& context)
+{
+    common::LoadRomsetResult load_result;
+
+    common::LoadRomsetError err = common::LoadRomset(context.romset_info,
+                                                     params.rom_directory,
+                                                     params.romset_name,
+                                                     params.legacy_romset_detection,
+                                                     params.adv.rom_overrides,
+                                                     load_result);
+
+    common::PrintLoadRomsetDiagnostics(stderr, err, load_result, context.romset_info);
+
+    if (err != common::LoadRomsetError{})
+    {
+        return false;
+    }
+
+    context.romset = load_result.romset;
+
+    if (params.reset)
+    {
+        context.reset = *params.reset;
+    }
+    else if (!params.reset && load_result.romset == Romset::MK2)
+    {
+        // user didn't explicitly pass a reset and we're using a buggy romset
+        fprintf(stderr, "WARNING: No reset specified with mk2 romset; using gs\n");
+        context.reset = EMU_SystemReset::GS_RESET;
+    }
+
+    return true;
+}
+
+// Names the checkpoint directory for a render. Everything that changes what the emulators do has to be hashed here;
+// output settings such as format, rate, and gain only apply to samples after they leave the emulators. Must be called
+// before rom data is purged.
+std::string R_CheckpointKey(const SMF_Data&      data,
+                            const R_RomContext&  context,
+                            const R_Parameters&  params,
+                            const R_RenderPlan&  plan)
+{
+    SHA256Context ctx;
+    SHA256Reset(&ctx);
+
+    const auto hash_bytes = [&ctx](std::span<const uint8_t> bytes) {
+        SHA256Input(&ctx, bytes.data(), RangeCast<unsigned int>(bytes.size()));
+    };
+    const auto hash_value = [&hash_bytes](const auto& value) {
+        hash_bytes(std::span((const uint8_t*)&value, sizeof(value)));
+    };
+
+    hash_bytes(data.bytes);
+    hash_value(context.romset);
+    for (const std::vector<uint8_t>& rom : context.romset_info.romsets[(size_t)context.romset].rom_data)
+    {
+        hash_value(rom.size());
+        hash_bytes(rom);
+    }
+    hash_value(context.reset);
+    hash_value(plan.instances);
+    hash_value(params.routing);
+    hash_value(params.stems);
+    hash_value(params.disable_oversampling);
+    hash_value(params.idle_bypass);
+    hash_value(params.checkpoint_interval_ns);
+
+    uint8_t digest[SHA256HashSize];
+    SHA256Result(&ctx, digest);
+
+    std::string key;
+    for (uint8_t byte : digest)
+    {
+        constexpr char HEX[] = "0123456789abcdef";
+        key += HEX[byte >> 4];
+        key += HEX[byte & 0xf];
+    }
+    return key;
+}
+
+bool R_InitEmulator(Emulator& emu, const R_RomContext& context, const R_Parameters& params, size_t instance)
+{
+    std::filesystem::path this_nvram = params.nvram_filename;
+    if (!this_nvram.empty())
+    {
+        // append instance number so that multiple instances don't clobber each other's nvram
+        this_nvram += std::to_string(instance);
+    }
+
+    emu.Init({.lcd_backend = nullptr, .nvram_filename = this_nvram});
+
+    RomLocationSet loaded{};
+    if (!emu.LoadRoms(context.romset, context.romset_info, &loaded))
+    {
+        fprintf(stderr, "FATAL: Failed to load roms for instance #%02zu\n", instance);
+        return false;
+    }
+
+    emu.Reset();
+    emu.GetPCM().enable_oversampling = !params.disable_oversampling;
+    emu.GetPCM().enable_idle_bypass = params.idle_bypass;
+
+    return true;
+}
+
+// Returns the peak resident set size of the process in bytes, or 0 if it can't be determined.
+size_t R_PeakRSSBytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+#ifdef __APPLE__
+    return (size_t)usage.ru_maxrss;
+#else
+    // Linux and the BSDs report kilobytes.
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+// Prints one line of --progress-json output. `type` is "progress" while rendering and "summary" once every output has
+// been written; the summary also includes per-instance queue statistics. `base_ns` is the song position each instance
+// started this render at, so that resumed renders report the speed of the work actually done.
+void R_PrintProgressJson(const char*               type,
+                         double                    elapsed_sec,
+                         const R_MixOutState&      mix_out_state,
+                         const R_TrackRenderState* render_states,
+                         const uint64_t*           base_ns,
+                         size_t                    instances,
+                         const R_Mixer&            mixer,
+                         uint32_t                  sample_rate)
+{
+    const bool   summary      = strcmp(type, "summary") == 0;
+    const size_t frames_mixed = mix_out_state.frames_mixed.load();
+    const double mixed_sec    = (double)frames_mixed / (double)sample_rate;
+
+    fprintf(stderr,
+            "{\"type\":\"%s\",\"elapsed_sec\":%.3f,\"frames_mixed\":%zu,\"mixed_sec\":%.3f,\"realtime_factor\":%.3f,"
+            "\"peak_rss_bytes\":%zu,\"instances\":[",
+            type,
+            elapsed_sec,
+            frames_mixed,
+            mixed_sec,
+            elapsed_sec > 0.0 ? mixed_sec / elapsed_sec : 0.0,
+            R_PeakRSSBytes());
+
+    for (size_t i = 0; i < instances; ++i)
+    {
+        const R_TrackRenderState& state        = render_states[i];
+        const R_ChunkQueue&       queue        = mixer.GetQueue(i);
+        const uint64_t            ns           = state.ns_progress.load(std::memory_order_relaxed);
+        const double              emulated_sec = (double)ns / 1e9;
+        const double              worked_sec   = (double)(ns - std::min(ns, base_ns[i])) / 1e9;
+
+        fprintf(stderr,
+                "%s{\"instance\":%zu,\"events_processed\":%zu,\"event_count\":%zu,\"emulated_sec\":%.3f,"
+                "\"realtime_factor\":%.3f,\"queued_chunks\":%zu,\"done\":%s",
+                i ? "," : "",
+                i,
+                state.events_processed.load(),
+                state.event_count,
+                emulated_sec,
+                elapsed_sec > 0.0 ? worked_sec / elapsed_sec : 0.0,
+                queue.ChunkCount(),
+                state.done ? "true" : "false");
+
+        if (summary)
+        {
+            fprintf(stderr,
+                    ",\"frames_written\":%zu,\"peak_queued_chunks\":%zu,\"allocated_chunks\":%zu,\"producer_stalls\":%zu",
+                    mixer.GetFramesWritten(i),
+                    queue.GetPeakChunkCount(),
+                    queue.GetAllocatedChunkCount(),
+                    queue.GetProducerStallCount());
+        }
+
+        fprintf(stderr, "}");
+    }
+
+    fprintf(stderr, "]}\n");
+    fflush(stderr);
+}
+
+bool R_RenderSong(const SMF_Data&       data,
+                  const R_RenderPlan&   plan,
+                  const R_Parameters&   params,
+                  std::span<Emulator>   emulators,
+                  bool                  quiet,
+                  const R_OutputStream& stream,
+                  R_CheckpointStore*    checkpoints)
+{
+    const auto t_render_start = std::chrono::high_resolution_clock::now();
+    const auto seconds_elapsed = [t_render_start] {
+        const auto t_diff = std::chrono::high_resolution_clock::now() - t_render_start;
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(t_diff).count() / 1e9;
+    };
+
+    const size_t instances = plan.instances;
+    const std::vector<uint8_t>& stem_channels = plan.stem_channels;
+
+    // With multiple outputs, instances render S32 without gain so that each output can apply its own gain to the
+    // unclipped mix and convert it to its own format. --normalize-lufs does the same with F32, but spools the mix until
+    // its loudness is known.
+    const bool        normalize     = params.normalize_lufs.has_value() && !stream.file;
+    const bool        fan_out       = (params.outputs.size() > 1 || normalize) && !stream.file;
+    const AudioFormat mix_format    = normalize ? AudioFormat::F32 : fan_out ? AudioFormat::S32 : params.output_format;
+    const float       instance_gain = fan_out ? 1.0f : params.gain;
+
+    // Batch jobs only set `output_filename`.
+    std::vector<R_OutputSpec> output_specs = params.outputs;
+    if (output_specs.empty())
+    {
+        output_specs.push_back({.filename             = params.output_filename,
+                                .format               = params.output_format,
+                                .container            = params.output_container,
+                                .flac_bits_per_sample = params.flac_bits_per_sample,
+                                .gain                 = params.gain});
+    }
+
+    R_Mixer mixer;
+    switch (mix_format)
+    {
+    case AudioFormat::S16:
+        mixer.SetQueueCount<int16_t>(instances, params.max_queued_chunks);
+        break;
+    case AudioFormat::S32:
+        mixer.SetQueueCount<int32_t>(instances, params.max_queued_chunks);
+        break;
+    case AudioFormat::F32:
+        mixer.SetQueueCount<float>(instances, params.max_queued_chunks);
+        break;
+    }
+
+    const uint32_t native_rate = PCM_GetOutputFrequency(emulators[0].GetPCM());
+    const uint32_t output_rate = params.output_rate ? params.output_rate : native_rate;
+    const bool     resample    = output_rate != native_rate;
+
+    R_OutputFile render_output;
+    std::vector<R_OutputFile> fan_outputs;
+    if (fan_out)
+    {
+        fan_outputs.resize(output_specs.size());
+        for (size_t i = 0; i < output_specs.size(); ++i)
+        {
+            const R_OutputSpec& spec = output_specs[i];
+            if (!fan_outputs[i].Open(spec.filename, spec.format, spec.container, spec.flac_bits_per_sample))
+            {
+                fprintf(stderr, "Failed to open %s for writing\n", std::string(spec.filename).c_str());
+                return false;
+            }
+            // With --normalize-lufs the gain is printed once it is known.
+            if (!quiet && !normalize)
+            {
+                fprintf(stderr,
+                        "Writing %s with gain %.2fdb\n",
+                        std::string(spec.filename).c_str(),
+                        common::ScalarToDb(spec.gain));
+            }
+        }
+    }
+    else if (stream.file)
+    {
+        render_output.SetSampleRate(output_rate);
+        render_output.OpenStream(stream.file, params.output_format, stream.wav_header);
+    }
+    else if (params.output_stdout)
+    {
+#ifdef _WIN32
+        // On Windows, stdout is opened in text mode, which causes newline translation to occur.
+        _setmode(_fileno(stdout), O_BINARY);
+#endif
+        render_output.OpenStdout(params.output_format);
+    }
+    else if (!render_output.Open(params.output_filename,
+                                 params.output_format,
+                                 params.output_container,
+                                 params.flac_bits_per_sample))
+    {
+        fprintf(stderr, "Failed to open %s for writing\n", std::string(params.output_filename).c_str());
+        return false;
+    }
+
+    std::vector<R_OutputFile> stem_outputs(stem_channels.size());
+    for (size_t i = 0; i < stem_channels.size(); ++i)
+    {
+        const std::filesystem::path stem_path = R_StemPath(params.output_filename, stem_channels[i]);
+        fprintf(stderr, "Writing channel %d stem to %s\n", stem_channels[i] + 1, stem_path.generic_string().c_str());
+        if (!stem_outputs[i].Open(
+                stem_path, params.output_format, params.output_container, params.flac_bits_per_sample))
+        {
+            fprintf(stderr, "Failed to open %s for writing\n", stem_path.generic_string().c_str());
+            return false;
+        }
+    }
+
+    R_LoudnessSpool spool;
+    if (normalize && !spool.Open(native_rate))
+    {
+        fprintf(stderr, "Failed to create a temporary file for --normalize-lufs\n");
+        return false;
+    }
+
+    R_LoopPointRecorder loop_recorder;
+
+    std::atomic<bool> stream_failed = false;
+
+    R_TrackRenderState render_states[R_MAX_INSTANCES];
+    uint64_t progress_base_ns[R_MAX_INSTANCES];
+    for (size_t i = 0; i < instances; ++i)
+    {
+        render_states[i].emu = &emulators[i];
+        render_states[i].router = &plan.router;
+        render_states[i].event_count = plan.event_counts[i];
+        render_states[i].mixer = &mixer;
+        render_states[i].queue_id = i;
+        render_states[i].end_behavior = params.end_behavior;
+        render_states[i].loop_recorder = &loop_recorder;
+        render_states[i].output_format = mix_format;
+        render_states[i].gain = instance_gain;
+        render_states[i].start_ns = params.from_ns;
+        render_states[i].end_ns = params.to_ns;
+        if (stream.file)
+        {
+            render_states[i].cancel = &stream_failed;
+        }
+
+        if (checkpoints)
+        {
+            const R_CheckpointPosition& position = checkpoints->GetRestoredPosition(i);
+            const uint64_t interval_ns = checkpoints->GetIntervalNS();
+            render_states[i].checkpoints = checkpoints;
+            render_states[i].ns_simulated = position.ns;
+            render_states[i].first_event = position.next_event;
+            render_states[i].events_processed = position.events_processed;
+            render_states[i].next_checkpoint_ns = (position.ns / interval_ns + 1) * interval_ns;
+        }
+
+        if (plan.loop)
+        {
+            // The file wraps around at the loop end, so the sound still ringing there is heard at the loop start
+            // instead of being released
+            render_states[i].end_behavior = R_EndBehavior::Cut;
+            render_states[i].loop_start_event = plan.loop->start_event;
+            render_states[i].loop_end_event = plan.loop->end_event;
+            render_states[i].loop_start_ns = plan.loop->start_ns;
+            render_states[i].loop_end_ns = plan.loop->end_ns;
+        }
+
+        progress_base_ns[i] = render_states[i].ns_simulated;
+        render_states[i].ns_progress = render_states[i].ns_simulated;
+
+        render_states[i].discarding = render_states[i].ns_simulated < render_states[i].start_ns;
+        if (render_states[i].discarding)
+        {
+            render_states[i].emu->SetSampleCallback(R_DiscardSample, &render_states[i]);
+        }
+        else
+        {
+            render_states[i].emu->SetSampleCallback(R_PickCallback<R_SilenceModelNone>(render_states[i]),
+                                                    &render_states[i]);
+        }
+
+        render_states[i].thread = std::thread(R_RenderOne, std::cref(data), std::ref(render_states[i]));
+    }
+
+    common::Resampler resampler;
+    std::vector<common::Resampler> stem_resamplers;
+    std::vector<common::Resampler> fan_resamplers;
+    if (resample)
+    {
+        if (!quiet)
+        {
+            fprintf(stderr, "Converting output from %" PRIu32 " Hz to %" PRIu32 " Hz\n", native_rate, output_rate);
+        }
+        resampler.Init(native_rate, output_rate);
+        stem_resamplers.resize(stem_channels.size());
+        for (auto& stem_resampler : stem_resamplers)
+        {
+            stem_resampler.Init(native_rate, output_rate);
+        }
+        fan_resamplers.resize(fan_outputs.size());
+        for (auto& fan_resampler : fan_resamplers)
+        {
+            fan_resampler.Init(native_rate, output_rate);
+        }
+    }
+
+    render_output.SetSampleRate(output_rate);
+    for (auto& fan_output : fan_outputs)
+    {
+        fan_output.SetSampleRate(output_rate);
+    }
+    for (auto& stem_output : stem_outputs)
+    {
+        stem_output.SetSampleRate(output_rate);
+    }
+
+    R_MixOutState mix_out_state;
+    mix_out_state.mixer = &mixer;
+    mix_out_state.output = &render_output;
+    if (params.stems)
+    {
+        mix_out_state.stem_outputs = stem_outputs.data();
+    }
+    if (resample)
+    {
+        mix_out_state.resampler       = &resampler;
+        mix_out_state.stem_resamplers = stem_resamplers.data();
+    }
+    if (plan.loop)
+    {
+        mix_out_state.loop = &render_states[0].loop_frames;
+    }
+    if (stream.file)
+    {
+        mix_out_state.stream = stream.file;
+        mix_out_state.cancel = &stream_failed;
+    }
+    std::thread mix_out_thread;
+
+    std::unique_ptr<R_FanOutWriter<int64_t>[]> fan_writers;
+    if (normalize)
+    {
+        mix_out_thread = std::thread(R_MixOutSpool, std::ref(mix_out_state), std::ref(spool));
+    }
+    else if (fan_out)
+    {
+        fan_writers = std::make_unique<R_FanOutWriter<int64_t>[]>(fan_outputs.size());
+        for (size_t i = 0; i < fan_outputs.size(); ++i)
+        {
+            fan_writers[i].Start(fan_outputs[i],
+                                 output_specs[i].format,
+                                 output_specs[i].gain,
+                                 resample ? &fan_resamplers[i] : nullptr,
+                                 mix_out_state.loop);
+        }
+        mix_out_thread = std::thread(R_MixOutFanOut,
+                                     std::ref(mix_out_state),
+                                     std::span<R_FanOutWriter<int64_t>>(fan_writers.get(), fan_outputs.size()));
+    }
+    else
+    {
+        switch (params.output_format)
+        {
+        case AudioFormat::S16:
+            mix_out_thread = std::thread(R_MixOut<int16_t>, std::ref(mix_out_state));
+            break;
+        case AudioFormat::S32:
+            mix_out_thread = std::thread(R_MixOut<int32_t>, std::ref(mix_out_state));
+            break;
+        case AudioFormat::F32:
+            mix_out_thread = std::thread(R_MixOut<float>, std::ref(mix_out_state));
+            break;
+        }
+    }
+
+    // Now we wait. --progress-json prints a JSON line every second; otherwise the status display is redrawn.
+    bool all_done = quiet;
+    while (!all_done && params.progress_json)
+    {
+        std::this_thread::sleep_for(1000ms);
+
+        all_done = std::all_of(render_states, render_states + instances, [](const R_TrackRenderState& state) {
+            return state.done.load();
+        });
+
+        R_PrintProgressJson("progress",
+                            seconds_elapsed(),
+                            mix_out_state,
+                            render_states,
+                            progress_base_ns,
+                            instances,
+                            mixer,
+                            native_rate);
+    }
+    while (!all_done)
+    {
+        all_done = true;
+
+        fprintf(stderr, "Rendered %zu frames\n", mix_out_state.frames_mixed.load());
+
+        for (size_t i = 0; i < instances; ++i)
+        {
+            if (!render_states[i].done)
+            {
+                all_done = false;
+            }
+
+            const size_t processed    = render_states[i].events_processed;
+            const size_t total        = render_states[i].event_count;
+            const float  percent_done = 100.f * (float)processed / (float)total;
+
+            fprintf(stderr, "#%02zu %6.2f%% [%zu / %zu]\n", i, percent_done, processed, total);
+        }
+
+        if (!all_done)
+        {
+            R_CursorUpLines(RangeCast<int>(1 + instances));
+        }
+
+        std::this_thread::sleep_for(1000ms);
+    }
+
+    for (size_t i = 0; i < instances; ++i)
+    {
+        render_states[i].thread.join();
+    }
+
+    mix_out_thread.join();
+
+    if (normalize)
+    {
+        if (!spool.Finish())
+        {
+            fprintf(stderr, "Failed to write temporary file for --normalize-lufs\n");
+            return false;
+        }
+
+        // Measured in F32 units; each output's loudness depends on its full scale.
+        const double loudness  = spool.GetMeter().GetIntegratedLoudness();
+        const double true_peak = common::ScalarToDb(spool.GetMeter().GetTruePeak());
+
+        auto spool_writers = std::make_unique<R_FanOutWriter<float>[]>(fan_outputs.size());
+        for (size_t i = 0; i < fan_outputs.size(); ++i)
+        {
+            const R_OutputSpec& spec       = output_specs[i];
+            const double        full_scale = 20.0 * std::log10(R_FullScale(spec.format));
+
+            // Silence has no loudness; leave it alone rather than amplifying the noise floor without bound.
+            const double normalize_db = std::isinf(loudness) ? 0.0 : *params.normalize_lufs - (loudness - full_scale);
+            const double gain_db      = normalize_db + common::ScalarToDb(spec.gain);
+            const double peak_db      = true_peak - full_scale + gain_db;
+
+            if (!quiet)
+            {
+                fprintf(stderr,
+                        "Writing %s with gain %.2fdb (%.2f LUFS, true peak %.2f dBTP)\n",
+                        std::string(spec.filename).c_str(),
+                        gain_db,
+                        loudness - full_scale + gain_db,
+                        peak_db);
+                if (peak_db > 0.0 && spec.format != AudioFormat::F32)
+                {
+                    fprintf(stderr, "warning: %s will clip\n", std::string(spec.filename).c_str());
+                }
+            }
+
+            spool_writers[i].Start(fan_outputs[i],
+                                   spec.format,
+                                   common::DbToScalar((float)gain_db),
+                                   resample ? &fan_resamplers[i] : nullptr,
+                                   mix_out_state.loop);
+        }
+        R_WriteSpool(spool,
+                     mixer.GetChunkSize(),
+                     std::span<R_FanOutWriter<float>>(spool_writers.get(), fan_outputs.size()));
+    }
+
+    switch (params.output_format)
+    {
+    case AudioFormat::S16:
+        R_FinishStems<int16_t>(mix_out_state, stem_outputs.size());
+        break;
+    case AudioFormat::S32:
+        R_FinishStems<int32_t>(mix_out_state, stem_outputs.size());
+        break;
+    case AudioFormat::F32:
+        R_FinishStems<float>(mix_out_state, stem_outputs.size());
+        break;
+    }
+
+    if (params.dump_emidi_loop_points)
+    {
+        loop_recorder.SortByTrack();
+
+        fprintf(stderr, "rate=%zu\n", (size_t)output_rate);
+
+        std::string time_str;
+        for (auto point : loop_recorder.GetLoopPoints())
+        {
+            if (resample)
+            {
+                point.frame = resampler.ConvertFramePosition(point.frame);
+            }
+
+            R_NsToTimeString(point.timestamp_ns, time_str);
+            switch (point.type)
+            {
+            case R_LoopPointType::TrackStart:
+                fprintf(stderr,
+                        "track %d loop start at sample=%" PRIu64 " timestamp=%s\n",
+                        point.midi_track,
+                        point.frame,
+                        time_str.c_str());
+                break;
+            case R_LoopPointType::TrackEnd:
+                fprintf(stderr,
+                        "track %d loop end at sample=%" PRIu64 " timestamp=%s\n",
+                        point.midi_track,
+                        point.frame,
+                        time_str.c_str());
+                break;
+            case R_LoopPointType::GlobalStart:
+                fprintf(
+                    stderr, "global loop start at sample=%" PRIu64 " timestamp=%s\n", point.frame, time_str.c_str());
+                break;
+            case R_LoopPointType::GlobalEnd:
+                fprintf(stderr, "global loop end at sample=%" PRIu64 " timestamp=%s\n", point.frame, time_str.c_str());
+                break;
+            }
+        }
+    }
+
+    if (params.debug)
+    {
+        for (size_t i = 0; i < instances; ++i)
+        {
+            auto t_instance_sec = (double)render_states[i].elapsed.count() / 1e9;
+            fprintf(params.debug_output,
+                    "#%02zu took %.2fs, rendered %zu frames\n",
+                    i,
+                    t_instance_sec,
+                    mixer.GetFramesWritten(i));
+        }
+
+        constexpr double MIB = 1024.0 * 1024.0;
+
+        size_t total_allocated = 0;
+        for (size_t i = 0; i < instances; ++i)
+        {
+            const R_ChunkQueue& queue = mixer.GetQueue(i);
+            fprintf(params.debug_output,
+                    "#%02zu peak queued %zu chunks (%.2f MiB), allocated %zu chunks (%.2f MiB), stalled %zu times\n",
+                    i,
+                    queue.GetPeakChunkCount(),
+                    (double)(queue.GetPeakChunkCount() * mixer.GetChunkSizeBytes()) / MIB,
+                    queue.GetAllocatedChunkCount(),
+                    (double)(queue.GetAllocatedChunkCount() * mixer.GetChunkSizeBytes()) / MIB,
+                    queue.GetProducerStallCount());
+            total_allocated += queue.GetAllocatedChunkCount();
+        }
+        fprintf(params.debug_output,
+                "Peak audio buffer memory: %.2f MiB\n",
+                (double)(total_allocated * mixer.GetChunkSizeBytes()) / MIB);
+    }
+
+    if (params.progress_json && !quiet)
+    {
+        R_PrintProgressJson("summary",
+                            seconds_elapsed(),
+                            mix_out_state,
+                            render_states,
+                            progress_base_ns,
+                            instances,
+                            mixer,
+                            native_rate);
+    }
+
+    return true;
+}
+
+bool R_RenderTrack(const SMF_Data& data, const R_Parameters& params)
+{
+    auto t_start = std::chrono::high_resolution_clock::now();
+
+    const R_RenderPlan plan = R_PlanRender(data, params);
+    if (params.emidi_loop && !plan.loop)
+    {
+        fprintf(stderr, "FATAL: --emidi-loop was passed, but the song has no EMIDI loop (CC 116/117 or 118/119)\n");
+        return false;
+    }
+
+    R_RomContext context;
+    if (!R_LoadRomContext(params, context))
+    {
+        return false;
+    }
+
+    if (params.outputs.size() <= 1)
+    {
+        fprintf(stderr, "Gain set to %.2fdb\n", common::ScalarToDb(params.gain));
+    }
+
+    std::vector<Emulator> emulators(plan.instances);
+    for (size_t i = 0; i < plan.instances; ++i)
+    {
+        if (!R_InitEmulator(emulators[i], context, params, i))
+        {
+            return false;
+        }
+    }
+
+    R_CheckpointStore checkpoints;
+    bool              restored = false;
+    if (!params.checkpoint_directory.empty())
+    {
+        const std::filesystem::path directory =
+            params.checkpoint_directory / R_CheckpointKey(data, context, params, plan);
+        checkpoints.Open(directory, plan.instances, params.checkpoint_interval_ns);
+
+        restored = checkpoints.Restore(params.from_ns, emulators);
+        if (restored)
+        {
+            std::string time_str;
+            R_NsToTimeString(checkpoints.GetRestoredPosition(0).ns, time_str);
+            fprintf(stderr, "Resuming from checkpoint at %s\n", time_str.c_str());
+        }
+    }
+
+    if (!restored)
+    {
+        for (size_t i = 0; i < plan.instances; ++i)
+        {
+            fprintf(stderr, "Initializing emulator #%02zu...\n", i);
+            R_RunReset(emulators[i], context.reset);
+        }
+    }
+
+    context.romset_info.PurgeRomData();
+
+    if (!R_RenderSong(data,
+                      plan,
+                      params,
+                      emulators,
+                      false,
+                      {},
+                      params.checkpoint_directory.empty() ? nullptr : &checkpoints))
+    {
+        return false;
+    }
+
+    auto t_finish = std::chrono::high_resolution_clock::now();
+    auto t_diff   = std::chrono::duration_cast<std::chrono::nanoseconds>(t_finish - t_start);
+    auto t_sec    = (double)t_diff.count() / 1e9;
+
+    fprintf(stderr, "Done in %.2fs!\n", t_sec);
+
+    return true;
+}
@@ -0,0 +1,117 @@
+// Rendering a song with one or more emulator instances and mixing them into the
+// requested outputs.
+
+#pragma once
+
+#include "checkpoint.h"
+#include "emu.h"
+#include "params.h"
+#include "smf.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "common/rom_loader.h"
+
+// Maps each MIDI channel to the index of the emulator instance that will play it.
+using R_ChannelMap = std::array<size_t, SMF_CHANNEL_COUNT>;
+
+// Bit N is set if instance N plays an event.
+using R_InstanceMask = uint64_t;
+static_assert(R_MAX_INSTANCES <= 64, "R_InstanceMask needs a bit per instance");
+
+// Mask with a bit for each of `n` instances.
+constexpr R_InstanceMask R_AllInstances(size_t n)
+{
+    return n >= 64 ? ~R_InstanceMask{} : (R_InstanceMask{1} << n) - 1;
+}
+
+// Decides which instances play each event of the merged track, in the order produced by SMF_TrackMerger. Instances
+// merge the file's tracks themselves and skip events that aren't theirs, so events are never copied per instance.
+struct R_EventRouter
+{
+    size_t       instances = 1;
+    R_ChannelMap channel_map{};
+    // Only set for voice routing: instances that play the merged event at each index.
+    std::vector<R_InstanceMask> voice_masks;
+
+    R_InstanceMask GetInstanceMask(size_t index, const SMF_Event& event) const
+    {
+        if (!voice_masks.empty())
+        {
+            return voice_masks[index];
+        }
+        // System events need to be processed by all emulators
+        if (event.IsSystem())
+        {
+            return R_AllInstances(instances);
+        }
+        return R_InstanceMask{1} << channel_map[event.GetChannel()];
+    }
+};
+
+// Merged event indices of the EMIDI loop markers rendered by --emidi-loop.
+struct R_EMIDILoop
+{
+    size_t   start_event;
+    size_t   end_event;
+    uint64_t start_ns;
+    uint64_t end_ns;
+};
+
+// Decides which events each emulator instance plays.
+struct R_RenderPlan
+{
+    size_t        instances = 0;
+    R_EventRouter router;
+    // Number of events each instance plays.
+    std::vector<size_t> event_counts;
+    // Channels that get their own stem, in instance order. Empty unless rendering stems.
+    std::vector<uint8_t> stem_channels;
+    // Only set for --emidi-loop, and only if the song has a loop.
+    std::optional<R_EMIDILoop> loop;
+};
+
+// Roms and settings shared by every emulator in the process.
+struct R_RomContext
+{
+    AllRomsetInfo   romset_info;
+    Romset          romset = Romset::MK2;
+    EMU_SystemReset reset  = EMU_SystemReset::NONE;
+};
+
+// Destination for R_RenderSong other than the files named in the parameters.
+struct R_OutputStream
+{
+    FILE* file = nullptr;
+    // Precede the samples with a WAVE header for a stream of unknown length.
+    bool wav_header = false;
+};
+
+R_RenderPlan R_PlanRender(const SMF_Data& data, const R_Parameters& params);
+
+bool R_LoadRomContext(const R_Parameters& params, R_RomContext& context);
+
+// Initializes `emu` and loads roms into it, but doesn't boot it.
+bool R_InitEmulator(Emulator& emu, const R_RomContext& context, const R_Parameters& params, size_t instance);
+
+void R_RunReset(Emulator& emu, EMU_SystemReset reset);
+
+// Renders `data` with `emulators`, which must already be booted, according to `plan`. Output goes to `stream` if it is
+// set, otherwise to the files or stream named in `params`. When `quiet` is set, progress and informational messages are
+// not printed. If `checkpoints` is set, instances resume from its restored position and save checkpoints as they go.
+bool R_RenderSong(const SMF_Data&       data,
+                  const R_RenderPlan&   plan,
+                  const R_Parameters&   params,
+                  std::span<Emulator>   emulators,
+                  bool                  quiet,
+                  const R_OutputStream& stream      = {},
+                  R_CheckpointStore*    checkpoints = nullptr);
+
+// Renders `data` to the outputs named in `params`, loading roms and booting emulators first.
+bool R_RenderTrack(const SMF_Data& data, const R_Parameters& params);
@@ -0,0 +1,541 @@
+#include "serve.h"
+
+#ifndef _WIN32
+#include "render.h"
+#include "smf.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <poll.h>
+#include <span>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "common/command_line.h"
+#include "common/gain.h"
+
+// Largest MIDI file a client may send.
+constexpr size_t R_SERVE_MAX_PAYLOAD = 64 * 1024 * 1024;
+// Longest request line a client may send.
+constexpr size_t R_SERVE_MAX_LINE = 4096;
+// Time a client has to send its whole request, including the MIDI file, before it is disconnected.
+constexpr std::chrono::seconds R_SERVE_REQUEST_TIMEOUT{30};
+
+// Booted emulator sets shared by all connections. A connection holds one slot from the moment it is accepted until its
+// render is done, so the number of slots bounds both how many songs render at once and how many MIDI files are held in
+// memory.
+class R_ServerPool
+{
+public:
+    void Init(size_t slot_count)
+    {
+        m_slots.resize(slot_count);
+        for (size_t i = 0; i < slot_count; ++i)
+        {
+            m_free.push_back(i);
+        }
+    }
+
+    std::vector<Emulator>& GetSlot(size_t slot)
+    {
+        return m_slots[slot];
+    }
+
+    size_t GetSlotCount() const
+    {
+        return m_slots.size();
+    }
+
+    // Returns a free slot, or nothing if every slot is taken.
+    std::optional<size_t> TryAcquire()
+    {
+        std::scoped_lock lock(m_mutex);
+        if (m_free.empty())
+        {
+            return std::nullopt;
+        }
+        const size_t slot = m_free.back();
+        m_free.pop_back();
+        return slot;
+    }
+
+    void Release(size_t slot)
+    {
+        std::scoped_lock lock(m_mutex);
+        m_free.push_back(slot);
+    }
+
+private:
+    std::vector<std::vector<Emulator>> m_slots;
+    std::vector<size_t>                m_free;
+    std::mutex                         m_mutex;
+};
+
+struct R_ServeRequest
+{
+    size_t       payload_size = 0;
+    bool         wav_header   = true;
+    R_Parameters params;
+};
+
+// Parses `RENDER <size> [key=value...]`. Options not given keep the value from the server's command line.
+static bool R_ParseServeRequest(std::string_view line, R_ServeRequest& request, std::string& error)
+{
+    std::vector<std::string_view> tokens;
+    while (!line.empty())
+    {
+        const size_t end = line.find(' ');
+        if (end != 0)
+        {
+            tokens.push_back(line.substr(0, end));
+        }
+        line.remove_prefix(end == std::string_view::npos ? line.size() : end + 1);
+    }
+
+    if (tokens.size() < 2 || tokens[0] != "RENDER")
+    {
+        error = "expected RENDER <size>";
+        return false;
+    }
+
+    if (!common::TryParse(tokens[1], request.payload_size) || request.payload_size == 0 ||
+        request.payload_size > R_SERVE_MAX_PAYLOAD)
+    {
+        error = "size must be 1-" + std::to_string(R_SERVE_MAX_PAYLOAD);
+        return false;
+    }
+
+    R_Parameters& params = request.params;
+    for (size_t i = 2; i < tokens.size(); ++i)
+    {
+        const size_t equals = tokens[i].find('=');
+        if (equals == std::string_view::npos)
+        {
+            error = "expected key=value, got " + std::string(tokens[i]);
+            return false;
+        }
+
+        const std::string_view key   = tokens[i].substr(0, equals);
+        const std::string_view value = tokens[i].substr(equals + 1);
+
+        bool valid = true;
+        if (key == "format")
+        {
+            if (value == "s16")
+            {
+                params.output_format = AudioFormat::S16;
+            }
+            else if (value == "s32")
+            {
+                params.output_format = AudioFormat::S32;
+            }
+            else if (value == "f32")
+            {
+                params.output_format = AudioFormat::F32;
+            }
+            else
+            {
+                valid = false;
+            }
+        }
+        else if (key == "end")
+        {
+            if (value == "cut")
+            {
+                params.end_behavior = R_EndBehavior::Cut;
+            }
+            else if (value == "release")
+            {
+                params.end_behavior = R_EndBehavior::Release;
+            }
+            else
+            {
+                valid = false;
+            }
+        }
+        else if (key == "header")
+        {
+            if (value == "wav")
+            {
+                request.wav_header = true;
+            }
+            else if (value == "none")
+            {
+                request.wav_header = false;
+            }
+            else
+            {
+                valid = false;
+            }
+        }
+        else if (key == "rate")
+        {
+            if (value == "native")
+            {
+                params.output_rate = 0;
+            }
+            else
+            {
+                valid = common::TryParse(value, params.output_rate) && params.output_rate >= 8000 &&
+                        params.output_rate <= 384000;
+            }
+        }
+        else if (key == "gain")
+        {
+            valid = common::ParseGain(value, params.gain) == common::ParseGainResult{};
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if (!valid)
+        {
+            error = "invalid option " + std::string(tokens[i]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+using R_ServeDeadline = std::chrono::steady_clock::time_point;
+
+// Waits until `fd` has data to read or has been closed. Returns false if `deadline` passes first.
+static bool R_WaitReadable(int fd, R_ServeDeadline deadline)
+{
+    while (true)
+    {
+        const auto remaining =
+            std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        pollfd poll_fd{};
+        poll_fd.fd     = fd;
+        poll_fd.events = POLLIN;
+        const int result = poll(&poll_fd, 1, (int)std::clamp<int64_t>(remaining.count(), 0, INT32_MAX));
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        return result > 0;
+    }
+}
+
+static bool R_ReadExact(int fd, uint8_t* buffer, size_t size, R_ServeDeadline deadline)
+{
+    while (size)
+    {
+        if (!R_WaitReadable(fd, deadline))
+        {
+            return false;
+        }
+        const ssize_t result = read(fd, buffer, size);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            return false;
+        }
+        buffer += result;
+        size -= (size_t)result;
+    }
+    return true;
+}
+
+// Reads up to and not including the next newline. Bytes after it are left in the socket.
+static bool R_ReadLine(int fd, std::string& line, R_ServeDeadline deadline)
+{
+    line.clear();
+    while (line.size() < R_SERVE_MAX_LINE)
+    {
+        uint8_t c;
+        if (!R_ReadExact(fd, &c, 1, deadline))
+        {
+            return false;
+        }
+        if (c == '\n')
+        {
+            return true;
+        }
+        line.push_back((char)c);
+    }
+    return false;
+}
+
+static void R_WriteAll(int fd, std::string_view text)
+{
+    while (!text.empty())
+    {
+        const ssize_t result = write(fd, text.data(), text.size());
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            return;
+        }
+        text.remove_prefix((size_t)result);
+    }
+}
+
+// Sends an error reply. Unread request bytes are then drained, until `deadline` or until no more than a full request has
+// been read, since closing a socket with unread data resets the connection and the client might never see the reply.
+static void R_RejectConnection(int fd, const std::string& error, R_ServeDeadline deadline)
+{
+    R_WriteAll(fd, "ERROR " + error + "\n");
+    shutdown(fd, SHUT_WR);
+
+    uint8_t buffer[4096];
+    size_t  drained = 0;
+    while (drained < R_SERVE_MAX_LINE + R_SERVE_MAX_PAYLOAD && R_WaitReadable(fd, deadline))
+    {
+        const ssize_t result = read(fd, buffer, sizeof(buffer));
+        if (result <= 0)
+        {
+            break;
+        }
+        drained += (size_t)result;
+    }
+}
+
+// Handles a single request on `fd` with the emulators of the slot it was given. The request must arrive within
+// R_SERVE_REQUEST_TIMEOUT. `fd` is left open so that the caller can release the slot before the client sees the
+// connection close.
+static void R_ServeConnection(int                 fd,
+                              size_t              request_id,
+                              const R_Parameters& server_params,
+                              std::span<Emulator> emulators,
+                              const EMU_State&    boot_state)
+{
+    auto t_start = std::chrono::high_resolution_clock::now();
+
+    const R_ServeDeadline deadline = std::chrono::steady_clock::now() + R_SERVE_REQUEST_TIMEOUT;
+
+    R_ServeRequest request;
+    request.params = server_params;
+
+    std::string error;
+    std::string line;
+    if (!R_ReadLine(fd, line, deadline))
+    {
+        fprintf(stderr, "Request #%zu: no request received\n", request_id);
+        return;
+    }
+
+    if (!R_ParseServeRequest(line, request, error))
+    {
+        fprintf(stderr, "Request #%zu rejected: %s\n", request_id, error.c_str());
+        R_RejectConnection(fd, error, deadline);
+        return;
+    }
+
+    std::vector<uint8_t> bytes(request.payload_size);
+    if (!R_ReadExact(fd, bytes.data(), bytes.size(), deadline))
+    {
+        fprintf(stderr, "Request #%zu: client disconnected or timed out\n", request_id);
+        return;
+    }
+
+    SMF_Data data;
+    if (!SMF_LoadEventsFromBytes(std::move(bytes), data, error))
+    {
+        fprintf(stderr, "Request #%zu rejected: %s\n", request_id, error.c_str());
+        R_RejectConnection(fd, "couldn't load MIDI: " + error, deadline);
+        return;
+    }
+
+    const R_RenderPlan plan = R_PlanRender(data, request.params);
+
+    bool restored = true;
+    for (Emulator& emu : emulators)
+    {
+        restored = restored && emu.LoadState(boot_state);
+    }
+
+    if (!restored)
+    {
+        fprintf(stderr, "Request #%zu failed: couldn't restore emulator state\n", request_id);
+        R_RejectConnection(fd, "couldn't restore emulator state", deadline);
+        return;
+    }
+
+    R_WriteAll(fd, "OK\n");
+
+    // The FILE gets a descriptor of its own, so closing it doesn't close the connection.
+    const int output_fd = dup(fd);
+    FILE*     output    = output_fd < 0 ? nullptr : fdopen(output_fd, "wb");
+    if (!output)
+    {
+        if (output_fd >= 0)
+        {
+            close(output_fd);
+        }
+        return;
+    }
+
+    R_RenderSong(data, plan, request.params, emulators, true, {.file = output, .wav_header = request.wav_header});
+
+    const bool write_failed = ferror(output) != 0;
+    fclose(output);
+
+    const auto   t_diff = std::chrono::high_resolution_clock::now() - t_start;
+    const double t_sec  = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(t_diff).count() / 1e9;
+    if (write_failed)
+    {
+        fprintf(stderr, "Request #%zu: client disconnected, render stopped after %.2fs\n", request_id, t_sec);
+    }
+    else
+    {
+        fprintf(stderr, "Request #%zu done in %.2fs\n", request_id, t_sec);
+    }
+}
+
+bool R_Serve(const R_Parameters& params)
+{
+    const std::string socket_path = params.serve_path.generic_string();
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Socket path %s is too long\n", socket_path.c_str());
+        return false;
+    }
+    memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    R_RomContext context;
+    if (!R_LoadRomContext(params, context))
+    {
+        return false;
+    }
+
+    fprintf(stderr, "Gain set to %.2fdb\n", common::ScalarToDb(params.gain));
+
+    // Every request starts from the state of a freshly booted emulator.
+    fprintf(stderr, "Initializing emulator...\n");
+    EMU_State boot_state;
+    {
+        Emulator boot;
+        if (!R_InitEmulator(boot, context, params, 0))
+        {
+            return false;
+        }
+        R_RunReset(boot, context.reset);
+        boot.SaveState(boot_state);
+    }
+
+    size_t slot_count = params.jobs;
+    if (slot_count == 0)
+    {
+        slot_count = std::max<size_t>(1, std::thread::hardware_concurrency() / params.instances);
+    }
+
+    R_ServerPool pool;
+    pool.Init(slot_count);
+    for (size_t slot = 0; slot < slot_count; ++slot)
+    {
+        std::vector<Emulator>& emulators = pool.GetSlot(slot);
+        emulators.resize(params.instances);
+        for (size_t i = 0; i < params.instances; ++i)
+        {
+            if (!R_InitEmulator(emulators[i], context, params, i))
+            {
+                return false;
+            }
+        }
+    }
+
+    context.romset_info.PurgeRomData();
+
+    // Writing to a client that went away should fail the write instead of killing the server.
+    signal(SIGPIPE, SIG_IGN);
+
+    const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+    {
+        fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    // Remove a socket left behind by a previous server, but never any other kind of file.
+    std::error_code ec;
+    if (std::filesystem::is_socket(params.serve_path, ec))
+    {
+        std::filesystem::remove(params.serve_path, ec);
+    }
+
+    if (bind(listen_fd, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listen_fd, SOMAXCONN) != 0)
+    {
+        fprintf(stderr, "Failed to listen on %s: %s\n", socket_path.c_str(), strerror(errno));
+        close(listen_fd);
+        return false;
+    }
+
+    fprintf(stderr, "Listening on %s with %zu workers\n", socket_path.c_str(), pool.GetSlotCount());
+
+    // Thread handling the connection that holds each slot. A slot is released just before its connection is closed, so
+    // joining the previous thread of a slot that was just acquired doesn't wait for long.
+    std::vector<std::thread> connection_threads(slot_count);
+
+    size_t next_request_id = 1;
+    while (true)
+    {
+        const int client_fd = accept(listen_fd, nullptr, nullptr);
+        if (client_fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            fprintf(stderr, "Failed to accept connection: %s\n", strerror(errno));
+            break;
+        }
+
+        const size_t                request_id = next_request_id++;
+        const std::optional<size_t> slot       = pool.TryAcquire();
+        if (!slot)
+        {
+            // Only drain what the client has already sent so that a busy server keeps accepting.
+            fprintf(stderr, "Request #%zu rejected: all workers are busy\n", request_id);
+            R_RejectConnection(client_fd, "busy", std::chrono::steady_clock::now());
+            close(client_fd);
+            continue;
+        }
+
+        std::thread& thread = connection_threads[*slot];
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+        thread = std::thread([client_fd, request_id, slot = *slot, &params, &pool, &boot_state] {
+            R_ServeConnection(client_fd, request_id, params, pool.GetSlot(slot), boot_state);
+            pool.Release(slot);
+            close(client_fd);
+        });
+    }
+
+    for (std::thread& thread : connection_threads)
+    {
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+    close(listen_fd);
+    return false;
+}
+#endif
@@ -0,0 +1,11 @@
+// Rendering MIDI files sent over a unix domain socket.
+
+#pragma once
+
+#include "params.h"
+
+#ifndef _WIN32
+// Accepts render requests on a unix domain socket until the process is killed. Returns false if the server couldn't
+// be started.
+bool R_Serve(const R_Parameters& params);
+#endif
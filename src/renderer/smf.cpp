@@ -2,9 +2,22 @@
 #include "cast.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstring>
 #include <fstream>
+#include <tuple>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 // security: do not call without verifying [ptr,ptr+1] is a readable range
 // performance: 16 bit load + rol in clang and gcc, worse in MSVC
@@ -118,7 +131,7 @@ public:
     [[nodiscard]]
     bool Seek(size_t new_offset)
     {
-        if (m_offset <= m_bytes.size())
+        if (new_offset <= m_bytes.size())
         {
             m_offset = new_offset;
             return true;
@@ -139,24 +152,24 @@ private:
     size_t       m_offset = 0;
 };
 
-inline void Check(bool stat, const char* msg)
-{
-    if (!stat)
-    {
-        fprintf(stderr, "Panic: %s\n", msg);
-        exit(1);
-    }
-}
-
 #define STR1(x) #x
 #define STR2(x) STR1(x)
-#define CHECK(expr) Check((expr), __FILE__ ":" STR2(__LINE__) ": " #expr)
+// Fails the enclosing function, storing the expression that failed in `error`.
+#define CHECK(expr)                                                                                                    \
+    if (!(expr))                                                                                                       \
+    {                                                                                                                  \
+        error = __FILE__ ":" STR2(__LINE__) ": " #expr;                                                                \
+        return false;                                                                                                  \
+    }
 
-static void SMF_ReadHeader(SMF_Reader& reader, SMF_Header& header)
+[[nodiscard]]
+static bool SMF_ReadHeader(SMF_Reader& reader, SMF_Header& header, std::string& error)
 {
     CHECK(reader.ReadU16BE(header.format));
     CHECK(reader.ReadU16BE(header.ntrks));
     CHECK(reader.ReadU16BE(header.division));
+    CHECK(header.division != 0);
+    return true;
 }
 
 [[nodiscard]]
@@ -179,41 +192,141 @@ static bool SMF_ReadVarint(SMF_Reader& reader, uint32_t& value)
     return true;
 }
 
-void SMF_SetDeltasFromTimestamps(SMF_Track& track)
+SMF_TrackMerger::SMF_TrackMerger(const SMF_Data& data)
+{
+    m_heap.reserve(data.tracks.size());
+    for (size_t i = 0; i < data.tracks.size(); ++i)
+    {
+        const std::vector<SMF_Event>& events = data.tracks[i].events;
+        if (!events.empty())
+        {
+            m_heap.push_back(
+                {.first = events.data(), .next = events.data(), .last = events.data() + events.size(), .track = i});
+        }
+    }
+    std::make_heap(m_heap.begin(), m_heap.end(), IsLater);
+}
+
+bool SMF_TrackMerger::IsLater(const Cursor& left, const Cursor& right)
+{
+    if (left.next->timestamp != right.next->timestamp)
+    {
+        return left.next->timestamp > right.next->timestamp;
+    }
+    // Position within the track
+    const ptrdiff_t left_index  = left.next - left.first;
+    const ptrdiff_t right_index = right.next - right.first;
+    if (left_index != right_index)
+    {
+        return left_index > right_index;
+    }
+    return left.track > right.track;
+}
+
+const SMF_Event* SMF_TrackMerger::Next()
 {
-    if (track.events.size() == 0)
+    if (m_heap.empty())
     {
-        return;
+        return nullptr;
     }
 
-    track.events[0].delta_time = RangeCast<uint32_t>(track.events[0].timestamp);
-    for (size_t i = 1; i < track.events.size(); ++i)
+    std::pop_heap(m_heap.begin(), m_heap.end(), IsLater);
+    Cursor&          cursor = m_heap.back();
+    const SMF_Event* event  = cursor.next++;
+    if (cursor.next == cursor.last)
+    {
+        m_heap.pop_back();
+    }
+    else
     {
-        track.events[i].delta_time = RangeCast<uint32_t>(
-            track.events[i].timestamp - track.events[i - 1].timestamp
-        );
+        std::push_heap(m_heap.begin(), m_heap.end(), IsLater);
     }
+    return event;
 }
 
 SMF_Track SMF_MergeTracks(const SMF_Data& data)
 {
     SMF_Track merged_track;
+
+    size_t event_count = 0;
     for (const SMF_Track& track : data.tracks)
     {
-        merged_track.events.insert(
-            merged_track.events.end(),
-            track.events.begin(),
-            track.events.end());
+        event_count += track.events.size();
     }
-    std::stable_sort(merged_track.events.begin(), merged_track.events.end(), [](const SMF_Event& left, const SMF_Event& right) {
-        if (left.timestamp == right.timestamp)
+    merged_track.events.reserve(event_count);
+
+    SMF_TrackMerger merger(data);
+    while (const SMF_Event* event = merger.Next())
+    {
+        merged_track.events.push_back(*event);
+    }
+
+    return merged_track;
+}
+
+// Computes `ticks * us_per_qn * 1000 / division` without overflowing for any tick count that fits in a track.
+static uint64_t SMF_TicksToNS(uint64_t ticks, uint64_t us_per_qn, uint64_t division)
+{
+    const uint64_t us_scaled = ticks * us_per_qn;
+    return us_scaled / division * 1000 + us_scaled % division * 1000 / division;
+}
+
+uint64_t SMF_TempoMap::TicksToNS(uint64_t tick) const
+{
+    // Find the last segment starting at or before `tick`.
+    auto it = std::upper_bound(segments.begin(), segments.end(), tick, [](uint64_t t, const Segment& segment) {
+        return t < segment.tick;
+    });
+    const Segment& segment = *(it - 1);
+    return segment.ns + SMF_TicksToNS(tick - segment.tick, segment.us_per_qn, division);
+}
+
+SMF_TempoMap SMF_BuildTempoMap(const SMF_Data& data)
+{
+    SMF_TempoMap map;
+    map.division = data.header.division;
+    map.segments.push_back({.tick = 0, .ns = 0, .us_per_qn = 500000});
+
+    // Tempo events in merge order (see SMF_TrackMerger), so that the last of several tempo events on one tick wins
+    // like it does during playback. Files have few of these, so this is cheaper than merging every event.
+    struct TempoEvent
+    {
+        const SMF_Event* event;
+        size_t           index;
+        size_t           track;
+    };
+    std::vector<TempoEvent> tempo_events;
+    for (size_t track = 0; track < data.tracks.size(); ++track)
+    {
+        const std::vector<SMF_Event>& events = data.tracks[track].events;
+        for (size_t index = 0; index < events.size(); ++index)
         {
-            return left.seq_id < right.seq_id;
+            if (events[index].IsTempo(data.bytes))
+            {
+                tempo_events.push_back({&events[index], index, track});
+            }
         }
-        return left.timestamp < right.timestamp;
+    }
+    std::sort(tempo_events.begin(), tempo_events.end(), [](const TempoEvent& left, const TempoEvent& right) {
+        return std::tie(left.event->timestamp, left.index, left.track) <
+               std::tie(right.event->timestamp, right.index, right.track);
     });
-    SMF_SetDeltasFromTimestamps(merged_track);
-    return merged_track;
+
+    for (const TempoEvent& tempo_event : tempo_events)
+    {
+        const SMF_Event*             event = tempo_event.event;
+        const SMF_TempoMap::Segment& last  = map.segments.back();
+        const uint64_t               ns    = last.ns + SMF_TicksToNS(event->timestamp - last.tick, last.us_per_qn, map.division);
+        if (event->timestamp == last.tick)
+        {
+            map.segments.back().us_per_qn = event->GetTempoUS(data.bytes);
+        }
+        else
+        {
+            map.segments.push_back({.tick = event->timestamp, .ns = ns, .us_per_qn = event->GetTempoUS(data.bytes)});
+        }
+    }
+    return map;
 }
 
 inline bool SMF_IsStatusByte(uint8_t byte)
@@ -221,7 +334,7 @@ inline bool SMF_IsStatusByte(uint8_t byte)
     return (byte & 0x80) != 0;
 }
 
-bool SMF_ReadTrack(SMF_Reader& reader, SMF_Data& result, uint64_t expected_end)
+bool SMF_ReadTrack(SMF_Reader& reader, SMF_Data& result, uint64_t expected_end, std::string& error)
 {
     uint8_t running_status = 0;
     uint64_t total_time = 0;
@@ -231,6 +344,11 @@ bool SMF_ReadTrack(SMF_Reader& reader, SMF_Data& result, uint64_t expected_end)
     result.tracks.emplace_back();
     SMF_Track& new_track = result.tracks.back();
 
+    // Dense tracks take about 4 bytes per event with running status. Reserving for that avoids copying the event
+    // list as it grows. The chunk size comes from the file, so don't trust it beyond the end of the file.
+    const uint64_t track_bytes = std::min<uint64_t>(expected_end - reader.GetOffset(), reader.RemainingBytes());
+    new_track.events.reserve((size_t)(track_bytes / 4));
+
     while (reader.GetOffset() < expected_end)
     {
         uint32_t delta_time;
@@ -255,8 +373,6 @@ bool SMF_ReadTrack(SMF_Reader& reader, SMF_Data& result, uint64_t expected_end)
 
         new_track.events.emplace_back();
         SMF_Event& new_event = new_track.events.back();
-        new_event.seq_id = new_track.events.size();
-        new_event.delta_time = delta_time;
         new_event.timestamp = total_time;
         new_event.status = running_status;
         new_event.track_id = this_track;
@@ -269,16 +385,16 @@ bool SMF_ReadTrack(SMF_Reader& reader, SMF_Data& result, uint64_t expected_end)
             case 0xA0:
             case 0xB0:
             case 0xE0:
-                new_event.data_first = reader.GetOffset();
+                new_event.data_first = (uint32_t)reader.GetOffset();
                 CHECK(reader.Skip(2));
-                new_event.data_last = reader.GetOffset();
+                new_event.data_last = (uint32_t)reader.GetOffset();
                 break;
             // 1 param
             case 0xC0:
             case 0xD0:
-                new_event.data_first = reader.GetOffset();
+                new_event.data_first = (uint32_t)reader.GetOffset();
                 CHECK(reader.Skip(1));
-                new_event.data_last = reader.GetOffset();
+                new_event.data_last = (uint32_t)reader.GetOffset();
                 break;
             // variable length
             case 0xF0:
@@ -288,20 +404,20 @@ bool SMF_ReadTrack(SMF_Reader& reader, SMF_Data& result, uint64_t expected_end)
                         // Sysex events
                         uint32_t sysex_len;
                         CHECK(SMF_ReadVarint(reader, sysex_len));
-                        new_event.data_first = reader.GetOffset();
+                        new_event.data_first = (uint32_t)reader.GetOffset();
                         CHECK(reader.Skip(sysex_len));
-                        new_event.data_last = reader.GetOffset();
+                        new_event.data_last = (uint32_t)reader.GetOffset();
                     }
                     else if (new_event.status == 0xFF)
                     {
                         // Meta events
                         uint32_t meta_len;
-                        new_event.data_first = reader.GetOffset();
+                        new_event.data_first = (uint32_t)reader.GetOffset();
                         uint8_t meta_type;
                         CHECK(reader.ReadU8(meta_type));
                         CHECK(SMF_ReadVarint(reader, meta_len));
                         CHECK(reader.Skip(meta_len));
-                        new_event.data_last = reader.GetOffset();
+                        new_event.data_last = (uint32_t)reader.GetOffset();
 
                         // End of track: stop reading events and skip to where the next track would be
                         if (meta_type == 0x2F)
@@ -312,8 +428,10 @@ bool SMF_ReadTrack(SMF_Reader& reader, SMF_Data& result, uint64_t expected_end)
                     }
                     else
                     {
-                        fprintf(stderr, "Panic: unhandled Fx message: %x\n", new_event.status);
-                        exit(1);
+                        char message[64];
+                        snprintf(message, sizeof(message), "unhandled Fx message: %x", new_event.status);
+                        error = message;
+                        return false;
                     }
                 }
                 break;
@@ -322,8 +440,8 @@ bool SMF_ReadTrack(SMF_Reader& reader, SMF_Data& result, uint64_t expected_end)
 
     if (reader.GetOffset() > expected_end)
     {
+        // Not fatal; the next chunk is read from wherever this one ended.
         fprintf(stderr, "Read past expected track end\n");
-        return false;
     }
 
     return true;
@@ -331,10 +449,24 @@ bool SMF_ReadTrack(SMF_Reader& reader, SMF_Data& result, uint64_t expected_end)
 
 void SMF_PrintStats(const SMF_Data& data)
 {
+    size_t event_count = 0;
     for (size_t i = 0; i < data.tracks.size(); ++i)
     {
         fprintf(stderr, "Track %02zu: %zu events\n", i, data.tracks[i].events.size());
+        event_count += data.tracks[i].events.size();
     }
+
+    constexpr double MIB = 1024.0 * 1024.0;
+
+    const double parse_sec = (double)data.parse_ns / 1e9;
+    const double size_mib  = (double)data.bytes.size() / MIB;
+    fprintf(stderr,
+            "Parsed %zu events (%.2f MiB) in %.3fs, %.1f MiB/s, %.1fM events/s\n",
+            event_count,
+            size_mib,
+            parse_sec,
+            parse_sec > 0 ? size_mib / parse_sec : 0.0,
+            parse_sec > 0 ? (double)event_count / parse_sec / 1e6 : 0.0);
 }
 
 bool SMF_ReadAllBytes(const std::filesystem::path& filename, std::vector<uint8_t>& buffer)
@@ -357,7 +489,139 @@ bool SMF_ReadAllBytes(const std::filesystem::path& filename, std::vector<uint8_t
     return input.good();
 }
 
-bool SMF_ReadChunk(SMF_Reader& reader, SMF_Data& data)
+SMF_FileBuffer::~SMF_FileBuffer()
+{
+    Unmap();
+}
+
+SMF_FileBuffer::SMF_FileBuffer(SMF_FileBuffer&& rhs) noexcept
+{
+    *this = std::move(rhs);
+}
+
+SMF_FileBuffer& SMF_FileBuffer::operator=(SMF_FileBuffer&& rhs) noexcept
+{
+    Unmap();
+    m_owned           = std::move(rhs.m_owned);
+    m_mapped          = rhs.m_mapped;
+    m_mapped_size     = rhs.m_mapped_size;
+    rhs.m_mapped      = nullptr;
+    rhs.m_mapped_size = 0;
+    return *this;
+}
+
+bool SMF_FileBuffer::Open(const std::filesystem::path& filename)
+{
+    Unmap();
+    m_owned.clear();
+    return Map(filename) || SMF_ReadAllBytes(filename, m_owned);
+}
+
+void SMF_FileBuffer::Assign(std::vector<uint8_t> bytes)
+{
+    Unmap();
+    m_owned = std::move(bytes);
+}
+
+SMF_ByteSpan SMF_FileBuffer::GetBytes() const
+{
+    if (m_mapped)
+    {
+        return SMF_ByteSpan(m_mapped, m_mapped_size);
+    }
+    return m_owned;
+}
+
+#ifdef _WIN32
+bool SMF_FileBuffer::Map(const std::filesystem::path& filename)
+{
+    HANDLE file = CreateFileW(
+        filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping)
+    {
+        return false;
+    }
+
+    // The view keeps the mapping alive.
+    const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!view)
+    {
+        return false;
+    }
+
+    m_mapped      = (const uint8_t*)view;
+    m_mapped_size = (size_t)size.QuadPart;
+    return true;
+}
+
+void SMF_FileBuffer::Unmap()
+{
+    if (m_mapped)
+    {
+        UnmapViewOfFile(m_mapped);
+        m_mapped      = nullptr;
+        m_mapped_size = 0;
+    }
+}
+#else
+bool SMF_FileBuffer::Map(const std::filesystem::path& filename)
+{
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    // The mapping stays valid after the descriptor is closed.
+    void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED)
+    {
+        return false;
+    }
+
+    // The parser reads the file front to back exactly once.
+    madvise(view, (size_t)info.st_size, MADV_SEQUENTIAL);
+
+    m_mapped      = (const uint8_t*)view;
+    m_mapped_size = (size_t)info.st_size;
+    return true;
+}
+
+void SMF_FileBuffer::Unmap()
+{
+    if (m_mapped)
+    {
+        munmap((void*)m_mapped, m_mapped_size);
+        m_mapped      = nullptr;
+        m_mapped_size = 0;
+    }
+}
+#endif
+
+bool SMF_ReadChunk(SMF_Reader& reader, SMF_Data& data, std::string& error)
 {
     uint64_t chunk_start = reader.GetOffset();
 
@@ -371,18 +635,62 @@ bool SMF_ReadChunk(SMF_Reader& reader, SMF_Data& data)
 
     if (memcmp(chunk_type, "MThd", 4) == 0)
     {
-        SMF_ReadHeader(reader, data.header);
+        if (!SMF_ReadHeader(reader, data.header, error))
+        {
+            return false;
+        }
     }
     else if (memcmp(chunk_type, "MTrk", 4) == 0)
     {
-        SMF_ReadTrack(reader, data, chunk_end);
+        if (!SMF_ReadTrack(reader, data, chunk_end, error))
+        {
+            return false;
+        }
     }
     else
     {
-        fprintf(stderr, "Unexpected chunk type at %zu\n", (size_t)chunk_start);
+        char message[64];
+        snprintf(message, sizeof(message), "Unexpected chunk type at %zu", (size_t)chunk_start);
+        error = message;
+        return false;
+    }
+
+    return true;
+}
+
+bool SMF_ParseEvents(SMF_Data& data, std::string& error)
+{
+    const auto t_start = std::chrono::steady_clock::now();
+
+    data.bytes = data.buffer.GetBytes();
+
+    // Events store 32-bit offsets.
+    if (data.bytes.size() > UINT32_MAX)
+    {
+        error = "File is too large";
+        return false;
+    }
+
+    SMF_Reader reader(data.bytes);
+
+    while (!reader.AtEnd())
+    {
+        if (!SMF_ReadChunk(reader, data, error))
+        {
+            return false;
+        }
+    }
+
+    if (data.header.division == 0)
+    {
+        error = "Missing MThd chunk";
         return false;
     }
 
+    data.tempo_map = SMF_BuildTempoMap(data);
+
+    data.parse_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t_start).count();
+
     return true;
 }
 
@@ -393,17 +701,31 @@ SMF_Data SMF_LoadEvents(const char* filename)
 
 SMF_Data SMF_LoadEvents(const std::filesystem::path& filename)
 {
-    SMF_Data data;
+    SMF_Data    data;
+    std::string error;
 
-    CHECK(SMF_ReadAllBytes(filename, data.bytes));
+    if (!SMF_LoadEvents(filename, data, error))
+    {
+        fprintf(stderr, "Panic: %s\n", error.c_str());
+        exit(1);
+    }
 
-    SMF_Reader reader(data.bytes);
+    return data;
+}
 
-    while (!reader.AtEnd())
+bool SMF_LoadEvents(const std::filesystem::path& filename, SMF_Data& data, std::string& error)
+{
+    if (!data.buffer.Open(filename))
     {
-        CHECK(SMF_ReadChunk(reader, data));
+        error = "Failed to read " + filename.generic_string();
+        return false;
     }
 
-    return data;
+    return SMF_ParseEvents(data, error);
 }
 
+bool SMF_LoadEventsFromBytes(std::vector<uint8_t> bytes, SMF_Data& data, std::string& error)
+{
+    data.buffer.Assign(std::move(bytes));
+    return SMF_ParseEvents(data, error);
+}
@@ -5,6 +5,7 @@
 #include <cstdint>
 #include <filesystem>
 #include <span>
+#include <string>
 #include <vector>
 
 using SMF_ByteSpan = std::span<const uint8_t>;
@@ -16,21 +17,17 @@ struct SMF_Header
     uint16_t division;
 };
 
+// Kept small since large files have millions of these.
 struct SMF_Event
 {
-    // Position of this event within the track. Used during sorting so events
-    // with the same timestamp preserve ordering.
-    uint64_t seq_id;
     // Absolute timestamp relative to track start.
     uint64_t timestamp;
-    // Time since track start (only for first event in a track) or the prior event.
-    uint32_t delta_time;
+    // Offset to raw data bytes for this message within an SMF_ByteSpan.
+    uint32_t data_first, data_last;
     // Number of MTrk chunk containing this event.
     uint16_t track_id;
     // MIDI message type.
     uint8_t status;
-    // Offset to raw data bytes for this message within an SMF_ByteSpan.
-    size_t data_first, data_last;
 
     uint8_t GetChannel() const
     {
@@ -59,7 +56,8 @@ struct SMF_Event
 
     bool IsTempo(SMF_ByteSpan bytes) const
     {
-        return IsMetaEvent() && bytes[data_first] == 0x51;
+        // type, length, 3 bytes of tempo
+        return IsMetaEvent() && data_last - data_first >= 5 && bytes[data_first] == 0x51;
     }
 
     uint32_t GetTempoUS(SMF_ByteSpan bytes) const
@@ -75,28 +73,113 @@ struct SMF_Event
     }
 };
 
+static_assert(sizeof(SMF_Event) == 24, "SMF_Event should stay compact");
+
 struct SMF_Track
 {
     std::vector<SMF_Event> events;
 };
 
+// Converts tick timestamps to time since the start of the file. Tempo changes apply to every track, so events that
+// share a tick convert to exactly the same time no matter which track they end up in.
+struct SMF_TempoMap
+{
+    struct Segment
+    {
+        // First tick this tempo applies to.
+        uint64_t tick;
+        // Time of `tick` in nanoseconds.
+        uint64_t ns;
+        uint64_t us_per_qn;
+    };
+
+    uint64_t division = 1;
+    // Sorted by tick. The first segment starts at tick 0 with the default tempo of 120 BPM.
+    std::vector<Segment> segments;
+
+    uint64_t TicksToNS(uint64_t tick) const;
+};
+
+// Contents of a MIDI file, either mapped into memory or owned.
+class SMF_FileBuffer
+{
+public:
+    SMF_FileBuffer() = default;
+    ~SMF_FileBuffer();
+    // moveable; the bytes don't move with the buffer
+    SMF_FileBuffer(SMF_FileBuffer&&) noexcept;
+    SMF_FileBuffer& operator=(SMF_FileBuffer&&) noexcept;
+    // noncopyable
+    SMF_FileBuffer(const SMF_FileBuffer&)            = delete;
+    SMF_FileBuffer& operator=(const SMF_FileBuffer&) = delete;
+
+    // Maps `filename` into memory, or reads it if it can't be mapped (e.g. a pipe). Returns false if the file can't be
+    // read at all.
+    bool Open(const std::filesystem::path& filename);
+    void Assign(std::vector<uint8_t> bytes);
+
+    SMF_ByteSpan GetBytes() const;
+
+private:
+    bool Map(const std::filesystem::path& filename);
+    void Unmap();
+
+    std::vector<uint8_t> m_owned;
+    const uint8_t*       m_mapped      = nullptr;
+    size_t               m_mapped_size = 0;
+};
+
 struct SMF_Data
 {
-    SMF_Header header;
-    std::vector<uint8_t> bytes;
+    SMF_Header header{};
+    SMF_FileBuffer buffer;
+    // View of `buffer` that events refer to.
+    SMF_ByteSpan bytes;
     std::vector<SMF_Track> tracks;
+    // Built from the tempo events of all tracks when the file is loaded.
+    SMF_TempoMap tempo_map;
+    // Time spent parsing, for SMF_PrintStats.
+    uint64_t parse_ns = 0;
 };
 
 const size_t SMF_CHANNEL_COUNT = 16;
 
-void SMF_SetDeltasFromTimestamps(SMF_Track& track);
+// Visits the events of every track of `data` in timestamp order without copying them. Events with the same timestamp
+// keep their order within a track, and ties between tracks go to the earlier track. Keeps a heap holding the next
+// event of each track, so memory use only depends on the number of tracks.
+class SMF_TrackMerger
+{
+public:
+    explicit SMF_TrackMerger(const SMF_Data& data);
+
+    // Returns the next event, or nullptr once every track is exhausted.
+    const SMF_Event* Next();
+
+private:
+    struct Cursor
+    {
+        const SMF_Event* first;
+        const SMF_Event* next;
+        const SMF_Event* last;
+        size_t           track;
+    };
+
+    // Orders the heap so that the cursor with the earliest event is at the front.
+    static bool IsLater(const Cursor& left, const Cursor& right);
+
+    std::vector<Cursor> m_heap;
+};
+
+// Builds a single track containing the events of every track in SMF_TrackMerger order.
 SMF_Track SMF_MergeTracks(const SMF_Data& data);
+SMF_TempoMap SMF_BuildTempoMap(const SMF_Data& data);
+// Prints event counts and parse throughput.
 void SMF_PrintStats(const SMF_Data& data);
+// These print an error and exit the process if the file can't be loaded.
 SMF_Data SMF_LoadEvents(const char* filename);
 SMF_Data SMF_LoadEvents(const std::filesystem::path& filename);
-
-inline uint64_t SMF_TicksToUS(uint64_t ticks, uint64_t us_per_qn, uint64_t division)
-{
-    return ticks * us_per_qn / division;
-}
+// Returns false and describes the problem in `error` if the file can't be loaded.
+bool SMF_LoadEvents(const std::filesystem::path& filename, SMF_Data& data, std::string& error);
+// Same as above, but parses a file that is already in memory.
+bool SMF_LoadEventsFromBytes(std::vector<uint8_t> bytes, SMF_Data& data, std::string& error);
 
@@ -0,0 +1,95 @@
+#include "spool.h"
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+R_LoudnessSpool::~R_LoudnessSpool()
+{
+    Close();
+}
+
+bool R_LoudnessSpool::Open(uint32_t sample_rate)
+{
+    std::error_code ec;
+    const std::filesystem::path temp_dir = std::filesystem::temp_directory_path(ec);
+    if (ec)
+    {
+        return false;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "nuked-sc55-spool-%08x.f32", (unsigned)std::random_device{}());
+    m_path = temp_dir / name;
+    m_file = fopen(m_path.string().c_str(), "wbx");
+    if (!m_file)
+    {
+        return false;
+    }
+
+    m_meter.Init(sample_rate);
+    return true;
+}
+
+void R_LoudnessSpool::Write(std::span<const AudioFrame<float>> frames)
+{
+    m_meter.Process(frames);
+    if (fwrite(frames.data(), sizeof(AudioFrame<float>), frames.size(), m_file) != frames.size())
+    {
+        m_failed = true;
+    }
+}
+
+bool R_LoudnessSpool::Finish()
+{
+    const bool closed = fclose(m_file) == 0;
+    m_file            = nullptr;
+    if (m_failed || !closed)
+    {
+        return false;
+    }
+
+    // An empty spool can't be mapped, but there is nothing to read from it either.
+    return std::filesystem::file_size(m_path) == 0 || m_buffer.Open(m_path);
+}
+
+std::span<const AudioFrame<float>> R_LoudnessSpool::GetFrames() const
+{
+    const SMF_ByteSpan bytes = m_buffer.GetBytes();
+    return {(const AudioFrame<float>*)bytes.data(), bytes.size() / sizeof(AudioFrame<float>)};
+}
+
+void R_LoudnessSpool::Close()
+{
+    if (m_file)
+    {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+    // Windows won't remove a file that is still mapped.
+    m_buffer = {};
+    if (!m_path.empty())
+    {
+        std::error_code ec;
+        std::filesystem::remove(m_path, ec);
+    }
+}
+
+void R_WriteSpool(const R_LoudnessSpool& spool, size_t block_size, std::span<R_FanOutWriter<float>> writers)
+{
+    const std::span<const AudioFrame<float>> frames = spool.GetFrames();
+    for (size_t offset = 0; offset < frames.size(); offset += block_size)
+    {
+        const auto block_frames = frames.subspan(offset, std::min(block_size, frames.size() - offset));
+        auto block = std::make_shared<std::vector<AudioFrame<float>>>(block_frames.begin(), block_frames.end());
+        for (R_FanOutWriter<float>& writer : writers)
+        {
+            writer.Push(block);
+        }
+    }
+
+    for (R_FanOutWriter<float>& writer : writers)
+    {
+        writer.Finish();
+    }
+}
@@ -0,0 +1,56 @@
+// Temporary storage for the mix when it has to be measured before it can be
+// written, as for --normalize-lufs.
+
+#pragma once
+
+#include "audio.h"
+#include "output.h"
+#include "smf.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <span>
+
+#include "common/loudness.h"
+
+// Temporary file holding the float mix for --normalize-lufs. The mix is measured as it is written, so once rendering is
+// done the gain is known and the spool can be read back once through the regular writers.
+class R_LoudnessSpool
+{
+public:
+    R_LoudnessSpool() = default;
+    ~R_LoudnessSpool();
+
+    // noncopyable
+    R_LoudnessSpool(const R_LoudnessSpool&)            = delete;
+    R_LoudnessSpool& operator=(const R_LoudnessSpool&) = delete;
+
+    // Creates the spool in the system temp directory. Returns false if it couldn't be created.
+    bool Open(uint32_t sample_rate);
+
+    // Called from the mix thread.
+    void Write(std::span<const AudioFrame<float>> frames);
+
+    // Closes the spool for writing and maps it for reading. Returns false if any write failed.
+    bool Finish();
+
+    std::span<const AudioFrame<float>> GetFrames() const;
+
+    const common::LoudnessMeter& GetMeter() const
+    {
+        return m_meter;
+    }
+
+private:
+    void Close();
+
+    std::filesystem::path m_path;
+    FILE*                 m_file   = nullptr;
+    bool                  m_failed = false;
+    SMF_FileBuffer        m_buffer;
+    common::LoudnessMeter m_meter;
+};
+
+// Feeds the spooled mix to every writer in blocks of `block_size` frames and finishes them.
+void R_WriteSpool(const R_LoudnessSpool& spool, size_t block_size, std::span<R_FanOutWriter<float>> writers);
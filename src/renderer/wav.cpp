@@ -2,11 +2,12 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include "wav.h"
-#include "cast.h"
 
 #include <bit>
 #include <cassert>
+#include <cinttypes>
 #include <cstring>
+#include <vector>
 
 // Constants from rfc2361
 enum class WaveFormat : uint16_t
@@ -43,6 +44,15 @@ void WAV_WriteU32LE(FILE* output, uint32_t value)
     WAV_WriteBytes(output, (const char*)&value, sizeof(uint32_t));
 }
 
+void WAV_WriteU64LE(FILE* output, uint64_t value)
+{
+    if constexpr (std::endian::native == std::endian::big)
+    {
+        value = std::byteswap(value);
+    }
+    WAV_WriteBytes(output, (const char*)&value, sizeof(uint64_t));
+}
+
 void WAV_WriteF32LE(FILE* output, float value)
 {
     // byteswap is only implemented for integral types, so forward the call to
@@ -50,6 +60,78 @@ void WAV_WriteF32LE(FILE* output, float value)
     WAV_WriteU32LE(output, std::bit_cast<uint32_t>(value));
 }
 
+// Seeks to an absolute offset. fseek takes a long, which can't reach past 2 GiB on Windows or 32-bit systems.
+void WAV_Seek(FILE* output, uint64_t offset)
+{
+#ifdef _WIN32
+    _fseeki64(output, (__int64)offset, SEEK_SET);
+#else
+    fseeko(output, (off_t)offset, SEEK_SET);
+#endif
+}
+
+// Size of the ds64 chunk body without a table. Files created with Open reserve a chunk of this size so that they can be
+// turned into RF64 without moving the sample data once they grow past 4 GB. Streams can't seek back to fill it in, so
+// they keep the plain 44 byte header (58 for float).
+constexpr uint32_t WAV_DS64_SIZE = 28;
+
+struct WAV_FormatInfo
+{
+    uint16_t frame_size;
+    uint16_t bits_per_sample;
+    bool     is_float;
+};
+
+WAV_FormatInfo WAV_GetFormatInfo(AudioFormat format)
+{
+    switch (format)
+    {
+    case AudioFormat::S16:
+        return {sizeof(AudioFrame<int16_t>), 8 * sizeof(int16_t), false};
+    case AudioFormat::S32:
+        return {sizeof(AudioFrame<int32_t>), 8 * sizeof(int32_t), false};
+    case AudioFormat::F32:
+        return {sizeof(AudioFrame<float>), 8 * sizeof(float), true};
+    }
+    return {};
+}
+
+// Returns the offset of the first sample.
+size_t WAV_GetHeaderSize(AudioFormat format, bool reserve_ds64)
+{
+    // RIFF (+ JUNK/ds64) + fmt (+ fact) + data
+    const size_t common = 12 + (reserve_ds64 ? 8 + WAV_DS64_SIZE : 0) + 8;
+    return WAV_GetFormatInfo(format).is_float ? common + (8 + 18) + (8 + 4) : common + (8 + 16);
+}
+
+// Writes interleaved samples as little endian. Sample data is already in the right byte order on little endian hosts, so
+// this is a single fwrite.
+template <typename T>
+void WAV_WriteFramesLE(FILE* output, std::span<const AudioFrame<T>> frames)
+{
+    static_assert(sizeof(AudioFrame<T>) == 2 * sizeof(T), "frames must be tightly packed");
+
+    if constexpr (std::endian::native == std::endian::little)
+    {
+        fwrite(frames.data(), sizeof(AudioFrame<T>), frames.size(), output);
+    }
+    else
+    {
+        // Swap through the unsigned integer type of the same size, since byteswap is only implemented for integral
+        // types.
+        using U = std::conditional_t<sizeof(T) == 2, uint16_t, uint32_t>;
+
+        const size_t   sample_count = frames.size() * AudioFrame<T>::channel_count;
+        std::vector<U> swapped(sample_count);
+        memcpy(swapped.data(), frames.data(), frames.size_bytes());
+        for (U& sample : swapped)
+        {
+            sample = std::byteswap(sample);
+        }
+        fwrite(swapped.data(), sizeof(U), swapped.size(), output);
+    }
+}
+
 WAV_Handle::~WAV_Handle()
 {
     Close();
@@ -59,9 +141,15 @@ WAV_Handle::WAV_Handle(WAV_Handle&& rhs) noexcept
 {
     m_output         = rhs.m_output;
     rhs.m_output     = nullptr;
+    m_owned          = rhs.m_owned;
     m_format         = rhs.m_format;
     m_sample_rate    = rhs.m_sample_rate;
     m_frames_written = rhs.m_frames_written;
+    m_path           = std::move(rhs.m_path);
+    m_has_loop       = rhs.m_has_loop;
+    m_loop_start     = rhs.m_loop_start;
+    m_loop_end       = rhs.m_loop_end;
+    m_trailer_size   = rhs.m_trailer_size;
 }
 
 WAV_Handle& WAV_Handle::operator=(WAV_Handle&& rhs) noexcept
@@ -69,9 +157,15 @@ WAV_Handle& WAV_Handle::operator=(WAV_Handle&& rhs) noexcept
     Close();
     m_output         = rhs.m_output;
     rhs.m_output     = nullptr;
+    m_owned          = rhs.m_owned;
     m_format         = rhs.m_format;
     m_sample_rate    = rhs.m_sample_rate;
     m_frames_written = rhs.m_frames_written;
+    m_path           = std::move(rhs.m_path);
+    m_has_loop       = rhs.m_has_loop;
+    m_loop_start     = rhs.m_loop_start;
+    m_loop_end       = rhs.m_loop_end;
+    m_trailer_size   = rhs.m_trailer_size;
     return *this;
 }
 
@@ -81,26 +175,43 @@ void WAV_Handle::SetSampleRate(uint32_t sample_rate)
 }
 
 void WAV_Handle::OpenStdout(AudioFormat format)
+{
+    OpenStream(stdout, format, false);
+}
+
+void WAV_Handle::OpenStream(FILE* output, AudioFormat format, bool write_header)
 {
     m_format = format;
-    m_output = stdout;
+    m_output = output;
+    m_owned  = false;
+    if (write_header)
+    {
+        WriteHeader(true);
+    }
 }
 
-void WAV_Handle::Open(const char* filename, AudioFormat format)
+bool WAV_Handle::Open(const char* filename, AudioFormat format)
 {
-    Open(std::filesystem::path(filename), format);
+    return Open(std::filesystem::path(filename), format);
 }
 
-void WAV_Handle::Open(const std::filesystem::path& filename, AudioFormat format)
+bool WAV_Handle::Open(const std::filesystem::path& filename, AudioFormat format)
 {
     m_format = format;
     m_output = fopen(filename.generic_string().c_str(), "wb");
-    fseek(m_output, format == AudioFormat::F32 ? 58 : 44, SEEK_SET);
+    m_owned  = true;
+    m_path   = filename;
+    if (!m_output)
+    {
+        return false;
+    }
+    WAV_Seek(m_output, WAV_GetHeaderSize(format, true));
+    return true;
 }
 
 void WAV_Handle::Close()
 {
-    if (m_output && m_output != stdout)
+    if (m_output && m_owned)
     {
         fclose(m_output);
     }
@@ -128,97 +239,180 @@ void WAV_Handle::Write(const AudioFrame<float>& frame)
     ++m_frames_written;
 }
 
+void WAV_Handle::Write(std::span<const AudioFrame<int16_t>> frames)
+{
+    WAV_WriteFramesLE(m_output, frames);
+    m_frames_written += frames.size();
+}
+
+void WAV_Handle::Write(std::span<const AudioFrame<int32_t>> frames)
+{
+    WAV_WriteFramesLE(m_output, frames);
+    m_frames_written += frames.size();
+}
+
+void WAV_Handle::Write(std::span<const AudioFrame<float>> frames)
+{
+    WAV_WriteFramesLE(m_output, frames);
+    m_frames_written += frames.size();
+}
+
+void WAV_Handle::SetLoop(uint64_t start, uint64_t end)
+{
+    assert(start < end);
+    m_has_loop   = true;
+    m_loop_start = start;
+    m_loop_end   = end;
+}
+
+void WAV_Handle::WriteSampleChunk()
+{
+    // Loop positions are 32-bit, so a loop beyond that can't be described.
+    if (m_loop_end - 1 > UINT32_MAX)
+    {
+        fprintf(stderr,
+                "Not marking a loop in %s: it ends past frame %" PRIu32 "\n",
+                m_path.generic_string().c_str(),
+                UINT32_MAX);
+        return;
+    }
+
+    const uint64_t header_size = WAV_GetHeaderSize(m_format, m_owned);
+    WAV_Seek(m_output, header_size + m_frames_written * WAV_GetFormatInfo(m_format).frame_size);
+
+    constexpr uint32_t SMPL_SIZE = 36 + 24;
+
+    WAV_WriteCString(m_output, "smpl");
+    WAV_WriteU32LE(m_output, SMPL_SIZE);
+    // manufacturer, product
+    WAV_WriteU32LE(m_output, 0);
+    WAV_WriteU32LE(m_output, 0);
+    // sample period in nanoseconds
+    WAV_WriteU32LE(m_output, 1'000'000'000 / m_sample_rate);
+    // unity note (middle C), pitch fraction, SMPTE format and offset
+    WAV_WriteU32LE(m_output, 60);
+    WAV_WriteU32LE(m_output, 0);
+    WAV_WriteU32LE(m_output, 0);
+    WAV_WriteU32LE(m_output, 0);
+    // loop count, sampler data size
+    WAV_WriteU32LE(m_output, 1);
+    WAV_WriteU32LE(m_output, 0);
+    // cue point id, type (forward), start, end (inclusive), fraction, play count (infinite)
+    WAV_WriteU32LE(m_output, 0);
+    WAV_WriteU32LE(m_output, 0);
+    WAV_WriteU32LE(m_output, (uint32_t)m_loop_start);
+    WAV_WriteU32LE(m_output, (uint32_t)(m_loop_end - 1));
+    WAV_WriteU32LE(m_output, 0);
+    WAV_WriteU32LE(m_output, 0);
+
+    m_trailer_size = 8 + SMPL_SIZE;
+}
+
 void WAV_Handle::Finish()
 {
-    // we wrote raw samples, nothing to do
-    if (m_output == stdout)
+    // we wrote raw samples or a streaming header, nothing to do
+    if (!m_owned)
     {
+        fflush(m_output);
+        m_output = nullptr;
         return;
     }
 
+    const bool truncate = m_has_loop && m_frames_written > m_loop_end;
+    if (m_has_loop && m_loop_end <= m_frames_written)
+    {
+        m_frames_written = m_loop_end;
+        WriteSampleChunk();
+    }
+    else if (m_has_loop)
+    {
+        fprintf(stderr,
+                "Not marking a loop in %s: it ends at frame %" PRIu64 " but only %" PRIu64 " frames were written\n",
+                m_path.generic_string().c_str(),
+                m_loop_end,
+                m_frames_written);
+    }
+
     // go back and fill in the header
-    fseek(m_output, 0, SEEK_SET);
-
-    switch (m_format)
-    {
-    case AudioFormat::S16: {
-        const uint32_t data_size = RangeCast<uint32_t>(m_frames_written * sizeof(AudioFrame<int16_t>));
-
-        // RIFF header
-        WAV_WriteCString(m_output, "RIFF");
-        WAV_WriteU32LE(m_output, 36 + data_size);
-        WAV_WriteCString(m_output, "WAVE");
-        // fmt
-        WAV_WriteCString(m_output, "fmt ");
-        WAV_WriteU32LE(m_output, 16);
-        WAV_WriteU16LE(m_output, (uint16_t)WaveFormat::PCM);
-        WAV_WriteU16LE(m_output, AudioFrame<int16_t>::channel_count);
-        WAV_WriteU32LE(m_output, m_sample_rate);
-        WAV_WriteU32LE(m_output, m_sample_rate * sizeof(AudioFrame<int16_t>));
-        WAV_WriteU16LE(m_output, sizeof(AudioFrame<int16_t>));
-        WAV_WriteU16LE(m_output, 8 * sizeof(int16_t));
-        // data
-        WAV_WriteCString(m_output, "data");
-        WAV_WriteU32LE(m_output, data_size);
-
-        assert(ftell(m_output) == 44);
-
-        break;
-    }
-    case AudioFormat::S32: {
-        const uint32_t data_size = RangeCast<uint32_t>(m_frames_written * sizeof(AudioFrame<int32_t>));
-
-        // RIFF header
-        WAV_WriteCString(m_output, "RIFF");
-        WAV_WriteU32LE(m_output, 36 + data_size);
-        WAV_WriteCString(m_output, "WAVE");
-        // fmt
-        WAV_WriteCString(m_output, "fmt ");
-        WAV_WriteU32LE(m_output, 16);
-        WAV_WriteU16LE(m_output, (uint16_t)WaveFormat::PCM);
-        WAV_WriteU16LE(m_output, AudioFrame<int32_t>::channel_count);
-        WAV_WriteU32LE(m_output, m_sample_rate);
-        WAV_WriteU32LE(m_output, m_sample_rate * sizeof(AudioFrame<int32_t>));
-        WAV_WriteU16LE(m_output, sizeof(AudioFrame<int32_t>));
-        WAV_WriteU16LE(m_output, 8 * sizeof(int32_t));
-        // data
-        WAV_WriteCString(m_output, "data");
-        WAV_WriteU32LE(m_output, data_size);
-
-        assert(ftell(m_output) == 44);
-
-        break;
-    }
-    case AudioFormat::F32: {
-        const uint32_t data_size = RangeCast<uint32_t>(m_frames_written * sizeof(AudioFrame<float>));
-
-        // RIFF header
-        WAV_WriteCString(m_output, "RIFF");
-        WAV_WriteU32LE(m_output, 50 + data_size);
-        WAV_WriteCString(m_output, "WAVE");
-        // fmt
-        WAV_WriteCString(m_output, "fmt ");
-        WAV_WriteU32LE(m_output, 18);
-        WAV_WriteU16LE(m_output, (uint16_t)WaveFormat::IEEE_FLOAT);
-        WAV_WriteU16LE(m_output, AudioFrame<float>::channel_count);
-        WAV_WriteU32LE(m_output, m_sample_rate);
-        WAV_WriteU32LE(m_output, m_sample_rate * sizeof(AudioFrame<float>));
-        WAV_WriteU16LE(m_output, sizeof(AudioFrame<float>));
-        WAV_WriteU16LE(m_output, 8 * sizeof(float));
+    WAV_Seek(m_output, 0);
+    WriteHeader(false);
+    assert(ftell(m_output) == (long)WAV_GetHeaderSize(m_format, m_owned));
+
+    Close();
+
+    // Cut off anything written past the loop end
+    if (truncate)
+    {
+        std::error_code ec;
+        std::filesystem::resize_file(m_path,
+                                     WAV_GetHeaderSize(m_format, m_owned) +
+                                         m_frames_written * WAV_GetFormatInfo(m_format).frame_size + m_trailer_size,
+                                     ec);
+        if (ec)
+        {
+            fprintf(stderr,
+                    "Failed to trim %s at the loop end: %s\n",
+                    m_path.generic_string().c_str(),
+                    ec.message().c_str());
+        }
+    }
+}
+
+void WAV_Handle::WriteHeader(bool streaming)
+{
+    const WAV_FormatInfo info = WAV_GetFormatInfo(m_format);
+
+    const uint64_t data_size = m_frames_written * info.frame_size;
+    // Everything after the RIFF size field
+    const uint64_t riff_size = WAV_GetHeaderSize(m_format, m_owned) - 8 + data_size + m_trailer_size;
+    // Use RF64 once any of the 32-bit size fields would overflow. A stream of unknown length instead marks every size
+    // as UINT32_MAX, which most readers take to mean "read until EOF".
+    const bool is_rf64   = !streaming && (riff_size > UINT32_MAX || m_frames_written > UINT32_MAX);
+    const bool max_sizes = streaming || is_rf64;
+
+    // RIFF header
+    WAV_WriteCString(m_output, is_rf64 ? "RF64" : "RIFF");
+    WAV_WriteU32LE(m_output, max_sizes ? UINT32_MAX : (uint32_t)riff_size);
+    WAV_WriteCString(m_output, "WAVE");
+    // ds64 for RF64, otherwise a JUNK chunk of the same size that reserved the space
+    if (m_owned)
+    {
+        WAV_WriteCString(m_output, is_rf64 ? "ds64" : "JUNK");
+        WAV_WriteU32LE(m_output, WAV_DS64_SIZE);
+        if (is_rf64)
+        {
+            WAV_WriteU64LE(m_output, riff_size);
+            WAV_WriteU64LE(m_output, data_size);
+            WAV_WriteU64LE(m_output, m_frames_written);
+            // table length
+            WAV_WriteU32LE(m_output, 0);
+        }
+        else
+        {
+            for (uint32_t i = 0; i < WAV_DS64_SIZE; ++i)
+            {
+                WAV_WriteBytes(m_output, "\0", 1);
+            }
+        }
+    }
+    // fmt
+    WAV_WriteCString(m_output, "fmt ");
+    WAV_WriteU32LE(m_output, info.is_float ? 18 : 16);
+    WAV_WriteU16LE(m_output, (uint16_t)(info.is_float ? WaveFormat::IEEE_FLOAT : WaveFormat::PCM));
+    WAV_WriteU16LE(m_output, AudioFrame<int16_t>::channel_count);
+    WAV_WriteU32LE(m_output, m_sample_rate);
+    WAV_WriteU32LE(m_output, m_sample_rate * info.frame_size);
+    WAV_WriteU16LE(m_output, info.frame_size);
+    WAV_WriteU16LE(m_output, info.bits_per_sample);
+    if (info.is_float)
+    {
         WAV_WriteU16LE(m_output, 0);
         // fact
         WAV_WriteCString(m_output, "fact");
         WAV_WriteU32LE(m_output, 4);
-        WAV_WriteU32LE(m_output, RangeCast<uint32_t>(m_frames_written));
-        // data
-        WAV_WriteCString(m_output, "data");
-        WAV_WriteU32LE(m_output, data_size);
-
-        assert(ftell(m_output) == 58);
-
-        break;
-    }
+        WAV_WriteU32LE(m_output, max_sizes ? UINT32_MAX : (uint32_t)m_frames_written);
     }
-
-    Close();
+    // data
+    WAV_WriteCString(m_output, "data");
+    WAV_WriteU32LE(m_output, max_sizes ? UINT32_MAX : (uint32_t)data_size);
 }
@@ -7,6 +7,7 @@
 #include <cstdint>
 #include <cstdio>
 #include <filesystem>
+#include <span>
 
 class WAV_Handle
 {
@@ -23,17 +24,39 @@ public:
     void SetSampleRate(uint32_t sample_rate);
 
     void OpenStdout(AudioFormat format);
-    void Open(const char* filename, AudioFormat format);
-    void Open(const std::filesystem::path& filename, AudioFormat format);
+    // Writes to `output` without seeking or closing it. If `write_header` is set, the samples are preceded by a header
+    // for a stream of unknown length; SetSampleRate must be called first.
+    void OpenStream(FILE* output, AudioFormat format, bool write_header);
+    // Returns false if the file couldn't be created.
+    bool Open(const char* filename, AudioFormat format);
+    bool Open(const std::filesystem::path& filename, AudioFormat format);
     void Close();
     void Write(const AudioFrame<int16_t>& frame);
     void Write(const AudioFrame<int32_t>& frame);
     void Write(const AudioFrame<float>& frame);
+    // Writes a block of frames at once. Prefer these over the single frame overloads.
+    void Write(std::span<const AudioFrame<int16_t>> frames);
+    void Write(std::span<const AudioFrame<int32_t>> frames);
+    void Write(std::span<const AudioFrame<float>> frames);
+    // Marks frames [start, end) as a loop. Finish cuts any frames written past `end` from the file and describes the
+    // loop in a smpl chunk. Only valid for files created with Open.
+    void SetLoop(uint64_t start, uint64_t end);
     void Finish();
 
 private:
-    FILE*       m_output = nullptr;
-    uint64_t    m_frames_written = 0;
-    AudioFormat m_format;
-    uint32_t    m_sample_rate;
+    void WriteHeader(bool streaming);
+    void WriteSampleChunk();
+
+private:
+    FILE*                 m_output = nullptr;
+    bool                  m_owned = false;
+    uint64_t              m_frames_written = 0;
+    AudioFormat           m_format;
+    uint32_t              m_sample_rate;
+    std::filesystem::path m_path;
+    bool                  m_has_loop = false;
+    uint64_t              m_loop_start = 0;
+    uint64_t              m_loop_end = 0;
+    // Size of chunks following the sample data.
+    uint64_t              m_trailer_size = 0;
 };
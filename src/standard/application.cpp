@@ -129,7 +129,7 @@ bool Application::AllocateInstance(Instance** result)
 
 void Application::SendMIDI(size_t instance_id, std::span<const uint8_t> bytes)
 {
-    m_instances[instance_id].GetEmulator().PostMIDI(bytes);
+    m_instances[instance_id].PostMIDI(bytes);
 }
 
 void Application::BroadcastMIDI(std::span<const uint8_t> bytes)
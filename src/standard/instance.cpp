@@ -1,11 +1,16 @@
 #include "instance.h"
 
+#include <algorithm>
 #include <bit>
+#include <chrono>
 
 #include "audio_sdl.h"
 #include "output_asio.h"
 #include "output_sdl.h"
 
+// Large enough to hold several seconds of SysEx at MIDI's 3125 bytes per second while the emulator catches up.
+constexpr size_t MIDI_QUEUE_CAPACITY = 256 * 1024;
+
 template <typename ElemT>
 size_t CalcRingbufferSizeBytes(uint32_t buffer_size, uint32_t buffer_count)
 {
@@ -37,6 +42,8 @@ bool Instance::Initialize(const InstanceParameters& params)
     m_buffer_count = params.buffer_count;
     m_gain         = params.gain;
 
+    m_midi_queue.Init(MIDI_QUEUE_CAPACITY);
+
     if (params.enable_lcd)
     {
         m_sdl_lcd = std::make_unique<LCD_SDL_Backend>();
@@ -73,6 +80,61 @@ bool Instance::Initialize(const InstanceParameters& params)
     return true;
 }
 
+void Instance::PostMIDI(std::span<const uint8_t> bytes)
+{
+    const auto     now       = std::chrono::steady_clock::now().time_since_epoch();
+    const uint64_t timestamp = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+
+    if (!m_midi_queue.TryPush(bytes, timestamp) && m_midi_queue.GetDroppedMessageCount() == 1)
+    {
+        fprintf(stderr, "WARNING: #%02zu: MIDI input queue is full; dropping messages\n", m_instance_id);
+    }
+}
+
+void Instance::DrainMIDI()
+{
+    if (m_midi_queue.IsEmpty())
+    {
+        return;
+    }
+
+    m_midi_queue.Drain([this](uint64_t timestamp, std::span<const uint8_t> bytes) {
+        m_emu.PostMIDIAt(ScheduleMIDI(timestamp), bytes);
+    });
+}
+
+// The emulator renders ahead of the audio device in bursts, so posting MIDI as soon as it is drained would shift each
+// message by however far ahead the emulator happened to be. Instead, messages keep the spacing they arrived with:
+// the first one is scheduled one buffer ahead of the emulator, and the rest relative to it. If that would put a
+// message in the past or far ahead, e.g. after the audio device stalled or the clocks drifted apart, the mapping
+// starts over from that message.
+uint64_t Instance::ScheduleMIDI(uint64_t timestamp)
+{
+    const uint64_t now            = m_emu.GetMCU().cycles;
+    const uint64_t cycles_per_sec = PCM_GetCyclesPerSecond(m_emu.GetPCM());
+    const uint64_t latency = (uint64_t)m_buffer_size * cycles_per_sec / PCM_GetOutputFrequency(m_emu.GetPCM());
+
+    uint64_t cycle = 0;
+    if (m_midi_anchored && timestamp >= m_midi_anchor_time)
+    {
+        const double elapsed = (double)(timestamp - m_midi_anchor_time) * 1e-9;
+        cycle                = m_midi_anchor_cycle + (uint64_t)(elapsed * (double)cycles_per_sec);
+    }
+
+    if (!m_midi_anchored || cycle < now || cycle > now + 4 * latency)
+    {
+        m_midi_anchored     = true;
+        m_midi_anchor_time  = timestamp;
+        m_midi_anchor_cycle = now + latency;
+        cycle               = m_midi_anchor_cycle;
+    }
+
+    // never reorder messages across a new anchor
+    cycle             = std::max(cycle, m_midi_last_cycle);
+    m_midi_last_cycle = cycle;
+    return cycle;
+}
+
 template <typename SampleT>
 void Instance::Prepare()
 {
@@ -112,6 +174,7 @@ void Instance::RunInstanceASIO(Instance& self)
             SDL_Delay(1);
         }
 
+        self.DrainMIDI();
         self.m_emu.Step();
     }
 }
@@ -155,6 +218,7 @@ void Instance::RunInstanceSDL(Instance& self)
             SDL_Delay(1);
         }
 
+        self.DrainMIDI();
         self.m_emu.Step();
     }
 }
@@ -331,6 +395,15 @@ void Instance::JoinThread()
 {
     m_running = false;
     m_thread.join();
+
+    if (const size_t dropped = m_midi_queue.GetDroppedMessageCount())
+    {
+        fprintf(stderr,
+                "#%02zu: dropped %zu MIDI messages (%zu bytes) because the input queue was full\n",
+                m_instance_id,
+                dropped,
+                m_midi_queue.GetDroppedByteCount());
+    }
 }
 
 bool Instance::IsQuitRequested() const
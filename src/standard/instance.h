@@ -6,6 +6,7 @@
 
 #include "emu.h"
 #include "lcd_sdl.h"
+#include "midi_queue.h"
 #include "output_common.h"
 #include "ringbuffer.h"
 
@@ -45,6 +46,10 @@ public:
         return m_emu;
     }
 
+    // Queues MIDI for the instance thread, stamped with the time it arrived. Safe to call from one input thread while
+    // the instance is running.
+    void PostMIDI(std::span<const uint8_t> bytes);
+
     void OpenSDLAudio();
 
 #if NUKED_ENABLE_ASIO
@@ -70,6 +75,12 @@ private:
 
     mcu_sample_callback PickSampleCallback(AudioOutputKind kind) const;
 
+    // Moves queued MIDI into the emulator, scheduled at the cycles matching the times it arrived.
+    void DrainMIDI();
+
+    // Returns the MCU cycle a message that arrived at `timestamp` should be posted at.
+    uint64_t ScheduleMIDI(uint64_t timestamp);
+
     template <typename SampleT>
     static void RunInstanceSDL(Instance& self);
 
@@ -98,6 +109,15 @@ private:
     std::thread m_thread;
     AudioFormat m_format;
 
+    // written by MIDI input thread, read by instance thread
+    MIDIQueue m_midi_queue;
+
+    // read and written by instance thread; maps MIDI arrival times (steady clock nanoseconds) onto MCU cycles
+    bool     m_midi_anchored     = false;
+    uint64_t m_midi_anchor_time  = 0;
+    uint64_t m_midi_anchor_cycle = 0;
+    uint64_t m_midi_last_cycle   = 0;
+
     // read by instance thread, written by main thread
     std::atomic<bool> m_running = false;
 
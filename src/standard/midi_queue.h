@@ -0,0 +1,172 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+// Lock-free single-producer/single-consumer queue of MIDI messages. The producer is the thread receiving MIDI input and
+// the consumer is the thread running the emulator. Each message carries the timestamp it was received at so that the
+// consumer can schedule it at the matching point in emulated time.
+//
+// Messages are pushed whole: if a message doesn't fit, none of it is queued and it is counted as dropped instead, so a
+// full queue never lets the emulator see a truncated SysEx message.
+class MIDIQueue
+{
+public:
+    // Bytes taken by each message in addition to its own bytes.
+    static constexpr size_t HEADER_SIZE = 16;
+
+    MIDIQueue() = default;
+
+    MIDIQueue(const MIDIQueue&)            = delete;
+    MIDIQueue& operator=(const MIDIQueue&) = delete;
+
+    // Allocates room for `capacity` bytes, rounded up to a power of two. Each message also takes `HEADER_SIZE` bytes.
+    // Must be called before the queue is shared between threads.
+    void Init(size_t capacity)
+    {
+        m_capacity = std::bit_ceil(capacity);
+        m_buffer   = std::make_unique<uint8_t[]>(m_capacity);
+        m_scratch  = std::make_unique<uint8_t[]>(m_capacity);
+        m_read     = 0;
+        m_write    = 0;
+    }
+
+    // Producer only. Returns false if the message was dropped because the queue doesn't have room for all of it.
+    bool TryPush(std::span<const uint8_t> bytes, uint64_t timestamp)
+    {
+        const size_t write = m_write.load(std::memory_order_relaxed);
+        const size_t read  = m_read.load(std::memory_order_acquire);
+        const size_t used  = write - read;
+        const size_t size  = HEADER_SIZE + bytes.size();
+
+        if (size > m_capacity - used)
+        {
+            m_dropped_messages.fetch_add(1, std::memory_order_relaxed);
+            m_dropped_bytes.fetch_add(bytes.size(), std::memory_order_relaxed);
+            return false;
+        }
+
+        const Header header{.timestamp = timestamp, .size = (uint32_t)bytes.size()};
+        Store(write, std::span((const uint8_t*)&header, HEADER_SIZE));
+        Store(write + HEADER_SIZE, bytes);
+
+        m_write.store(write + size, std::memory_order_release);
+
+        const size_t new_used = used + size;
+        if (new_used > m_peak_bytes.load(std::memory_order_relaxed))
+        {
+            m_peak_bytes.store(new_used, std::memory_order_relaxed);
+        }
+
+        return true;
+    }
+
+    // Consumer only. Passes every queued message to `post(timestamp, bytes)` in order and returns how many were passed.
+    // `bytes` is only valid during the call.
+    template <typename PostFn>
+    size_t Drain(PostFn&& post)
+    {
+        size_t       read  = m_read.load(std::memory_order_relaxed);
+        const size_t write = m_write.load(std::memory_order_acquire);
+
+        size_t count = 0;
+        while (read != write)
+        {
+            Header header;
+            Load(read, std::span((uint8_t*)&header, HEADER_SIZE));
+
+            const size_t first = (read + HEADER_SIZE) & (m_capacity - 1);
+            if (first + header.size <= m_capacity)
+            {
+                post(header.timestamp, std::span<const uint8_t>(&m_buffer[first], header.size));
+            }
+            else
+            {
+                // The message wraps around the end of the buffer
+                Load(read + HEADER_SIZE, std::span(m_scratch.get(), header.size));
+                post(header.timestamp, std::span<const uint8_t>(m_scratch.get(), header.size));
+            }
+
+            read += HEADER_SIZE + header.size;
+            ++count;
+        }
+
+        m_read.store(read, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer only. Cheap check for whether Drain has anything to do.
+    bool IsEmpty() const
+    {
+        return m_read.load(std::memory_order_relaxed) == m_write.load(std::memory_order_acquire);
+    }
+
+    size_t GetCapacity() const
+    {
+        return m_capacity;
+    }
+
+    // Statistics; safe to read from any thread.
+    size_t GetDroppedMessageCount() const
+    {
+        return m_dropped_messages.load(std::memory_order_relaxed);
+    }
+
+    size_t GetDroppedByteCount() const
+    {
+        return m_dropped_bytes.load(std::memory_order_relaxed);
+    }
+
+    // Highest number of bytes that were waiting at once, including message headers.
+    size_t GetPeakByteCount() const
+    {
+        return m_peak_bytes.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Header
+    {
+        uint64_t timestamp;
+        uint32_t size;
+    };
+
+    static_assert(sizeof(Header) == HEADER_SIZE);
+
+    void Store(size_t index, std::span<const uint8_t> bytes)
+    {
+        for (size_t i = 0; i < bytes.size(); ++i)
+        {
+            m_buffer[(index + i) & (m_capacity - 1)] = bytes[i];
+        }
+    }
+
+    void Load(size_t index, std::span<uint8_t> bytes) const
+    {
+        for (size_t i = 0; i < bytes.size(); ++i)
+        {
+            bytes[i] = m_buffer[(index + i) & (m_capacity - 1)];
+        }
+    }
+
+    // Keep the indices on separate cache lines so that the producer and consumer don't contend.
+    static constexpr size_t CACHE_LINE = 64;
+
+    std::unique_ptr<uint8_t[]> m_buffer;
+    size_t                     m_capacity = 0;
+
+    // Written by the consumer only. Holds a message that wraps around the end of `m_buffer`.
+    std::unique_ptr<uint8_t[]> m_scratch;
+
+    // Both indices count bytes since Init and only wrap when masked with `m_capacity - 1`.
+    alignas(CACHE_LINE) std::atomic<size_t> m_read  = 0;
+    alignas(CACHE_LINE) std::atomic<size_t> m_write = 0;
+
+    // Written by the producer only.
+    alignas(CACHE_LINE) std::atomic<size_t> m_dropped_messages = 0;
+    std::atomic<size_t> m_dropped_bytes = 0;
+    std::atomic<size_t> m_peak_bytes    = 0;
+};
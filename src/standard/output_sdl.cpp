@@ -3,7 +3,11 @@
 #include "audio_sdl.h"
 #include "bounded_vector.h"
 #include "cast.h"
+#include "common/resampler.h"
 #include <SDL.h>
+#include <algorithm>
+#include <type_traits>
+#include <vector>
 
 // one per instance
 const size_t MAX_STREAMS = 16;
@@ -19,18 +23,30 @@ struct SDLOutput
 
     // Parameters requested by the user
     AudioOutputParameters create_params;
+
+    // Set when the device doesn't run at the emulator frequency. We convert the sample rate ourselves instead of
+    // letting SDL do it so that all frontends share the same converter.
+    bool                           resample = false;
+    common::Resampler              resampler;
+    std::vector<AudioFrame<float>> native_frames;
+    std::vector<AudioFrame<float>> resampled_frames;
+    size_t                         resampled_read = 0;
+
+    // Sources are summed into one of these before being clipped to the device format.
+    std::vector<AudioFrame<int32_t>> accum_s16;
+    std::vector<AudioFrame<int64_t>> accum_s32;
+    std::vector<AudioFrame<float>>   accum_f32;
 };
 
 static SDLOutput g_output;
 
+// Mixes one buffer of frames at the emulator frequency from all sources, then converts it to the device frequency.
 template <typename SampleT>
-void AudioCallback(void* userdata, Uint8* stream, int len)
+void ResampleNextBuffer()
 {
-    (void)userdata;
-
     using Frame = AudioFrame<SampleT>;
 
-    memset(stream, 0, (size_t)len);
+    g_output.native_frames.assign(g_output.create_params.buffer_size, AudioFrame<float>{});
 
     for (RingbufferView* view : g_output.views)
     {
@@ -39,11 +55,86 @@ void AudioCallback(void* userdata, Uint8* stream, int len)
             auto span = view->UncheckedPrepareRead<Frame>(g_output.create_params.buffer_size);
             for (size_t samp = 0; samp < span.size(); ++samp)
             {
-                MixFrame(*((Frame*)stream + samp), span[samp]);
+                MixFrame(g_output.native_frames[samp], common::ToResamplerFrame(span[samp]));
             }
             view->UncheckedFinishRead<Frame>(g_output.create_params.buffer_size);
         }
     }
+
+    g_output.resampled_frames.clear();
+    g_output.resampled_read = 0;
+    g_output.resampler.Process(g_output.native_frames, g_output.resampled_frames);
+}
+
+template <typename SampleT>
+void ResampledAudioCallback(Uint8* stream, int len)
+{
+    using Frame = AudioFrame<SampleT>;
+
+    Frame* const out        = (Frame*)stream;
+    const size_t out_frames = (size_t)len / sizeof(Frame);
+
+    size_t written = 0;
+    while (written < out_frames)
+    {
+        if (g_output.resampled_read == g_output.resampled_frames.size())
+        {
+            ResampleNextBuffer<SampleT>();
+            continue;
+        }
+
+        out[written] = common::FromResamplerFrame<SampleT>(g_output.resampled_frames[g_output.resampled_read]);
+        ++written;
+        ++g_output.resampled_read;
+    }
+}
+
+template <typename SampleT>
+std::vector<AudioFrame<AudioAccumulatorT<SampleT>>>& GetAccumulator()
+{
+    if constexpr (std::is_same_v<SampleT, int16_t>)
+    {
+        return g_output.accum_s16;
+    }
+    else if constexpr (std::is_same_v<SampleT, int32_t>)
+    {
+        return g_output.accum_s32;
+    }
+    else
+    {
+        return g_output.accum_f32;
+    }
+}
+
+template <typename SampleT>
+void AudioCallback(void* userdata, Uint8* stream, int len)
+{
+    (void)userdata;
+
+    using Frame = AudioFrame<SampleT>;
+
+    if (g_output.resample)
+    {
+        ResampledAudioCallback<SampleT>(stream, len);
+        return;
+    }
+
+    const size_t frame_count = (size_t)len / sizeof(Frame);
+
+    auto& accum = GetAccumulator<SampleT>();
+    accum.assign(frame_count, {});
+
+    for (RingbufferView* view : g_output.views)
+    {
+        if (view->GetReadableElements<Frame>() >= g_output.create_params.buffer_size)
+        {
+            auto span = view->UncheckedPrepareRead<Frame>(g_output.create_params.buffer_size);
+            AccumulateFrames(accum.data(), span.data(), std::min(span.size(), frame_count));
+            view->UncheckedFinishRead<Frame>(g_output.create_params.buffer_size);
+        }
+    }
+
+    NarrowFrames((Frame*)stream, accum.data(), frame_count);
 }
 
 bool Out_SDL_QueryOutputs(AudioOutputList& list)
@@ -97,7 +188,7 @@ bool Out_SDL_Create(const char* device_name, const AudioOutputParameters& params
         break;
     }
 
-    g_output.device = SDL_OpenAudioDevice(device_name, 0, &spec, &spec_actual, 0);
+    g_output.device = SDL_OpenAudioDevice(device_name, 0, &spec, &spec_actual, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
 
     if (!g_output.device)
     {
@@ -125,6 +216,30 @@ bool Out_SDL_Create(const char* device_name, const AudioOutputParameters& params
     g_output.requested_spec = spec;
     g_output.actual_spec    = spec_actual;
 
+    g_output.resample = spec_actual.freq != spec.freq;
+    if (g_output.resample)
+    {
+        fprintf(stderr, "Converting audio from %d Hz to %d Hz\n", spec.freq, spec_actual.freq);
+        g_output.resampler.Init(RangeCast<uint32_t>(spec.freq), RangeCast<uint32_t>(spec_actual.freq));
+        g_output.native_frames.reserve(params.buffer_size);
+        g_output.resampled_frames.clear();
+        g_output.resampled_read = 0;
+    }
+
+    // Reserve accumulators up front so the audio callback doesn't allocate.
+    switch (params.format)
+    {
+    case AudioFormat::S16:
+        g_output.accum_s16.reserve((size_t)spec_actual.samples);
+        break;
+    case AudioFormat::S32:
+        g_output.accum_s32.reserve((size_t)spec_actual.samples);
+        break;
+    case AudioFormat::F32:
+        g_output.accum_f32.reserve((size_t)spec_actual.samples);
+        break;
+    }
+
     return true;
 }
 
@@ -0,0 +1,66 @@
+import argparse
+import hashlib
+import pathlib
+import re
+import subprocess
+import sys
+
+# Rewrites the expected hashes in CMakeLists.txt by rendering every test with the given renderer. Run this after a
+# change that is meant to alter the rendered output, then review the diff.
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--render-exe", type=str, required=True)
+parser.add_argument("--rom-directory", type=str, required=True)
+parser.add_argument("--jv880-nvram", type=str, default="")
+
+TEST_RE = re.compile(
+    r'add_render_test(?P<multi>_multi_instance)?\("(?P<romset>[^"]+)" "(?P<filename>[^"]+)"'
+    r'(?: (?P<instances>\d+))? "(?P<sha256>[0-9a-f]{64})"\)'
+)
+
+
+def render_hash(args, match):
+    here = pathlib.Path(__file__).parent
+    romset = match["romset"]
+
+    cmd = [
+        args.render_exe,
+        "--stdout",
+        str(here / match["filename"]),
+        "--rom-directory",
+        args.rom_directory,
+        "--romset",
+        romset,
+    ]
+    if match["multi"]:
+        cmd += ["--reset", "gm", "--instances", match["instances"]]
+    elif romset == "jv880":
+        cmd += ["--nvram", args.jv880_nvram]
+    else:
+        cmd += ["--reset", "gm"]
+
+    with subprocess.Popen(cmd, stdout=subprocess.PIPE) as proc:
+        digest = hashlib.file_digest(proc.stdout, "sha256")
+    if proc.wait() != 0:
+        sys.exit(f"render failed: {' '.join(cmd)}")
+    return digest.hexdigest()
+
+
+def main():
+    args = parser.parse_args()
+
+    cmake_path = pathlib.Path(__file__).parent / "CMakeLists.txt"
+    text = cmake_path.read_text()
+
+    def replace(match):
+        sha256 = render_hash(args, match)
+        if sha256 != match["sha256"]:
+            print(f"{match['romset']} {match['filename']}: {sha256}")
+        line = match[0]
+        return line.replace(match["sha256"], sha256)
+
+    cmake_path.write_text(TEST_RE.sub(replace, text))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,99 @@
+#include "standard/midi_queue.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <thread>
+#include <vector>
+
+struct DrainedMessage
+{
+    uint64_t             timestamp;
+    std::vector<uint8_t> bytes;
+
+    bool operator==(const DrainedMessage&) const = default;
+};
+
+static std::vector<DrainedMessage> DrainAll(MIDIQueue& queue)
+{
+    std::vector<DrainedMessage> result;
+    queue.Drain([&result](uint64_t timestamp, std::span<const uint8_t> bytes) {
+        result.push_back({timestamp, std::vector<uint8_t>(bytes.begin(), bytes.end())});
+    });
+    return result;
+}
+
+TEST_CASE("MIDIQueue")
+{
+    MIDIQueue queue;
+    queue.Init(40);
+    REQUIRE(queue.GetCapacity() == 64);
+    REQUIRE(queue.IsEmpty());
+
+    const std::vector<uint8_t> note_on = {0x90, 0x3C, 0x7F};
+    REQUIRE(queue.TryPush(note_on, 1));
+    REQUIRE(queue.TryPush(note_on, 2));
+    REQUIRE(queue.TryPush(note_on, 3));
+    REQUIRE(!queue.IsEmpty());
+
+    // Doesn't fit; the whole message is dropped rather than a prefix of it
+    const uint8_t sysex[] = {0xF0, 0x41, 0x10, 0xF7};
+    REQUIRE(!queue.TryPush(sysex, 4));
+    REQUIRE(queue.GetDroppedMessageCount() == 1);
+    REQUIRE(queue.GetDroppedByteCount() == 4);
+    REQUIRE(queue.GetPeakByteCount() == 3 * (MIDIQueue::HEADER_SIZE + 3));
+
+    REQUIRE(DrainAll(queue) == std::vector<DrainedMessage>{{1, note_on}, {2, note_on}, {3, note_on}});
+    REQUIRE(queue.IsEmpty());
+
+    // The first header wraps around the end of the buffer, then the second message's bytes do
+    std::vector<uint8_t> long_sysex(20);
+    for (size_t i = 0; i < long_sysex.size(); ++i)
+    {
+        long_sysex[i] = (uint8_t)i;
+    }
+    REQUIRE(queue.TryPush(long_sysex, 5));
+    REQUIRE(DrainAll(queue) == std::vector<DrainedMessage>{{5, long_sysex}});
+    REQUIRE(queue.TryPush(long_sysex, 6));
+    REQUIRE(DrainAll(queue) == std::vector<DrainedMessage>{{6, long_sysex}});
+    REQUIRE(queue.IsEmpty());
+}
+
+TEST_CASE("MIDIQueue across threads")
+{
+    MIDIQueue queue;
+    queue.Init(256);
+
+    constexpr size_t MESSAGE_COUNT = 100000;
+
+    std::thread producer([&queue] {
+        for (size_t i = 0; i < MESSAGE_COUNT; ++i)
+        {
+            const uint8_t message[] = {0x90, (uint8_t)(i & 0x7F), (uint8_t)((i >> 7) & 0x7F)};
+            while (!queue.TryPush(message, i))
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    std::vector<uint8_t>  received;
+    std::vector<uint64_t> timestamps;
+    received.reserve(MESSAGE_COUNT * 3);
+    timestamps.reserve(MESSAGE_COUNT);
+    while (timestamps.size() < MESSAGE_COUNT)
+    {
+        queue.Drain([&](uint64_t timestamp, std::span<const uint8_t> bytes) {
+            timestamps.push_back(timestamp);
+            received.insert(received.end(), bytes.begin(), bytes.end());
+        });
+    }
+    producer.join();
+
+    bool in_order = received.size() == MESSAGE_COUNT * 3;
+    for (size_t i = 0; in_order && i < MESSAGE_COUNT; ++i)
+    {
+        in_order = timestamps[i] == i && received[i * 3] == 0x90 && received[i * 3 + 1] == (uint8_t)(i & 0x7F) &&
+                   received[i * 3 + 2] == (uint8_t)((i >> 7) & 0x7F);
+    }
+    REQUIRE(in_order);
+    REQUIRE(queue.IsEmpty());
+}
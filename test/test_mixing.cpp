@@ -0,0 +1,63 @@
+#include "audio.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <vector>
+
+TEST_CASE("Mixing int16 clips only the final sum")
+{
+    const std::vector<AudioFrame<int16_t>> a = {{30000, -30000}, {INT16_MAX, INT16_MIN}, {100, -100}};
+    const std::vector<AudioFrame<int16_t>> b = {{30000, -30000}, {INT16_MAX, INT16_MIN}, {-200, 200}};
+    const std::vector<AudioFrame<int16_t>> c = {{-30000, 30000}, {-INT16_MAX, INT16_MAX}, {50, 50}};
+
+    std::vector<AudioFrame<int32_t>> accum(a.size());
+    AccumulateFrames(accum.data(), a.data(), a.size());
+    AccumulateFrames(accum.data(), b.data(), b.size());
+    AccumulateFrames(accum.data(), c.data(), c.size());
+
+    std::vector<AudioFrame<int16_t>> result(a.size());
+    NarrowFrames(result.data(), accum.data(), accum.size());
+
+    // a + b would have clipped to INT16_MAX before c was added
+    REQUIRE(result[0].left == 30000);
+    REQUIRE(result[0].right == -30000);
+    REQUIRE(result[1].left == INT16_MAX);
+    REQUIRE(result[1].right == INT16_MIN);
+    REQUIRE(result[2].left == -50);
+    REQUIRE(result[2].right == 150);
+}
+
+TEST_CASE("Mixing int32 clips only the final sum")
+{
+    const std::vector<AudioFrame<int32_t>> a = {{INT32_MAX, INT32_MIN}, {INT32_MAX, 1}};
+    const std::vector<AudioFrame<int32_t>> b = {{INT32_MAX, -1000}, {INT32_MAX, 2}};
+    const std::vector<AudioFrame<int32_t>> c = {{-INT32_MAX, INT32_MAX}, {0, 3}};
+
+    std::vector<AudioFrame<int64_t>> accum(a.size());
+    AccumulateFrames(accum.data(), a.data(), a.size());
+    AccumulateFrames(accum.data(), b.data(), b.size());
+    AccumulateFrames(accum.data(), c.data(), c.size());
+
+    std::vector<AudioFrame<int32_t>> result(a.size());
+    NarrowFrames(result.data(), accum.data(), accum.size());
+
+    REQUIRE(result[0].left == INT32_MAX);
+    REQUIRE(result[0].right == -1001);
+    REQUIRE(result[1].left == INT32_MAX);
+    REQUIRE(result[1].right == 6);
+}
+
+TEST_CASE("Mixing float does not clip")
+{
+    const std::vector<AudioFrame<float>> a = {{0.75f, -0.75f}};
+    const std::vector<AudioFrame<float>> b = {{0.75f, -0.75f}};
+
+    std::vector<AudioFrame<float>> accum(a.size());
+    AccumulateFrames(accum.data(), a.data(), a.size());
+    AccumulateFrames(accum.data(), b.data(), b.size());
+
+    std::vector<AudioFrame<float>> result(a.size());
+    NarrowFrames(result.data(), accum.data(), accum.size());
+
+    REQUIRE(result[0].left == 1.5f);
+    REQUIRE(result[0].right == -1.5f);
+}
@@ -0,0 +1,62 @@
+#include "renderer/output_spec.h"
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+
+TEST_CASE("Output spec parsing")
+{
+    using namespace Catch::Matchers;
+
+    SECTION("No settings")
+    {
+        const R_OutputSpec spec = R_ParseOutputSpec("out.wav");
+        REQUIRE(spec.filename == "out.wav");
+        REQUIRE(!spec.has_format);
+        REQUIRE(!spec.has_gain);
+    }
+
+    SECTION("Format and gain")
+    {
+        const R_OutputSpec spec = R_ParseOutputSpec("f32,-6db:master.wav");
+        REQUIRE(spec.filename == "master.wav");
+        REQUIRE(spec.has_format);
+        REQUIRE(spec.format == AudioFormat::F32);
+        REQUIRE(spec.container == R_OutputContainer::Wav);
+        REQUIRE(spec.has_gain);
+        REQUIRE_THAT(spec.gain, WithinRel(0.501187f, 0.0001f));
+    }
+
+    SECTION("FLAC")
+    {
+        const R_OutputSpec spec = R_ParseOutputSpec("flac24:archive.flac");
+        REQUIRE(spec.filename == "archive.flac");
+        REQUIRE(spec.container == R_OutputContainer::Flac);
+        REQUIRE(spec.flac_bits_per_sample == 24);
+    }
+
+    SECTION("Explicit scalar gain")
+    {
+        const R_OutputSpec spec = R_ParseOutputSpec("gain=0.5,s32:quiet.wav");
+        REQUIRE(spec.filename == "quiet.wav");
+        REQUIRE(spec.format == AudioFormat::S32);
+        REQUIRE(spec.has_gain);
+        REQUIRE_THAT(spec.gain, WithinRel(0.5f, 0.0001f));
+    }
+
+    SECTION("A bare number is part of the filename")
+    {
+        const R_OutputSpec spec = R_ParseOutputSpec("1:take.wav");
+        REQUIRE(spec.filename == "1:take.wav");
+        REQUIRE(!spec.has_gain);
+        REQUIRE(!spec.has_format);
+
+        REQUIRE(R_ParseOutputSpec("s16,2:take.wav").filename == "s16,2:take.wav");
+    }
+
+    SECTION("Drive letters and invalid settings")
+    {
+        REQUIRE(R_ParseOutputSpec("C:\\out.wav").filename == "C:\\out.wav");
+        REQUIRE(R_ParseOutputSpec("s16,s32:out.wav").filename == "s16,s32:out.wav");
+        REQUIRE(R_ParseOutputSpec("-3db,-3db:out.wav").filename == "-3db,-3db:out.wav");
+        REQUIRE(R_ParseOutputSpec(":out.wav").filename == ":out.wav");
+    }
+}
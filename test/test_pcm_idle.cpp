@@ -0,0 +1,143 @@
+#include "backend/mcu.h"
+#include "backend/pcm.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace
+{
+
+struct PCMHarness
+{
+    std::unique_ptr<mcu_t>           mcu = std::make_unique<mcu_t>();
+    std::unique_ptr<pcm_t>           pcm = std::make_unique<pcm_t>();
+    std::vector<AudioFrame<int32_t>> output;
+
+    explicit PCMHarness(bool idle_bypass)
+    {
+        mcu->callback_userdata = this;
+        mcu->sample_callback   = [](void* userdata, const AudioFrame<int32_t>& frame) {
+            static_cast<PCMHarness*>(userdata)->output.push_back(frame);
+        };
+
+        PCM_Init(*pcm, *mcu);
+        pcm->enable_idle_bypass = idle_bypass;
+
+        for (size_t i = 0; i < sizeof(pcm->waverom1); ++i)
+        {
+            pcm->waverom1[i] = static_cast<uint8_t>(i * 37 + (i >> 8));
+        }
+
+        // oversampling, 4-bit noise dither, 24 slots
+        PCM_Write(*pcm, 0x3c, 0x7d);
+        PCM_Write(*pcm, 0x3d, 0x17);
+    }
+
+    void Run(uint64_t samples)
+    {
+        const uint64_t cycles_per_sample = (uint64_t)(pcm->config.reg_slots + 1) * 25;
+        PCM_Update(*pcm, pcm->cycles + samples * cycles_per_sample);
+    }
+
+    void WriteRam1(uint8_t channel, int ix, uint32_t value)
+    {
+        // ix 6 and 7 aren't addressable, those addresses are the voice enable registers
+        const uint32_t base = ((ix & 1) ? 0x20 : 0) | ((ix & 4) ? 0 : 8) | ((ix & 2) ? 0 : 4);
+        PCM_Write(*pcm, 0x3e, channel);
+        PCM_Write(*pcm, base + 1, static_cast<uint8_t>(value >> 16));
+        PCM_Write(*pcm, base + 2, static_cast<uint8_t>(value >> 8));
+        PCM_Write(*pcm, base + 3, static_cast<uint8_t>(value));
+    }
+
+    void WriteRam2(uint8_t channel, int ix, uint16_t value)
+    {
+        const uint32_t base = (ix & 8) ? 0x30 + (ix & 7) * 2 : 0x10 + ix * 2;
+        PCM_Write(*pcm, 0x3e, channel);
+        PCM_Write(*pcm, base + 0, static_cast<uint8_t>(value >> 8));
+        PCM_Write(*pcm, base + 1, static_cast<uint8_t>(value));
+    }
+
+    void SetVoiceMask(uint32_t mask)
+    {
+        PCM_Write(*pcm, 0, static_cast<uint8_t>(mask >> 24));
+        PCM_Write(*pcm, 1, static_cast<uint8_t>(mask >> 16));
+        PCM_Write(*pcm, 2, static_cast<uint8_t>(mask >> 8));
+        PCM_Write(*pcm, 3, static_cast<uint8_t>(mask));
+        PCM_Read(*pcm, 0);
+    }
+};
+
+// Sets up the effect slot so that its phase and the chorus taps move while no voices are playing.
+void SetupEffects(PCMHarness& h)
+{
+    h.WriteRam2(2, 0, 0x0300);
+    h.WriteRam1(31, 0, 0x100);
+    h.WriteRam1(31, 2, 0x010);
+    h.WriteRam2(31, 7, 0x0042);
+}
+
+void KeyOnVoice(PCMHarness& h)
+{
+    h.WriteRam2(3, 0, 0x1000);
+    h.WriteRam1(0, 0, 0x8000);
+    h.WriteRam1(0, 2, 0x0100);
+    h.WriteRam2(0, 1, 0x7f7f); // pan
+    h.WriteRam2(0, 2, 0x4040); // reverb/chorus send
+    h.WriteRam2(0, 3, 0xff1f); // envelopes
+    h.WriteRam2(0, 4, 0xff1f);
+    h.WriteRam2(0, 5, 0x801f);
+    h.WriteRam2(0, 6, 0x0002);
+    h.WriteRam2(0, 7, 0x0043);
+    h.Run(2);
+    h.SetVoiceMask(1);
+}
+
+} // namespace
+
+TEST_CASE("PCM idle bypass matches the full path across a key on")
+{
+    PCMHarness full(false);
+    PCMHarness bypass(true);
+
+    for (PCMHarness* h : {&full, &bypass})
+    {
+        SetupEffects(*h);
+        h->Run(20000);
+    }
+
+    REQUIRE(bypass.pcm->idle);
+    REQUIRE(!full.pcm->idle);
+    const size_t idle_frames = full.output.size();
+
+    for (PCMHarness* h : {&full, &bypass})
+    {
+        KeyOnVoice(*h);
+        h->Run(8000);
+    }
+
+    REQUIRE(!bypass.pcm->idle);
+    // the voice must actually be audible for the comparison to mean anything
+    const AudioFrame<int32_t> silence = full.output[idle_frames - 1];
+    bool audible = false;
+    for (size_t i = idle_frames; i < full.output.size(); ++i)
+    {
+        audible |= full.output[i].left != silence.left || full.output[i].right != silence.right;
+    }
+    REQUIRE(audible);
+
+    REQUIRE(full.output.size() == bypass.output.size());
+    size_t first_mismatch = 0;
+    while (first_mismatch < full.output.size() &&
+           full.output[first_mismatch].left == bypass.output[first_mismatch].left &&
+           full.output[first_mismatch].right == bypass.output[first_mismatch].right)
+    {
+        ++first_mismatch;
+    }
+    REQUIRE(first_mismatch == full.output.size());
+
+    REQUIRE(full.pcm->tv_counter == bypass.pcm->tv_counter);
+    REQUIRE(std::memcmp(full.pcm->ram1, bypass.pcm->ram1, sizeof(full.pcm->ram1)) == 0);
+    REQUIRE(std::memcmp(full.pcm->ram2, bypass.pcm->ram2, sizeof(full.pcm->ram2)) == 0);
+}
@@ -0,0 +1,108 @@
+#include "common/resampler.h"
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+
+#include <cmath>
+#include <numbers>
+
+static std::vector<AudioFrame<float>> MakeSine(uint32_t rate, double frequency, size_t frames)
+{
+    std::vector<AudioFrame<float>> result(frames);
+    for (size_t i = 0; i < frames; ++i)
+    {
+        const float value = (float)std::sin(2.0 * std::numbers::pi * frequency * (double)i / (double)rate);
+        result[i]         = {value, -value};
+    }
+    return result;
+}
+
+TEST_CASE("Resampler output length")
+{
+    using namespace common;
+
+    Resampler resampler;
+    resampler.Init(66207, 44100);
+
+    const auto input = MakeSine(66207, 1000.0, 100000);
+
+    // Feed it in uneven pieces to exercise history handling
+    std::vector<AudioFrame<float>> output;
+    size_t                         offset = 0;
+    while (offset < input.size())
+    {
+        const size_t count = std::min<size_t>(1237, input.size() - offset);
+        resampler.Process(std::span(input).subspan(offset, count), output);
+        offset += count;
+    }
+    resampler.Finish(output);
+
+    REQUIRE(output.size() == resampler.ConvertFramePosition(input.size()));
+    REQUIRE(resampler.ConvertFramePosition(66207) == 44100);
+    REQUIRE(resampler.ConvertFramePosition(0) == 0);
+}
+
+TEST_CASE("Resampler preserves in-band sine")
+{
+    using namespace common;
+    using Catch::Matchers::WithinAbs;
+
+    const uint32_t in_rates[]  = {64000, 66207, 32000};
+    const uint32_t out_rates[] = {44100, 48000, 96000};
+
+    for (uint32_t in_rate : in_rates)
+    {
+        for (uint32_t out_rate : out_rates)
+        {
+            Resampler resampler;
+            resampler.Init(in_rate, out_rate);
+
+            const auto                     input = MakeSine(in_rate, 1000.0, in_rate);
+            std::vector<AudioFrame<float>> output;
+            resampler.Process(input, output);
+            resampler.Finish(output);
+
+            // Skip the edges where the filter sees the implicit silence before and after the input
+            for (size_t i = 1000; i < output.size() - 1000; ++i)
+            {
+                const float expected = (float)std::sin(2.0 * std::numbers::pi * 1000.0 * (double)i / (double)out_rate);
+                REQUIRE_THAT(output[i].left, WithinAbs(expected, 1e-3));
+                REQUIRE_THAT(output[i].right, WithinAbs(-expected, 1e-3));
+            }
+        }
+    }
+}
+
+TEST_CASE("Resampler rejects out-of-band sine")
+{
+    using namespace common;
+
+    // 30 kHz is representable at 66207 Hz but not at 44100 Hz
+    Resampler resampler;
+    resampler.Init(66207, 44100);
+
+    const auto                     input = MakeSine(66207, 30000.0, 66207);
+    std::vector<AudioFrame<float>> output;
+    resampler.Process(input, output);
+    resampler.Finish(output);
+
+    float peak = 0;
+    for (size_t i = 1000; i < output.size() - 1000; ++i)
+    {
+        peak = std::max(peak, std::abs(output[i].left));
+    }
+    // -80 dB
+    REQUIRE(peak < 1e-4f);
+}
+
+TEST_CASE("Resampler sample conversion")
+{
+    using namespace common;
+
+    REQUIRE(FromResamplerSample<int16_t>(40000.0f) == INT16_MAX);
+    REQUIRE(FromResamplerSample<int16_t>(-40000.0f) == INT16_MIN);
+    REQUIRE(FromResamplerSample<int16_t>(1.5f) == 2);
+    REQUIRE(FromResamplerSample<int16_t>(-1.5f) == -2);
+    REQUIRE(FromResamplerSample<int32_t>(3e9f) == INT32_MAX);
+    REQUIRE(FromResamplerSample<int32_t>(-3e9f) == INT32_MIN);
+    REQUIRE(FromResamplerSample<float>(2.5f) == 2.5f);
+}
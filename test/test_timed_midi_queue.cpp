@@ -0,0 +1,78 @@
+#include "backend/timed_midi_queue.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <vector>
+
+static std::vector<uint8_t> ReleaseUpTo(TimedMIDIQueue& queue, uint64_t cycle)
+{
+    std::vector<uint8_t> result;
+    queue.Release(cycle, SIZE_MAX, [&result](uint8_t byte) { result.push_back(byte); });
+    return result;
+}
+
+TEST_CASE("TimedMIDIQueue releases bytes at their cycle")
+{
+    TimedMIDIQueue queue;
+    REQUIRE(queue.GetNextCycle() == TimedMIDIQueue::NO_CYCLE);
+
+    const uint8_t note_on[]  = {0x90, 0x3C, 0x7F};
+    const uint8_t note_off[] = {0x80, 0x3C, 0x00};
+    queue.Push(100, note_on);
+    queue.Push(200, note_off);
+    REQUIRE(queue.GetNextCycle() == 100);
+    REQUIRE(queue.GetByteCount() == 6);
+
+    REQUIRE(ReleaseUpTo(queue, 99).empty());
+    REQUIRE(ReleaseUpTo(queue, 150) == std::vector<uint8_t>{0x90, 0x3C, 0x7F});
+    REQUIRE(queue.GetNextCycle() == 200);
+    REQUIRE(ReleaseUpTo(queue, 1000) == std::vector<uint8_t>{0x80, 0x3C, 0x00});
+    REQUIRE(queue.IsEmpty());
+}
+
+TEST_CASE("TimedMIDIQueue orders out of order pushes")
+{
+    TimedMIDIQueue queue;
+
+    const uint8_t a[] = {1, 2};
+    const uint8_t b[] = {3, 4};
+    const uint8_t c[] = {5, 6};
+    const uint8_t d[] = {7};
+    queue.Push(300, a);
+    queue.Push(100, b);
+    queue.Push(300, c);
+    // Same cycle as `b`, but pushed later, so it must not split `b`
+    queue.Push(100, d);
+
+    REQUIRE(queue.GetNextCycle() == 100);
+    REQUIRE(ReleaseUpTo(queue, 300) == std::vector<uint8_t>{3, 4, 7, 1, 2, 5, 6});
+}
+
+TEST_CASE("TimedMIDIQueue limits bytes released at once")
+{
+    TimedMIDIQueue queue;
+
+    // More than the UART buffer can hold, all on one cycle, like a large SysEx dump
+    std::vector<uint8_t> sysex(10000);
+    for (size_t i = 0; i < sysex.size(); ++i)
+    {
+        sysex[i] = (uint8_t)i;
+    }
+    queue.Push(100, sysex);
+
+    std::vector<uint8_t> released;
+    auto post = [&released](uint8_t byte) { released.push_back(byte); };
+
+    queue.Release(100, 8191, post);
+    REQUIRE(released.size() == 8191);
+    REQUIRE(queue.GetByteCount() == 10000 - 8191);
+    REQUIRE(queue.GetNextCycle() == 100);
+
+    // Nothing is released while there is no room
+    queue.Release(101, 0, post);
+    REQUIRE(released.size() == 8191);
+
+    // The remainder comes out in order on a later cycle
+    queue.Release(102, 8191, post);
+    REQUIRE(queue.IsEmpty());
+    REQUIRE(released == sysex);
+}